@@ -8,356 +8,373 @@
 #include <sys/uio.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "contents.h"
 #include "benchmark.h"
 #include "misc.h"
+#include "latency.h"
+#include "cpucap.h"
+#include "provider.h"
+#include "cstage.h"
+
+/* Registered ciphers. keyBits is the strength selected with -k,
+   keyLength the key actually installed (both AES keys for XTS), and a
+   tagLength marks an AEAD. CCM keeps a 7 byte nonce so whole inputs fit
+   its 8 byte length field. */
+struct c_cipher {
+  const char *name;
+  const char *mode;
+  unsigned int cipherMode;
+  unsigned int keyBits;
+  const EVP_CIPHER *(*evp)(void);
+  unsigned int keyLength;
+  int ivLength;
+  int tagLength;
+};
+typedef struct c_cipher CIPHER;
+
+static const CIPHER ciphers[] = {
+  {"AES-128-CBC", "CBC", cipherModeCBC, 128, EVP_aes_128_cbc, 16, 16, 0},
+  {"AES-192-CBC", "CBC", cipherModeCBC, 192, EVP_aes_192_cbc, 24, 16, 0},
+  {"AES-256-CBC", "CBC", cipherModeCBC, 256, EVP_aes_256_cbc, 32, 16, 0},
+  {"AES-128-CFB", "CFB", cipherModeCFB, 128, EVP_aes_128_cfb, 16, 16, 0},
+  {"AES-192-CFB", "CFB", cipherModeCFB, 192, EVP_aes_192_cfb, 24, 16, 0},
+  {"AES-256-CFB", "CFB", cipherModeCFB, 256, EVP_aes_256_cfb, 32, 16, 0},
+  {"AES-128-OFB", "OFB", cipherModeOFB, 128, EVP_aes_128_ofb, 16, 16, 0},
+  {"AES-192-OFB", "OFB", cipherModeOFB, 192, EVP_aes_192_ofb, 24, 16, 0},
+  {"AES-256-OFB", "OFB", cipherModeOFB, 256, EVP_aes_256_ofb, 32, 16, 0},
+  {"AES-128-CTR", "CTR", cipherModeCTR, 128, EVP_aes_128_ctr, 16, 16, 0},
+  {"AES-192-CTR", "CTR", cipherModeCTR, 192, EVP_aes_192_ctr, 24, 16, 0},
+  {"AES-256-CTR", "CTR", cipherModeCTR, 256, EVP_aes_256_ctr, 32, 16, 0},
+  {"AES-128-GCM", "GCM", cipherModeGCM, 128, EVP_aes_128_gcm, 16, 12, 16},
+  {"AES-192-GCM", "GCM", cipherModeGCM, 192, EVP_aes_192_gcm, 24, 12, 16},
+  {"AES-256-GCM", "GCM", cipherModeGCM, 256, EVP_aes_256_gcm, 32, 12, 16},
+  {"AES-128-CCM", "CCM", cipherModeCCM, 128, EVP_aes_128_ccm, 16, 7, 12},
+  {"AES-192-CCM", "CCM", cipherModeCCM, 192, EVP_aes_192_ccm, 24, 7, 12},
+  {"AES-256-CCM", "CCM", cipherModeCCM, 256, EVP_aes_256_ccm, 32, 7, 12},
+#ifndef OPENSSL_NO_OCB
+  {"AES-128-OCB", "OCB", cipherModeOCB, 128, EVP_aes_128_ocb, 16, 12, 16},
+  {"AES-192-OCB", "OCB", cipherModeOCB, 192, EVP_aes_192_ocb, 24, 12, 16},
+  {"AES-256-OCB", "OCB", cipherModeOCB, 256, EVP_aes_256_ocb, 32, 12, 16},
+#endif
+  {"AES-128-XTS", "XTS", cipherModeXTS, 128, EVP_aes_128_xts, 32, 16, 0},
+  {"AES-256-XTS", "XTS", cipherModeXTS, 256, EVP_aes_256_xts, 64, 16, 0},
+#if !defined(OPENSSL_NO_CHACHA) && !defined(OPENSSL_NO_POLY1305)
+  {"CHACHA20-POLY1305", "CHACHA20-POLY1305", cipherModeChaCha20Poly1305,
+   256, EVP_chacha20_poly1305, 32, 12, 16},
+#endif
+};
+
+/* cSettings.cipher is resolved once per run from the selected registry
+   entry, fetched explicitly into fetchedCipher or the implicit
+   EVP_aes_*() object. */
+static EVP_CIPHER *fetchedCipher = NULL;
+static unsigned int fetchMode = fetchModeDefault;
+
+#define bufferModeCopy    (1 << 0)
+#define bufferModeInPlace (1 << 1)
+
+static unsigned int bufferMode = bufferModeCopy;
+
+static cJSON *recordStageJSON(const RESULT *r, unsigned int run,
+                              size_t bytes, const LATENCY *latency) {
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+
+  double perSec = 1000000.0 / resultAvgIntervalByRun(r, run) *
+                  resultThreads(r);
+
+  cJSON_AddNumberToObject(json, "recordsPerSec", recordCount(bytes) * perSec);
+  cJSON_AddNumberToObject(json, "bytesPerSec", bytes * perSec);
+  cJSON_AddItemToObject(json, "latency", latencyToJSON(latency));
+
+  return json;
+}
 
-#define keyLength128Bit 16
-#define keyLength192Bit 24
-#define keyLength256Bit 32
-
-static unsigned char key[32];
-static unsigned char iv[16];
-static unsigned char aad[32];
+static cJSON *recordJSON(const RESULT *r, size_t bytes) {
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+
+  cJSON_AddNumberToObject(json, "recordSize", cSettings.recordSize);
+  cJSON_AddNumberToObject(json, "records", recordCount(bytes));
+  cJSON_AddNumberToObject(json, "nonceLength", recordNonceLength);
+  cJSON_AddNumberToObject(json, "aadLength", recordAADLength);
+  cJSON_AddNumberToObject(json, "tagLength", cSettings.tagLength);
+  cJSON_AddItemToObject(json, "seal",
+                        recordStageJSON(r, 0, bytes, cSettings.sealLatency));
+  cJSON_AddItemToObject(json, "open",
+                        recordStageJSON(r, 1, bytes, cSettings.openLatency));
+
+  return json;
+}
 
-#define cipherModeCBC (1 << 0)
-#define cipherModeCFB (1 << 1)
-#define cipherModeOFB (1 << 2)
-#define cipherModeCTR (1 << 3)
-#define cipherModeGCM (1 << 4)
-#define cipherModeCCM (1 << 5)
+/* Whether the loaded providers implement cipher at all. */
+static int cipherAvailable() {
+  if (!cSettings.cipher) return 0;
 
-static unsigned int cipherMode = 0;
-static unsigned int keyLength = 0;
-static int tagLength = 12;
-static int ivLength = 7;
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+  assert(ctx);
+  int i = EVP_CipherInit_ex(ctx, cSettings.cipher, NULL, NULL, NULL, 1);
+  EVP_CIPHER_CTX_free(ctx);
 
-static void init() {
-  int fd = open("/dev/urandom", O_RDONLY);
-  assert(fd >= 0);
+  return i == 1;
+}
 
-  ssize_t ret;
+/* Make c the cipher under test and draw a fresh key for it. Records use
+   TLS nonce and tag sizes whatever the cipher's defaults. Returns 0 if
+   no loaded provider has it. */
+static int cipherApply(const CIPHER *c) {
+  providerCipherFree(fetchedCipher);
+  fetchedCipher = NULL;
 
-  ret = read(fd, key, keyLength);
-  assert(ret == keyLength);
+  if (fetchMode == fetchModeExplicit) {
+    fetchedCipher = providerCipher(c->name);
+    cSettings.cipher = fetchedCipher;
+  } else {
+    cSettings.cipher = c->evp();
+  }
+  if (!cipherAvailable()) return 0;
 
-  ret = read(fd, iv, sizeof(iv));
-  assert(ret == sizeof(iv));
+  cSettings.cipherMode = c->cipherMode;
+  cSettings.keyLength = c->keyLength;
+  cSettings.ivLength = c->ivLength;
+  cSettings.tagLength = c->tagLength;
 
-  if (cipherMode == cipherModeGCM || cipherMode == cipherModeCCM) {
-    ret = read(fd, aad, sizeof(aad));
-    assert(ret == sizeof(aad));
+  if (cSettings.recordSize) {
+    cSettings.ivLength = recordNonceLength;
+    cSettings.tagLength = 16;
   }
 
-  close(fd);
+  cipherKeys();
+
+  return 1;
 }
 
-static CONTENTS* decryptContent(const CONTENTS* data) {
-  EVP_CIPHER_CTX *ctx;
+static RESULT *runTest(const CONTENTS *contents, unsigned int threads,
+                       struct timeval *timeout, unsigned int mode,
+                       unsigned int buffer) {
+  cSettings.keyMode = mode;
+  bufferMode = buffer;
 
-  ctx = EVP_CIPHER_CTX_new();
-  assert(ctx);
+  TEST *t = testNew();
+  testSetThreads(t, threads);
+  testSetTimeout(t, timeout);
+  if (cSettings.recordSize) {
+    latencyReset(cSettings.sealLatency);
+    latencyReset(cSettings.openLatency);
+    testAddRun(t, &sealRecords);
+    testAddRun(t, &openRecords);
+  } else if (bufferMode == bufferModeInPlace) {
+    testAddRun(t, &encryptContentInPlace);
+    testAddRun(t, &decryptContentInPlace);
+  } else {
+    testAddRun(t, &encryptContent);
+    testAddRun(t, &decryptContent);
+  }
+  testSetInput(t, contents);
+  testSetTesting(t, contents);
 
-  int i = 0;
-
-  int len;
-  size_t dataLength = data->size;
-
-  switch (cipherMode) {
-  case cipherModeCBC:
-    switch (keyLength) {
-      case keyLength128Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, key, iv);
-        break;
-      case keyLength192Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_192_cbc(), NULL, key, iv);
-        break;
-      case keyLength256Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv);
-        break;
-    }
-    assert(i==1);
-    break;
-  case cipherModeCFB:
-    switch (keyLength) {
-      case keyLength128Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_128_cfb(), NULL, key, iv);
-        break;
-      case keyLength192Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_192_cfb(), NULL, key, iv);
-        break;
-      case keyLength256Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_256_cfb(), NULL, key, iv);
-        break;
-    }
-    assert(i==1);
-    break;
-  case cipherModeOFB:
-    switch (keyLength) {
-      case keyLength128Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_128_ofb(), NULL, key, iv);
-        break;
-      case keyLength192Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_192_ofb(), NULL, key, iv);
-        break;
-      case keyLength256Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_256_ofb(), NULL, key, iv);
-        break;
-    }
-    assert(i==1);
-    break;
-  case cipherModeCTR:
-    switch (keyLength) {
-      case keyLength128Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_128_ctr(), NULL, key, iv);
-        break;
-      case keyLength192Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_192_ctr(), NULL, key, iv);
-        break;
-      case keyLength256Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_256_ctr(), NULL, key, iv);
-        break;
-    }
-    assert(i==1);
-    break;
-  case cipherModeGCM:
-    switch (keyLength) {
-      case keyLength128Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL);
-        break;
-      case keyLength192Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_192_gcm(), NULL, NULL, NULL);
-        break;
-      case keyLength256Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL);
-        break;
-    }
-    assert(i==1);
-
-    dataLength -= tagLength;
-
-    i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, ivLength, NULL);
-    assert(i==1);
-
-    i = EVP_DecryptInit_ex(ctx, NULL, NULL, key, iv);
-    assert(i==1);
-
-    i = EVP_DecryptUpdate(ctx, NULL, &len, aad, sizeof(aad));
-    assert(i==1);
-
-    break;
-  case cipherModeCCM:
-    switch (keyLength) {
-      case keyLength128Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_128_ccm(), NULL, NULL, NULL);
-        break;
-      case keyLength192Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_192_ccm(), NULL, NULL, NULL);
-        break;
-      case keyLength256Bit:
-        i = EVP_DecryptInit_ex(ctx, EVP_aes_256_ccm(), NULL, NULL, NULL);
-        break;
-    }
-    assert(i==1);
+  RESULT *r = testRun(t);
+  assert(r);
 
-    dataLength -= tagLength;
+  testDestory(t);
 
-    i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_SET_IVLEN, ivLength, NULL);
-    assert(i==1);
+  return r;
+}
 
-    i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_SET_TAG, tagLength, data->body + dataLength);
-    assert(i==1);
+static cJSON *runJSON(const CONTENTS *contents, unsigned int threads,
+                      struct timeval *timeout, unsigned int mode,
+                      unsigned int buffer, int verbose) {
+  RESULT *r = runTest(contents, threads, timeout, mode, buffer);
 
-    i = EVP_DecryptInit_ex(ctx, NULL, NULL, key, iv);
-    assert(i==1);
+  cJSON *json = resultJSON(r, verbose);
+  if (cSettings.recordSize && cJSON_IsObject(json)) {
+    cJSON_AddItemToObject(json, "record", recordJSON(r, contents->size));
+  }
 
-    i = EVP_DecryptUpdate(ctx, NULL, &len, NULL, dataLength);
-    assert(i==1);
+  resultDestory(r);
 
-    i = EVP_DecryptUpdate(ctx, NULL, &len, aad, sizeof(aad));
-    assert(i==1);
+  return json;
+}
 
-    break;
+/* One result per selected buffer mode, side by side when both are. */
+static cJSON *bufferJSON(const CONTENTS *contents, unsigned int threads,
+                         struct timeval *timeout, unsigned int mode,
+                         int verbose) {
+  if (bufferMode != (bufferModeCopy | bufferModeInPlace)) {
+    return runJSON(contents, threads, timeout, mode, bufferMode, verbose);
   }
 
-  CONTENTS* ret = NULL;
-  ret = calloc(1, sizeof(CONTENTS));
-  assert(ret);
-  ret->body = (unsigned char*)malloc(dataLength);
-  assert(ret->body);
+  unsigned int buffers = bufferMode;
 
-  i = EVP_DecryptUpdate(ctx, ret->body, &len, data->body, dataLength);
-  assert(i==1);
-  ret->size = len;
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddItemToObject(json, "copy",
+                        runJSON(contents, threads, timeout, mode,
+                                bufferModeCopy, verbose));
+  cJSON_AddItemToObject(json, "inplace",
+                        runJSON(contents, threads, timeout, mode,
+                                bufferModeInPlace, verbose));
 
-  if (cipherMode == cipherModeGCM) {
-    i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, tagLength, data->body + dataLength);
-    assert(i==1);
-  }
+  bufferMode = buffers;
 
-  if (cipherMode != cipherModeCCM) {
-    i = EVP_DecryptFinal_ex(ctx, ret->body + len, &len);
-    assert(i==1);
-    ret->size += len;
-  }
+  return json;
+}
 
-  EVP_CIPHER_CTX_free(ctx);
+struct c_rank {
+  const CIPHER *cipher;
+  double encryptMBps;
+  cJSON *json;
+};
+typedef struct c_rank RANK;
 
-  return ret;
-}
+static int rankCompare(const void *x, const void *y) {
+  double a = ((const RANK *)x)->encryptMBps;
+  double b = ((const RANK *)y)->encryptMBps;
 
-static CONTENTS *encryptContent(const CONTENTS* data) {
-  EVP_CIPHER_CTX *ctx;
+  return (a < b) - (a > b);
+}
 
-  ctx = EVP_CIPHER_CTX_new();
-  assert(ctx);
+static double cyclesPerByte(const RESULT *r, unsigned int run, double hz) {
+  return resultAvgIntervalByRun(r, run) / 1000000.0 * hz /
+         (double)resultSampleInputByRun(r, run);
+}
 
-  int len;
-  size_t dataLength = data->size + keyLength - 1;
-
-  int i = 0;
-  switch (cipherMode) {
-  case cipherModeCBC:
-    switch (keyLength) {
-      case keyLength128Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, key, iv);
-        break;
-      case keyLength192Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_192_cbc(), NULL, key, iv);
-        break;
-      case keyLength256Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv);
-        break;
-    }
-    break;
-  case cipherModeCFB:
-    switch (keyLength) {
-      case keyLength128Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_128_cfb(), NULL, key, iv);
-        break;
-      case keyLength192Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_192_cfb(), NULL, key, iv);
-        break;
-      case keyLength256Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_256_cfb(), NULL, key, iv);
-        break;
-    }
-    break;
-  case cipherModeOFB:
-    switch (keyLength) {
-      case keyLength128Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_128_cfb(), NULL, key, iv);
-        break;
-      case keyLength192Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_192_cfb(), NULL, key, iv);
-        break;
-      case keyLength256Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_256_cfb(), NULL, key, iv);
-        break;
+/* Every registered cipher (AEADs only in record mode) at every key
+   length on the same input, ranked by encrypt throughput. Only the
+   first key and buffer mode selected are used. */
+static cJSON *matrixJSON(const CONTENTS *contents, unsigned int threads,
+                         struct timeval *timeout, int verbose) {
+  unsigned int keyMode = cSettings.keyMode;
+  unsigned int mode = keyMode & keyModeFixed ? keyModeFixed : keyMode;
+  unsigned int buffer = bufferMode & bufferModeCopy ? bufferModeCopy : bufferMode;
+  double hz = cpuCyclesPerSecond();
+
+  unsigned int count = sizeof(ciphers) / sizeof(ciphers[0]);
+  RANK *ranks = (RANK *)calloc(count, sizeof(RANK));
+  assert(ranks);
+
+  unsigned int ranked = 0;
+  for (unsigned int i = 0; i < count; i ++) {
+    if (cSettings.recordSize && !ciphers[i].tagLength) continue;
+    if (ciphers[i].cipherMode == cipherModeXTS && contents->size < 16) continue;
+
+    if (!cipherApply(&ciphers[i])) continue;
+
+    RESULT *r = runTest(contents, threads, timeout, mode, buffer);
+    size_t bytes = contents->size;
+
+    cJSON *json = cJSON_CreateObject();
+    assert(json);
+    cJSON_AddStringToObject(json, "cipher", ciphers[i].name);
+    cJSON_AddNumberToObject(json, "keyBits", ciphers[i].keyBits);
+    cJSON_AddBoolToObject(json, "correct", isResultCorrect(r));
+
+    double perSec = 1000000.0 / (double)(1 << 20) * resultThreads(r);
+    ranks[ranked].encryptMBps = bytes / resultAvgIntervalByRun(r, 0) * perSec;
+    cJSON_AddNumberToObject(json, "encryptMBps", ranks[ranked].encryptMBps);
+    cJSON_AddNumberToObject(json, "decryptMBps",
+                            bytes / resultAvgIntervalByRun(r, 1) * perSec);
+    if (hz > 0) {
+      cJSON_AddNumberToObject(json, "encryptCyclesPerByte", cyclesPerByte(r, 0, hz));
+      cJSON_AddNumberToObject(json, "decryptCyclesPerByte", cyclesPerByte(r, 1, hz));
     }
-    break;
-  case cipherModeCTR:
-    switch (keyLength) {
-      case keyLength128Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_128_ctr(), NULL, key, iv);
-        break;
-      case keyLength192Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_192_ctr(), NULL, key, iv);
-        break;
-      case keyLength256Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_256_ctr(), NULL, key, iv);
-        break;
+    if (cSettings.recordSize) {
+      cJSON_AddItemToObject(json, "record", recordJSON(r, bytes));
     }
-    break;
-  case cipherModeGCM:
-    switch (keyLength) {
-      case keyLength128Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL);
-        break;
-      case keyLength192Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_192_gcm(), NULL, NULL, NULL);
-        break;
-      case keyLength256Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL);
-        break;
+    if (verbose) {
+      cJSON_AddItemToObject(json, "result", resultJSON(r, 0));
     }
 
-    dataLength += tagLength;
-
-    i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, ivLength, NULL);
-    assert(i==1);
-
-    i = EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv);
-    assert(i==1);
-
-    i = EVP_EncryptUpdate(ctx, NULL, &len, aad, sizeof(aad));
-    assert(i==1);
-
-    break;
-  case cipherModeCCM:
-    switch (keyLength) {
-      case keyLength128Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_128_ccm(), NULL, NULL, NULL);
-        break;
-      case keyLength192Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_192_ccm(), NULL, NULL, NULL);
-        break;
-      case keyLength256Bit:
-        i = EVP_EncryptInit_ex(ctx, EVP_aes_256_ccm(), NULL, NULL, NULL);
-        break;
-    }
+    ranks[ranked].cipher = &ciphers[i];
+    ranks[ranked].json = json;
+    ranked ++;
 
-    dataLength += tagLength;
+    resultDestory(r);
+  }
 
-    i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_SET_IVLEN, ivLength, NULL);
-    assert(i==1);
+  qsort(ranks, ranked, sizeof(RANK), rankCompare);
 
-    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_SET_TAG, tagLength, NULL);
+  cJSON *matrixJSON = cJSON_CreateArray();
+  assert(matrixJSON);
+  for (unsigned int i = 0; i < ranked; i ++) {
+    cJSON_AddNumberToObject(ranks[i].json, "rank", i + 1);
+    cJSON_AddItemToArray(matrixJSON, ranks[i].json);
+  }
+  free(ranks);
 
-    i = EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv);
-    assert(i==1);
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddItemToObject(json, "matrix", matrixJSON);
+  cJSON_AddNumberToObject(json, "cyclesPerSec", hz);
+
+  return json;
+}
 
-    i = EVP_EncryptUpdate(ctx, NULL, &len, NULL, data->size);
-    assert(i==1);
+/* What one run measures, handed through provider comparisons. */
+struct c_bench {
+  const CIPHER *selected;
+  const CONTENTS *contents;
+  unsigned int threads;
+  struct timeval *timeout;
+  int matrix;
+  int verbose;
+};
+typedef struct c_bench BENCH;
+
+static cJSON *benchJSON(const BENCH *b) {
+  if (b->matrix) {
+    return matrixJSON(b->contents, b->threads, b->timeout, b->verbose);
+  }
 
-    i = EVP_EncryptUpdate(ctx, NULL, &len, aad, sizeof(aad));
-    assert(i==1);
+  if (!cipherApply(b->selected)) {
+    cJSON *json = cJSON_CreateObject();
+    assert(json);
+    cJSON_AddStringToObject(json, "error", "cipher unavailable");
+    return json;
+  }
 
-    break;
+  if (cSettings.keyMode == (keyModeFixed | keyModeAgile)) {
+    cJSON *json = cJSON_CreateObject();
+    assert(json);
+    cJSON_AddItemToObject(json, "fixed",
+                          bufferJSON(b->contents, b->threads, b->timeout,
+                                     keyModeFixed, b->verbose));
+    cJSON_AddItemToObject(json, "agile",
+                          bufferJSON(b->contents, b->threads, b->timeout,
+                                     keyModeAgile, b->verbose));
+    cSettings.keyMode = keyModeFixed | keyModeAgile;
+    return json;
   }
-  assert(i==1);
-
-  CONTENTS* ret = NULL;
-  ret = calloc(1, sizeof(CONTENTS));
-  assert(ret);
-  ret->body = (unsigned char*)malloc(dataLength);
-
-  i = EVP_EncryptUpdate(ctx, ret->body, &len, data->body, data->size);
-  assert(i==1);
-  ret->size = len;
-
-  i = EVP_EncryptFinal_ex(ctx, ret->body + len, &len);
-  assert(i==1);
-  ret->size += len;
-
-  switch (cipherMode)
-  {
-  case cipherModeGCM:
-    i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, tagLength, ret->body + ret->size);
-    assert(i==1);
-    ret->size += tagLength;
-    break;
-  case cipherModeCCM:
-    i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_GET_TAG, tagLength, ret->body + ret->size);
-    assert(i==1);
-    ret->size += tagLength;
-    break;
+
+  return bufferJSON(b->contents, b->threads, b->timeout, cSettings.keyMode,
+                    b->verbose);
+}
+
+/* One result per selected fetch mode, side by side when both are.
+   Fetched algorithms are released before their providers are. */
+static cJSON *fetchJSON(void *arg) {
+  const BENCH *b = (const BENCH *)arg;
+  cJSON *json = NULL;
+
+  if (fetchMode != (fetchModeImplicit | fetchModeExplicit)) {
+    json = benchJSON(b);
+  } else {
+    json = cJSON_CreateObject();
+    assert(json);
+    fetchMode = fetchModeImplicit;
+    cJSON_AddItemToObject(json, "implicit", benchJSON(b));
+    fetchMode = fetchModeExplicit;
+    cJSON_AddItemToObject(json, "explicit", benchJSON(b));
+    fetchMode = fetchModeImplicit | fetchModeExplicit;
   }
 
-  EVP_CIPHER_CTX_free(ctx);
+  providerCipherFree(fetchedCipher);
+  fetchedCipher = NULL;
+  cSettings.cipher = NULL;
 
-  return ret;
+  return json;
 }
 
 static void printUsage() {
@@ -365,8 +382,16 @@ static void printUsage() {
           "Usage: aes_bench \n"
           "[-r seconds <seconds, default is 3>]\n"
           "[-t threads <threads, default is logic cpu cores>]\n"
-          "[-k <key length>, should be 128, 192 or 256, default is 128]\n"
-          "[-c <cipher mode>, should be CBC, CFB, OFB, GCM, CCM or CTR, default is CBC]\n"
+          "[-k <key length>, should be 128, 192 or 256, default is the shortest the cipher has]\n"
+          "[-c <cipher mode>, should be CBC, CFB, OFB, CTR, GCM, CCM, OCB, XTS or CHACHA20-POLY1305, default is CBC]\n"
+          "[-x <run every registered cipher and key length, ranked>]\n"
+          "[-H <rerun under each OpenSSL CPU feature tier, generic to vaes>]\n"
+          "[-a <key mode>, should be fixed, agile or all, default is fixed]\n"
+          "[-R size <seal TLS style records of size, up to 16K, AEAD ciphers only>]\n"
+          "[-i <buffer mode>, should be copy, inplace or all, default is copy]\n"
+          "[-e <fetch mode>, should be implicit, explicit or all, default is explicit on OpenSSL 3]\n"
+          "[-P <provider sets>, comma separated sets of '+' joined providers to compare, e.g. default,fips+base]\n"
+          "[-Q <property query>, e.g. provider=default or fips=yes]\n"
           "[-v <verbose json output>] [-f <formated json output>]\n"
           "-u size <use random data block, size can use K, M, G>|file|url\n");
 }
@@ -383,14 +408,18 @@ int main(int argc, char **argv) {
   int verbose = 0;
   int formated = 0;
   size_t randomSize = 0;
-  char mode[4];
-  mode[0] = '\0';
+  const char *mode = "CBC";
+  unsigned int keyBits = 0;
+  int matrix = 0;
+  int hwTiers = 0;
+  const char *providerSets = NULL;
+  const char *propq = NULL;
 
   int index;
   int c;
   opterr = 0;
 
-  while ((c = getopt(argc, argv, "r:t:vfu:k:c:")) != -1) {
+  while ((c = getopt(argc, argv, "r:t:vfu:k:c:a:R:i:xHe:P:Q:")) != -1) {
     switch (c) {
     case 'r':
       timeout.tv_sec = atoi(optarg);
@@ -408,11 +437,71 @@ int main(int argc, char **argv) {
       formated = 1;
       break;
     case 'k':
-      keyLength = atoi(optarg);
+      keyBits = atoi(optarg);
       break;
     case 'c':
-      strncpy(mode, optarg, sizeof(mode));
-      mode[3] = '\0';
+      mode = optarg;
+      break;
+    case 'x':
+      matrix = 1;
+      break;
+    case 'H':
+      hwTiers = 1;
+      break;
+    case 'P':
+      providerSets = optarg;
+      break;
+    case 'Q':
+      propq = optarg;
+      break;
+    case 'e':
+      if (strcmp(optarg, "implicit") == 0) {
+        fetchMode = fetchModeImplicit;
+      } else if (strcmp(optarg, "explicit") == 0) {
+        fetchMode = fetchModeExplicit;
+      } else if (strcmp(optarg, "all") == 0) {
+        fetchMode = fetchModeImplicit | fetchModeExplicit;
+      } else {
+        printUsage();
+        goto END;
+      }
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+      if (fetchMode & fetchModeExplicit) {
+        fprintf(stderr, "Explicit fetch needs OpenSSL 3\n");
+        goto END;
+      }
+#endif
+      break;
+    case 'R':
+      cSettings.recordSize = parseHumanSize(optarg);
+      if (cSettings.recordSize == 0 || cSettings.recordSize > 16384) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'i':
+      if (strcmp(optarg, "copy") == 0) {
+        bufferMode = bufferModeCopy;
+      } else if (strcmp(optarg, "inplace") == 0) {
+        bufferMode = bufferModeInPlace;
+      } else if (strcmp(optarg, "all") == 0) {
+        bufferMode = bufferModeCopy | bufferModeInPlace;
+      } else {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'a':
+      if (strcmp(optarg, "fixed") == 0) {
+        cSettings.keyMode = keyModeFixed;
+      } else if (strcmp(optarg, "agile") == 0) {
+        cSettings.keyMode = keyModeAgile;
+      } else if (strcmp(optarg, "all") == 0) {
+        cSettings.keyMode = keyModeFixed | keyModeAgile;
+      } else {
+        printUsage();
+        goto END;
+      }
       break;
     case '?':
       printUsage();
@@ -430,44 +519,41 @@ int main(int argc, char **argv) {
       threads = 2;
   }
 
-  switch (keyLength) {
-  case 128:
-  case 0:
-    keyLength = keyLength128Bit;
-    break;
-  case 192:
-    keyLength = keyLength192Bit;
-    break;
-  case 256:
-    keyLength = keyLength256Bit;
-    break;
-  default:
+  const CIPHER *selected = NULL;
+  for (unsigned int i = 0; i < sizeof(ciphers) / sizeof(ciphers[0]); i ++) {
+    if (strcmp(ciphers[i].mode, mode) == 0 &&
+        (keyBits == 0 || keyBits == ciphers[i].keyBits)) {
+      selected = &ciphers[i];
+      break;
+    }
+  }
+  if (!selected) {
     printUsage();
     goto END;
   }
 
-  if (mode[0] == '\0' || strcmp(mode, "CBC") == 0) {
-    cipherMode = cipherModeCBC;
-  } else if (strcmp(mode, "CFB") == 0) {
-    cipherMode = cipherModeCFB;
-  } else if (strcmp(mode, "OFB") == 0) {
-    cipherMode = cipherModeOFB;
-  } else if (strcmp(mode, "CTR") == 0) {
-    cipherMode = cipherModeCTR;
-  } else if (strcmp(mode, "GCM") == 0) {
-    cipherMode = cipherModeGCM;
-    ivLength = 12;
-    tagLength = 16;
-  } else if (strcmp(mode, "CCM") == 0) {
-    cipherMode = cipherModeCCM;
-    ivLength = 7;
-    tagLength = 12;
-  } else {
-    printUsage();
-    goto END;
+  if (cSettings.recordSize) {
+    if ((!selected->tagLength && !matrix) || bufferMode != bufferModeCopy) {
+      printUsage();
+      goto END;
+    }
+
+    cSettings.sealLatency = latencyNew();
+    cSettings.openLatency = latencyNew();
   }
 
-  init();
+  if (hwTiers && !cpuTierChild()) {
+    cJSON *json = cJSON_CreateObject();
+    assert(json);
+    cJSON_AddItemToObject(json, "cpuFlags", cpuFlagsJSON());
+    cJSON_AddItemToObject(json, "tiers", cpuTiersJSON(argv));
+
+    printJSON(json, formated);
+
+    cJSON_Delete(json);
+    ret = 0;
+    goto END;
+  }
 
   if (randomSize) {
     contents = randomContents(randomSize);
@@ -489,20 +575,26 @@ int main(int argc, char **argv) {
     }
   }
 
-  TEST *t = testNew();
-  testSetThreads(t, threads);
-  testSetTimeout(t, &timeout);
-  testAddRun(t, &encryptContent);
-  testAddRun(t, &decryptContent);
-  testSetInput(t, contents);
-  testSetTesting(t, contents);
+  if (selected->cipherMode == cipherModeXTS && contents->size < 16) {
+    fprintf(stderr, "XTS needs at least 16 bytes\n");
+    goto END;
+  }
 
-  RESULT *r = testRun(t);
-  assert(r);
+  BENCH bench = {selected, contents, threads, &timeout, matrix, verbose};
+  cJSON *json = NULL;
 
-  printResult(r, verbose, formated);
+  if (providerSets) {
+    json = providerCompareJSON(providerSets, propq, fetchJSON, &bench);
+  } else if (providerLoad(NULL, propq)) {
+    json = fetchJSON(&bench);
+  } else {
+    fprintf(stderr, "Bad property query\n");
+    goto END;
+  }
 
-  resultDestory(r);
+  printJSON(json, formated);
+
+  cJSON_Delete(json);
 
   ret = 0;
 
@@ -512,5 +604,8 @@ END:
     free(contents);
     contents = NULL;
   }
+  latencyDestroy(cSettings.sealLatency);
+  latencyDestroy(cSettings.openLatency);
+  providerUnload();
   return ret;
 }
\ No newline at end of file
@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "allocator.h"
+
+#define arenaChunkSize (1 << 20)
+#define poolSlabSize (64 << 10)
+#define poolClasses 9
+#define poolMinShift 4
+#define poolLarge poolClasses
+/* Keeps payloads 16 byte aligned and holds a block's size class. */
+#define poolHeader 16
+
+struct a_chunk {
+  struct a_chunk *next;
+  size_t size;
+  size_t used;
+  size_t pad;
+};
+typedef struct a_chunk CHUNK;
+
+struct a_thread {
+  CHUNK *chunks;
+  CHUNK *current;
+  CHUNK *tail;
+  void *freeLists[poolClasses];
+  CHUNK *slabs;
+};
+typedef struct a_thread THREAD;
+
+static pthread_key_t threadKey;
+static pthread_once_t threadOnce = PTHREAD_ONCE_INIT;
+
+static void chunksFree(CHUNK *c) {
+  while (c) {
+    CHUNK *next = c->next;
+    free(c);
+    c = next;
+  }
+}
+
+static void threadDestroy(void *arg) {
+  THREAD *thread = (THREAD *)arg;
+
+  chunksFree(thread->chunks);
+  chunksFree(thread->slabs);
+  free(thread);
+}
+
+static void threadKeyCreate() {
+  pthread_key_create(&threadKey, threadDestroy);
+}
+
+static THREAD *threadGet() {
+  pthread_once(&threadOnce, threadKeyCreate);
+
+  THREAD *thread = (THREAD *)pthread_getspecific(threadKey);
+  if (!thread) {
+    thread = (THREAD *)calloc(1, sizeof(THREAD));
+    assert(thread);
+    pthread_setspecific(threadKey, thread);
+  }
+
+  return thread;
+}
+
+static void *systemMalloc(size_t size) {
+  return malloc(size);
+}
+
+static void systemFree(void *p) {
+  free(p);
+}
+
+static void nothing() {
+}
+
+static void *arenaMalloc(size_t size) {
+  THREAD *thread = threadGet();
+  size = (size + 15) & ~(size_t)15;
+
+  CHUNK *c = thread->current;
+  while (c && c->used + size > c->size) {
+    c = c->next;
+  }
+
+  if (!c) {
+    size_t chunkSize = size > arenaChunkSize ? size : arenaChunkSize;
+    c = (CHUNK *)malloc(sizeof(CHUNK) + chunkSize);
+    if (!c) return NULL;
+    c->next = NULL;
+    c->size = chunkSize;
+    c->used = 0;
+
+    if (thread->tail) {
+      thread->tail->next = c;
+    } else {
+      thread->chunks = c;
+    }
+    thread->tail = c;
+  }
+  thread->current = c;
+
+  void *p = (unsigned char *)(c + 1) + c->used;
+  c->used += size;
+
+  return p;
+}
+
+static void arenaFree(void *p) {
+  (void)p;
+}
+
+static void arenaReset() {
+  THREAD *thread = threadGet();
+
+  for (CHUNK *c = thread->chunks; c; c = c->next) {
+    c->used = 0;
+  }
+  thread->current = thread->chunks;
+}
+
+static void *poolMalloc(size_t size) {
+  unsigned int sizeClass = 0;
+  while (sizeClass < poolClasses && ((size_t)1 << (sizeClass + poolMinShift)) < size) {
+    sizeClass ++;
+  }
+
+  unsigned char *block;
+  if (sizeClass == poolLarge) {
+    block = (unsigned char *)malloc(poolHeader + size);
+    if (!block) return NULL;
+  } else {
+    THREAD *thread = threadGet();
+
+    if (!thread->freeLists[sizeClass]) {
+      size_t blockSize = poolHeader + ((size_t)1 << (sizeClass + poolMinShift));
+      CHUNK *slab = (CHUNK *)malloc(sizeof(CHUNK) + poolSlabSize);
+      if (!slab) return NULL;
+      slab->next = thread->slabs;
+      thread->slabs = slab;
+
+      unsigned char *base = (unsigned char *)(slab + 1);
+      for (size_t offset = 0; offset + blockSize <= poolSlabSize; offset += blockSize) {
+        *(void **)(base + offset + poolHeader) = thread->freeLists[sizeClass];
+        thread->freeLists[sizeClass] = base + offset + poolHeader;
+      }
+    }
+
+    block = (unsigned char *)thread->freeLists[sizeClass] - poolHeader;
+    thread->freeLists[sizeClass] = *(void **)(block + poolHeader);
+  }
+
+  *(size_t *)block = sizeClass;
+
+  return block + poolHeader;
+}
+
+static void poolFree(void *p) {
+  if (!p) return;
+
+  unsigned char *block = (unsigned char *)p - poolHeader;
+  size_t sizeClass = *(size_t *)block;
+
+  if (sizeClass == poolLarge) {
+    free(block);
+    return;
+  }
+
+  THREAD *thread = threadGet();
+  *(void **)p = thread->freeLists[sizeClass];
+  thread->freeLists[sizeClass] = p;
+}
+
+const ALLOCATOR allocators[] = {
+  {"malloc", systemMalloc, systemFree, nothing},
+  {"arena", arenaMalloc, arenaFree, arenaReset},
+  {"pool", poolMalloc, poolFree, nothing},
+};
+const unsigned int allocatorCount = sizeof(allocators) / sizeof(allocators[0]);
+
+const ALLOCATOR *allocatorByName(const char *name) {
+  for (unsigned int i = 0; i < allocatorCount; i ++) {
+    if (strcmp(allocators[i].name, name) == 0) return &allocators[i];
+  }
+  return NULL;
+}
@@ -0,0 +1,28 @@
+#ifndef __REALITY_ALLOCATOR_H
+#define __REALITY_ALLOCATOR_H
+
+#include <stdlib.h>
+
+/* Allocators to plug into libraries with malloc/free hooks, such as
+   cJSON_InitHooks. State is per thread, so blocks must be freed on the
+   thread that allocated them.
+
+   malloc: the C library's.
+   arena:  bump allocation from per-thread chunks; free does nothing and
+           reset rewinds the thread's arena, keeping its chunks.
+   pool:   per-thread free lists of power of two size classes carved from
+           slabs, larger blocks from malloc; reset does nothing. */
+struct a_allocator {
+  const char *name;
+  void *(*malloc)(size_t size);
+  void (*free)(void *p);
+  void (*reset)(void);
+};
+typedef struct a_allocator ALLOCATOR;
+
+extern const ALLOCATOR allocators[];
+extern const unsigned int allocatorCount;
+
+const ALLOCATOR *allocatorByName(const char *name);
+
+#endif
@@ -2,6 +2,7 @@
 #include <assert.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include "misc.h"
@@ -43,7 +44,10 @@ void testSetInput(TEST *t, const CONTENTS* input) {
 }
 
 void testDestory(TEST *t) {
-  return;
+  if (t) {
+    free(t->run);
+    free(t);
+  }
 }
 
 static unsigned long getLoops(const LOOP* loop) {
@@ -54,7 +58,7 @@ static unsigned long getLoops(const LOOP* loop) {
   return count;
 }
 
-static unsigned long resultTotalLoops(const RESULT* result) {
+unsigned long resultTotalLoops(const RESULT* result) {
   unsigned long total = 0;
   for (const RESULT *re = result; re; re = re->next) {
     total += getLoops(re->loops);
@@ -62,7 +66,7 @@ static unsigned long resultTotalLoops(const RESULT* result) {
   return total;
 }
 
-static unsigned int resultThreads(const RESULT* result) {
+unsigned int resultThreads(const RESULT* result) {
   unsigned int count = 0;
   for (const RESULT *re = result; re; re = re->next) {
     count ++;
@@ -196,7 +200,7 @@ static unsigned long loopTotalTime(const LOOP* loops, const unsigned int run,
   return timevalToUsec(totalTime);
 }
 
-static double resultAvgIntervalByRun(const RESULT* results, const unsigned int run) {
+double resultAvgIntervalByRun(const RESULT* results, const unsigned int run) {
   struct timeval t;
   unsigned long total = 0;
   unsigned long loops = 0;
@@ -205,6 +209,7 @@ static double resultAvgIntervalByRun(const RESULT* results, const unsigned int r
   for (const RESULT* r = results; r; r = r->next) {
     total += loopTotalTime(r->loops, run, &t);
     loops += resultThreadLoops(results, id);
+    id++;
   }
 
   return (double)total / (double)loops;
@@ -274,7 +279,7 @@ static unsigned long resultRealTime(const RESULT* results, struct timeval *total
   return resultRealTimeByRun(results, ~0, totalTime);
 }
 
-static int isResultCorrect(const RESULT* results) {
+int isResultCorrect(const RESULT* results) {
   for (const RESULT *re = results; re; re = re->next) {
     if (!isLoopCorrect(re->loops)) return 0;
   }
@@ -317,22 +322,22 @@ static size_t *runInputSample(RUN* runs) {
   return samples;
 }
 
-static size_t resultSampleInputByRun(const RESULT *r, const unsigned int run) {
+size_t resultSampleInputByRun(const RESULT *r, const unsigned int run) {
   size_t *samples = runInputSample(r->loops->runs);
   assert (samples);
 
-  unsigned int ret = samples[run];
+  size_t ret = samples[run];
 
   free(samples);
 
   return ret;
 }
 
-static size_t resultSampleOutputByRun(const RESULT *r, const unsigned int run) {
+size_t resultSampleOutputByRun(const RESULT *r, const unsigned int run) {
   size_t *samples = runOutputSample(r->loops->runs);
   assert (samples);
 
-  unsigned int ret = samples[run];
+  size_t ret = samples[run];
 
   free(samples);
 
@@ -535,6 +540,7 @@ static void *loopThread(void *arg) {
 
       if (needFree) {
         destroyContents(needFree);
+        free(needFree);
         needFree = NULL;
       }
       if (output) {
@@ -561,6 +567,7 @@ static void *loopThread(void *arg) {
 
     if (needFree) {
       destroyContents(needFree);
+      free(needFree);
     }
 
     if (output) {
@@ -571,6 +578,7 @@ static void *loopThread(void *arg) {
       }
 
       destroyContents(output);
+      free(output);
     }
 
     loop->runs = headRun;
@@ -609,7 +617,7 @@ RESULT *testRun(TEST *t) {
   return headResult;
 }
 
-void printResult(const RESULT *r, int verbose, int formated) {
+cJSON *resultJSON(const RESULT *r, int verbose) {
   cJSON *json = NULL;
   if (verbose) {
     json = resultToJSONVerbose(r);
@@ -618,7 +626,80 @@ void printResult(const RESULT *r, int verbose, int formated) {
   }
   assert(json);
 
+  return json;
+}
+
+/* Throughput keys by suffix, and what one unit is in MBps (MiB/s):
+   GBps is GiB/s and Gbps is 10^9 bits/s. */
+static const struct {
+  const char *suffix;
+  double toMBps;
+} throughputUnits[] = {
+  {"MBps", 1},
+  {"GBps", 1 << 10},
+  {"Gbps", 1e9 / 8 / (1 << 20)},
+};
+
+static void baselineFractions(cJSON *json, double copyMBps) {
+  for (cJSON *item = json->child; item; item = item->next) {
+    if (cJSON_IsObject(item) || cJSON_IsArray(item)) {
+      baselineFractions(item, copyMBps);
+      continue;
+    }
+
+    size_t length = item->string ? strlen(item->string) : 0;
+    if (!cJSON_IsNumber(item) || length < 4) continue;
+
+    for (size_t i = 0; i < sizeof(throughputUnits) / sizeof(throughputUnits[0]); i ++) {
+      if (strcmp(item->string + length - 4, throughputUnits[i].suffix) != 0) {
+        continue;
+      }
+
+      char name[128];
+      snprintf(name, sizeof(name), "%sOfCopy", item->string);
+      cJSON_AddNumberToObject(json, name,
+                              item->valuedouble * throughputUnits[i].toMBps / copyMBps);
+      break;
+    }
+  }
+}
+
+/* Skipped for mem_bench's own report, which carries a baseline. */
+static void baselineAdd(cJSON *json) {
+  const char *file = getenv(memBaselineEnv);
+  if (!file || !cJSON_IsObject(json) ||
+      cJSON_GetObjectItemCaseSensitive(json, "baseline")) {
+    return;
+  }
+
+  CONTENTS *contents = getContents(file);
+  if (!contents) return;
+
+  /* cJSON_Parse wants a terminated string. */
+  contents->body = realloc(contents->body, contents->size + 1);
+  assert(contents->body);
+  contents->body[contents->size] = '\0';
+
+  cJSON *report = cJSON_Parse((const char *)contents->body);
+  destroyContents(contents);
+  free(contents);
+  if (!report) return;
+
+  cJSON *baseline = cJSON_DetachItemFromObjectCaseSensitive(report, "baseline");
+  cJSON *copy = baseline ? cJSON_GetObjectItemCaseSensitive(baseline, "copyMBps") : NULL;
+  if (cJSON_IsNumber(copy) && copy->valuedouble > 0) {
+    baselineFractions(json, copy->valuedouble);
+    cJSON_AddItemToObject(json, "memoryBaseline", baseline);
+  } else {
+    cJSON_Delete(baseline);
+  }
+  cJSON_Delete(report);
+}
+
+void printJSON(cJSON *json, int formated) {
   char *jsonString = NULL;
+
+  baselineAdd(json);
   if (formated) {
     jsonString = cJSON_Print(json);
   } else {
@@ -628,6 +709,13 @@ void printResult(const RESULT *r, int verbose, int formated) {
 
   printf("%s\n", jsonString);
 
-  cJSON_Delete(json);
   free(jsonString);
+}
+
+void printResult(const RESULT *r, int verbose, int formated) {
+  cJSON *json = resultJSON(r, verbose);
+
+  printJSON(json, formated);
+
+  cJSON_Delete(json);
 }
\ No newline at end of file
@@ -31,6 +31,21 @@ typedef struct b_result RESULT;
 void resultDestory(RESULT* r);
 
 void printResult(const RESULT *r, int verbose, int formated);
+cJSON *resultJSON(const RESULT *r, int verbose);
+void printJSON(cJSON *json, int formated);
+
+/* When set to a file holding a mem_bench report, printJSON adds its
+   baseline to the output and, next to every number whose name ends in
+   MBps (MiB/s), GBps (GiB/s) or Gbps (10^9 bits/s), that number in MiB/s
+   over the baseline's copyMBps as <name>OfCopy. */
+#define memBaselineEnv "REALITY_MEM_BASELINE"
+
+unsigned int resultThreads(const RESULT* result);
+unsigned long resultTotalLoops(const RESULT* result);
+int isResultCorrect(const RESULT* results);
+double resultAvgIntervalByRun(const RESULT* results, const unsigned int run);
+size_t resultSampleInputByRun(const RESULT *r, const unsigned int run);
+size_t resultSampleOutputByRun(const RESULT *r, const unsigned int run);
 
 struct b_test {
   struct timeval timeout;
@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+
+#include "contents.h"
+#include "benchmark.h"
+#include "misc.h"
+#include "parallel.h"
+#include "cpucap.h"
+
+/* Bytes checksummed per harness call. */
+#define checksumBatch (1 << 20)
+
+/* crc32 and adler32 take a uInt length, so longer buffers are fed to
+   them in pieces of this size. */
+#define zlibChunk (1U << 30)
+
+/* Reflected CRC32C (Castagnoli) polynomial. */
+#define crc32cPoly 0x82f63b78
+
+typedef uint32_t (*checksumFunc)(uint32_t check, const unsigned char *p,
+                                 size_t size);
+typedef uint32_t (*combineFunc)(uint32_t first, uint32_t second,
+                                size_t secondSize);
+
+struct c_algorithm {
+  const char *name;
+  uint32_t init;
+  checksumFunc run;
+  /* NULL when zlib offers no combine for it. */
+  combineFunc combine;
+};
+typedef struct c_algorithm ALGORITHM;
+
+static uint32_t crc32cTable[256];
+
+static void crc32cTableInit() {
+  for (uint32_t i = 0; i < 256; i ++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k ++) {
+      c = c & 1 ? (c >> 1) ^ crc32cPoly : c >> 1;
+    }
+    crc32cTable[i] = c;
+  }
+}
+
+kernelFunction static uint32_t crc32cTableRun(uint32_t check,
+                                              const unsigned char *p,
+                                              size_t size) {
+  uint32_t c = ~check;
+  for (size_t i = 0; i < size; i ++) {
+    c = crc32cTable[(c ^ p[i]) & 0xff] ^ (c >> 8);
+  }
+  return ~c;
+}
+
+#if defined(__x86_64__)
+/* One crc32 instruction per 8 bytes. A single dependency chain, as a
+   storage engine checksumming one block at a time would run it. */
+__attribute__((target("sse4.2"))) kernelFunction
+static uint32_t crc32cHardwareRun(uint32_t check, const unsigned char *p,
+                                  size_t size) {
+  uint64_t c = ~check;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t v;
+    memcpy(&v, p + i, sizeof(v));
+    c = _mm_crc32_u64(c, v);
+  }
+  uint32_t c32 = (uint32_t)c;
+  for (; i < size; i ++) {
+    c32 = _mm_crc32_u8(c32, p[i]);
+  }
+  return ~c32;
+}
+#endif
+
+static uint32_t crc32Run(uint32_t check, const unsigned char *p, size_t size) {
+  for (; size > zlibChunk; p += zlibChunk, size -= zlibChunk) {
+    check = crc32(check, p, zlibChunk);
+  }
+  return crc32(check, p, (uInt)size);
+}
+
+static uint32_t crc32zRun(uint32_t check, const unsigned char *p, size_t size) {
+  return crc32_z(check, p, size);
+}
+
+static uint32_t adler32Run(uint32_t check, const unsigned char *p, size_t size) {
+  for (; size > zlibChunk; p += zlibChunk, size -= zlibChunk) {
+    check = adler32(check, p, zlibChunk);
+  }
+  return adler32(check, p, (uInt)size);
+}
+
+static uint32_t crc32Combine(uint32_t first, uint32_t second, size_t secondSize) {
+  return crc32_combine(first, second, (z_off_t)secondSize);
+}
+
+static uint32_t adler32Combine(uint32_t first, uint32_t second, size_t secondSize) {
+  return adler32_combine(first, second, (z_off_t)secondSize);
+}
+
+/* crc32c's run is picked at startup by CPUID. */
+static ALGORITHM algorithms[] = {
+  {"crc32", 0, crc32Run, crc32Combine},
+  {"crc32_z", 0, crc32zRun, crc32Combine},
+  {"adler32", 1, adler32Run, adler32Combine},
+  {"crc32c", 0, crc32cTableRun, NULL},
+};
+#define algorithmCount (sizeof(algorithms) / sizeof(algorithms[0]))
+
+static const ALGORITHM *algorithm = NULL;
+static size_t blockSize = 4 << 20;
+static unsigned int workers = 1;
+
+static const char *crc32cInit() {
+  crc32cTableInit();
+#if defined(__x86_64__)
+  if (cpuHasFlag("sse4_2")) {
+    algorithms[algorithmCount - 1].run = crc32cHardwareRun;
+    return "sse4.2";
+  }
+#endif
+  return "table";
+}
+
+static CONTENTS *checkContents(uint32_t check) {
+  CONTENTS *result = calloc(1, sizeof(CONTENTS));
+  assert(result);
+  result->body = malloc(sizeof(check));
+  assert(result->body);
+  memcpy(result->body, &check, sizeof(check));
+  result->size = sizeof(check);
+
+  return result;
+}
+
+/* Outputs the checksum of the input, computed once per batch rep. */
+static CONTENTS* checksumContent(const CONTENTS* data) {
+  assert(data != NULL);
+  assert(data->body != NULL);
+
+  uint32_t check = 0;
+  size_t reps = batchReps(checksumBatch, data->size);
+  for (size_t i = 0; i < reps; i ++) {
+    check = algorithm->run(algorithm->init, data->body, data->size);
+  }
+
+  return checkContents(check);
+}
+
+struct c_block {
+  const unsigned char *in;
+  size_t size;
+  uint32_t check;
+};
+typedef struct c_block BLOCK;
+
+static void checksumBlock(size_t index, void *arg) {
+  BLOCK *block = (BLOCK *)arg + index;
+  block->check = algorithm->run(algorithm->init, block->in, block->size);
+}
+
+/* Checksums blockSize slices on workers threads and merges them in
+   order with the algorithm's combine. */
+static CONTENTS* checksumContentParallel(const CONTENTS* data) {
+  assert(data != NULL);
+  assert(data->body != NULL);
+  assert(data->size > 0);
+
+  size_t count = (data->size + blockSize - 1) / blockSize;
+  BLOCK *blocks = (BLOCK *)calloc(count, sizeof(BLOCK));
+  assert(blocks);
+
+  for (size_t i = 0; i < count; i ++) {
+    size_t offset = i * blockSize;
+    blocks[i].in = data->body + offset;
+    blocks[i].size = (i == count - 1) ? data->size - offset : blockSize;
+  }
+
+  parallelFor(workers, count, checksumBlock, blocks);
+
+  uint32_t check = blocks[0].check;
+  for (size_t i = 1; i < count; i ++) {
+    check = algorithm->combine(check, blocks[i].check, blocks[i].size);
+  }
+  free(blocks);
+
+  return checkContents(check);
+}
+
+static RESULT *runTest(CONTENTS *(*run)(const CONTENTS *),
+                       unsigned int threads, struct timeval *timeout,
+                       const CONTENTS *input, const CONTENTS *reference) {
+  TEST *t = testNew();
+  testSetThreads(t, threads);
+  testSetTimeout(t, timeout);
+  testAddRun(t, run);
+  testSetInput(t, input);
+  testSetTesting(t, reference);
+
+  RESULT *r = testRun(t);
+  assert(r);
+
+  testDestory(t);
+
+  return r;
+}
+
+/* The reference is always computed by the plain table or zlib code, so
+   a hardware kernel is checked against it. */
+static CONTENTS *referenceContents(const ALGORITHM *a, const CONTENTS *input) {
+  checksumFunc run = a->combine ? a->run : crc32cTableRun;
+  return checkContents(run(a->init, input->body, input->size));
+}
+
+static void viewContents(CONTENTS *view, const unsigned char *body, size_t size) {
+  memset(view, 0, sizeof(*view));
+  view->body = (unsigned char *)body;
+  view->size = size;
+  view->borrowed = 1;
+}
+
+/* Every algorithm over sizes growing fourfold from 64 bytes to max. */
+static cJSON *sizesJSON(const ALGORITHM *a, const unsigned char *buffer,
+                        size_t max, unsigned int threads,
+                        struct timeval *timeout, int verbose) {
+  cJSON *json = cJSON_CreateArray();
+  assert(json);
+
+  for (size_t size = 64; size <= max; size <<= 2) {
+    CONTENTS input;
+    viewContents(&input, buffer, size);
+    CONTENTS *reference = referenceContents(a, &input);
+
+    RESULT *r = runTest(&checksumContent, threads, timeout, &input, reference);
+    double interval = resultAvgIntervalByRun(r, 0);
+    size_t reps = batchReps(checksumBatch, size);
+
+    cJSON *item = cJSON_CreateObject();
+    assert(item);
+    cJSON_AddNumberToObject(item, "size", size);
+    cJSON_AddNumberToObject(item, "GBps",
+                            (double)size * reps / interval * 1000000 /
+                            (1 << 30) * resultThreads(r));
+    cJSON_AddNumberToObject(item, "nsPerCall", interval * 1000 / reps);
+    cJSON_AddBoolToObject(item, "correct", isResultCorrect(r));
+    if (verbose) {
+      cJSON_AddItemToObject(item, "result", resultJSON(r, 0));
+    }
+    cJSON_AddItemToArray(json, item);
+
+    resultDestory(r);
+    destroyContents(reference);
+    free(reference);
+  }
+
+  return json;
+}
+
+/* Latency of one checksum of the whole buffer against the number of
+   workers, each point measured by a single harness thread. */
+static cJSON *parallelJSON(const ALGORITHM *a, const unsigned char *buffer,
+                           size_t size, unsigned int threads,
+                           struct timeval *timeout, int verbose) {
+  CONTENTS input;
+  viewContents(&input, buffer, size);
+  CONTENTS *reference = referenceContents(a, &input);
+
+  cJSON *json = cJSON_CreateArray();
+  assert(json);
+
+  double baseLatency = 0;
+  for (unsigned int w = 1; w; w = parallelNextWorkers(w, threads)) {
+    workers = w;
+
+    RESULT *r = runTest(&checksumContentParallel, 1, timeout, &input, reference);
+    double latency = resultAvgIntervalByRun(r, 0);
+    if (w == 1) baseLatency = latency;
+
+    cJSON *point = cJSON_CreateObject();
+    assert(point);
+    cJSON_AddNumberToObject(point, "workers", w);
+    cJSON_AddNumberToObject(point, "GBps",
+                            (double)size / latency * 1000000 / (1 << 30));
+    cJSON_AddNumberToObject(point, "nsPerCall", latency * 1000);
+    cJSON_AddNumberToObject(point, "speedup", baseLatency / latency);
+    cJSON_AddBoolToObject(point, "correct", isResultCorrect(r));
+    if (verbose) {
+      cJSON_AddItemToObject(point, "result", resultJSON(r, 0));
+    }
+    cJSON_AddItemToArray(json, point);
+
+    resultDestory(r);
+  }
+  workers = 1;
+
+  destroyContents(reference);
+  free(reference);
+
+  return json;
+}
+
+static void printUsage() {
+  fprintf(stderr,
+          "Usage: checksum_bench \n"
+          "[-r seconds <seconds, default is 3>]\n"
+          "[-t threads <threads, default is logic cpu cores>]\n"
+          "[-a <algorithms>, comma separated crc32, crc32_z, adler32 or crc32c, default is all]\n"
+          "[-s size <largest size, size can use K, M, G, default is 1G>]\n"
+          "[-b size <slice size of parallel checksums, default is 4M>]\n"
+          "[-p <only run parallel checksums>]\n"
+          "[-v <verbose json output>] [-f <formated json output>]\n");
+}
+
+int main(int argc, char **argv) {
+  int ret = -1;
+  unsigned char *buffer = NULL;
+
+  struct timeval timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 0;
+  unsigned int threads = 0;
+  int verbose = 0;
+  int formated = 0;
+  size_t max = 1 << 30;
+  int parallelOnly = 0;
+  unsigned int selected = (1 << algorithmCount) - 1;
+  const char *algorithmNames[algorithmCount];
+  for (unsigned int i = 0; i < algorithmCount; i ++) {
+    algorithmNames[i] = algorithms[i].name;
+  }
+
+  int c;
+  opterr = 0;
+
+  while ((c = getopt(argc, argv, "r:t:a:s:b:pvf")) != -1) {
+    switch (c) {
+    case 'r':
+      timeout.tv_sec = atoi(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'a':
+      selected = parseNameList(optarg, algorithmNames, algorithmCount);
+      if (!selected) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 's':
+      max = parseHumanSize(optarg);
+      if (max < 64) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'b':
+      blockSize = parseHumanSize(optarg);
+      if (blockSize == 0) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'p':
+      parallelOnly = 1;
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'f':
+      formated = 1;
+      break;
+    case '?':
+      printUsage();
+      goto END;
+    }
+  }
+
+  if (timeout.tv_sec == 0) {
+    timeout.tv_sec = 3;
+  }
+
+  if (threads == 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads == 0)
+      threads = 2;
+  }
+
+  const char *crc32cImplementation = crc32cInit();
+
+  buffer = malloc(max);
+  assert(buffer);
+  xorshiftFill(buffer, max);
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddNumberToObject(json, "threads", threads);
+  cJSON_AddNumberToObject(json, "maxSize", max);
+  cJSON_AddStringToObject(json, "crc32c", crc32cImplementation);
+  cJSON_AddItemToObject(json, "cpuFlags", cpuFlagsJSON());
+
+  cJSON *algorithmsJSON = cJSON_CreateArray();
+  assert(algorithmsJSON);
+  for (unsigned int i = 0; i < algorithmCount; i ++) {
+    if (!(selected & (1 << i))) continue;
+    algorithm = &algorithms[i];
+
+    cJSON *item = cJSON_CreateObject();
+    assert(item);
+    cJSON_AddStringToObject(item, "algorithm", algorithm->name);
+    if (!parallelOnly) {
+      cJSON_AddItemToObject(item, "sizes",
+                            sizesJSON(algorithm, buffer, max, threads,
+                                      &timeout, verbose));
+    }
+    if (algorithm->combine) {
+      cJSON *parallel = cJSON_CreateObject();
+      assert(parallel);
+      cJSON_AddNumberToObject(parallel, "size", max);
+      cJSON_AddNumberToObject(parallel, "blockSize", blockSize);
+      cJSON_AddItemToObject(parallel, "points",
+                            parallelJSON(algorithm, buffer, max, threads,
+                                         &timeout, verbose));
+      cJSON_AddItemToObject(item, "parallel", parallel);
+    }
+    cJSON_AddItemToArray(algorithmsJSON, item);
+  }
+  cJSON_AddItemToObject(json, "algorithms", algorithmsJSON);
+
+  printJSON(json, formated);
+
+  cJSON_Delete(json);
+
+  ret = 0;
+
+END:
+  free(buffer);
+  return ret;
+}
@@ -109,7 +109,9 @@ CONTENTS *getContents(const char *url) {
 
 int destroyContents(CONTENTS *file) {
   if (file != NULL) {
-    if (file->body != NULL) {
+    if (file->body != NULL && file->release) {
+      file->release(file->body);
+    } else if (file->body != NULL && !file->borrowed) {
       free(file->body);
     }
   }
@@ -6,6 +6,10 @@
 struct f_data {
   unsigned char *body;
   size_t size;
+  /* body belongs to someone else and is not freed with the contents */
+  int borrowed;
+  /* frees body instead of free() when set, for bodies from allocators */
+  void (*release)(void *body);
 };
 
 typedef struct f_data CONTENTS;
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "cpucap.h"
+
+struct c_flag {
+  const char *name;
+  unsigned int leaf;
+  unsigned int reg; /* 1 = ebx, 2 = ecx, 3 = edx */
+  unsigned int bit;
+};
+typedef struct c_flag FLAG;
+
+static const FLAG flags[] = {
+  {"sse2", 1, 3, 26},
+  {"ssse3", 1, 2, 9},
+  {"sse4_1", 1, 2, 19},
+  {"sse4_2", 1, 2, 20},
+  {"pclmulqdq", 1, 2, 1},
+  {"aes", 1, 2, 25},
+  {"movbe", 1, 2, 22},
+  {"avx", 1, 2, 28},
+  {"avx2", 7, 1, 5},
+  {"bmi1", 7, 1, 3},
+  {"bmi2", 7, 1, 8},
+  {"adx", 7, 1, 19},
+  {"sha_ni", 7, 1, 29},
+  {"avx512f", 7, 1, 16},
+  {"avx512dq", 7, 1, 17},
+  {"avx512bw", 7, 1, 30},
+  {"avx512vl", 7, 1, 31},
+  {"gfni", 7, 2, 8},
+  {"vaes", 7, 2, 9},
+  {"vpclmulqdq", 7, 2, 10},
+};
+
+/* OpenSSL's capability vector is CPUID.1:EDX|ECX<<32 followed after
+   the colon by CPUID.7:EBX|ECX<<32; "~mask" clears the masked bits.
+   Tiers are cumulative and named after what they add. */
+struct c_tier {
+  const char *name;
+  const char *ia32cap;
+  const char *requires[3];
+};
+typedef struct c_tier TIER;
+
+static const TIER tiers[] = {
+  /* Everything off: OpenSSL's scalar code paths. */
+  {"generic", "~0xffffffffffffffff:~0xffffffffffffffff", {NULL}},
+  /* SSE up to SSE4.2, no AES-NI, CLMUL, AVX, MOVBE or XOP. */
+  {"ssse3", "~0x1240180200000000:~0xffffffffffffffff", {"ssse3", NULL}},
+  /* Adds AES-NI, PCLMULQDQ and AVX, nothing from CPUID.7. */
+  {"aesni", "~0x0:~0xffffffffffffffff", {"aes", "pclmulqdq", NULL}},
+  /* Adds SHA-NI. */
+  {"sha-ni", "~0x0:~0xffffffffdfffffff", {"sha_ni", NULL}},
+  /* Adds AVX2, BMI and ADX, still no AVX-512, VAES or VPCLMULQDQ. */
+  {"avx2", "~0x0:~0xffffffffdc230000", {"avx2", NULL}},
+  /* Adds AVX-512, still no VAES or VPCLMULQDQ. */
+  {"avx512", "~0x0:~0x0000060000000000", {"avx512f", NULL}},
+  /* Unmasked. */
+  {"vaes", NULL, {"vaes", "vpclmulqdq", NULL}},
+};
+
+int cpuHasFlag(const char *name) {
+#if defined(__x86_64__) || defined(__i386__)
+  for (unsigned int i = 0; i < sizeof(flags) / sizeof(flags[0]); i ++) {
+    if (strcmp(flags[i].name, name) != 0) continue;
+
+    unsigned int regs[4] = {0, 0, 0, 0};
+    if (!__get_cpuid_count(flags[i].leaf, 0,
+                           &regs[0], &regs[1], &regs[2], &regs[3])) {
+      return 0;
+    }
+    return (regs[flags[i].reg] >> flags[i].bit) & 1;
+  }
+#endif
+  return 0;
+}
+
+cJSON *cpuFlagsJSON() {
+  cJSON *json = cJSON_CreateArray();
+  assert(json);
+
+  for (unsigned int i = 0; i < sizeof(flags) / sizeof(flags[0]); i ++) {
+    if (cpuHasFlag(flags[i].name)) {
+      cJSON_AddItemToArray(json, cJSON_CreateString(flags[i].name));
+    }
+  }
+
+  return json;
+}
+
+int cpuTierChild() {
+  return getenv(cpuTierEnv) != NULL;
+}
+
+/* Run argv under one tier and return everything it printed. */
+static char *tierOutput(const TIER *tier, char **argv) {
+  int fds[2];
+  int i = pipe(fds);
+  assert(i == 0);
+
+  fflush(stdout);
+  pid_t pid = fork();
+  assert(pid >= 0);
+
+  if (pid == 0) {
+    close(fds[0]);
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[1]);
+
+    setenv(cpuTierEnv, tier->name, 1);
+    if (tier->ia32cap) {
+      setenv("OPENSSL_ia32cap", tier->ia32cap, 1);
+    }
+
+    execv("/proc/self/exe", argv);
+    _exit(127);
+  }
+
+  close(fds[1]);
+
+  size_t size = 0;
+  size_t capacity = 4096;
+  char *output = (char *)malloc(capacity);
+  assert(output);
+
+  ssize_t n;
+  while ((n = read(fds[0], output + size, capacity - size - 1)) > 0) {
+    size += n;
+    if (capacity - size == 1) {
+      capacity *= 2;
+      output = (char *)realloc(output, capacity);
+      assert(output);
+    }
+  }
+  output[size] = '\0';
+  close(fds[0]);
+
+  int status = 0;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    free(output);
+    return NULL;
+  }
+
+  return output;
+}
+
+/* MiB/s of the first stage, from a plain harness result. */
+static double firstStageMBps(const cJSON *result) {
+  const cJSON *threads = cJSON_GetObjectItemCaseSensitive(result, "threads");
+  const cJSON *runs = cJSON_GetObjectItemCaseSensitive(result, "runs");
+  if (!cJSON_IsNumber(threads) || !runs || !runs->child) return 0;
+
+  const cJSON *input = cJSON_GetObjectItemCaseSensitive(runs->child, "input");
+  const cJSON *interval = cJSON_GetObjectItemCaseSensitive(runs->child, "avgInterval");
+  if (!cJSON_IsNumber(input) || !cJSON_IsNumber(interval) ||
+      interval->valuedouble <= 0) {
+    return 0;
+  }
+
+  return input->valuedouble / interval->valuedouble * threads->valuedouble *
+         1000000.0 / (double)(1 << 20);
+}
+
+cJSON *cpuTiersJSON(char **argv) {
+  cJSON *json = cJSON_CreateArray();
+  assert(json);
+
+#if defined(__x86_64__) || defined(__i386__)
+  double base = 0;
+
+  for (unsigned int i = 0; i < sizeof(tiers) / sizeof(tiers[0]); i ++) {
+    const TIER *tier = &tiers[i];
+
+    int supported = 1;
+    for (unsigned int j = 0; j < 3 && tier->requires[j]; j ++) {
+      supported &= cpuHasFlag(tier->requires[j]);
+    }
+
+    cJSON *tierJSON = cJSON_CreateObject();
+    assert(tierJSON);
+    cJSON_AddStringToObject(tierJSON, "tier", tier->name);
+    if (tier->ia32cap) {
+      cJSON_AddStringToObject(tierJSON, "ia32cap", tier->ia32cap);
+    }
+    cJSON_AddBoolToObject(tierJSON, "supported", supported);
+    cJSON_AddItemToArray(json, tierJSON);
+
+    if (!supported) continue;
+
+    char *output = tierOutput(tier, argv);
+    cJSON *result = output ? cJSON_Parse(output) : NULL;
+    free(output);
+    if (!result) {
+      cJSON_AddBoolToObject(tierJSON, "success", 0);
+      continue;
+    }
+
+    double mbps = firstStageMBps(result);
+    if (mbps > 0) {
+      cJSON_AddNumberToObject(tierJSON, "MBps", mbps);
+      if (base == 0) base = mbps;
+      cJSON_AddNumberToObject(tierJSON, "speedup", mbps / base);
+    }
+    cJSON_AddItemToObject(tierJSON, "result", result);
+  }
+#else
+  (void)argv;
+#endif
+
+  return json;
+}
@@ -0,0 +1,27 @@
+#ifndef __REALITY_CPUCAP_H
+#define __REALITY_CPUCAP_H
+
+#include "external/cJSON.h"
+
+/* Set in the environment of a benchmark re-executed for one tier. */
+#define cpuTierEnv "REALITY_CPU_TIER"
+
+/* Instruction set flags relevant to crypto and hashing that CPUID
+   reports on this host, as an array of names. Empty off x86. */
+cJSON *cpuFlagsJSON();
+
+/* Non-zero when CPUID reports the named flag, as spelled in
+   cpuFlagsJSON. Always zero off x86. */
+int cpuHasFlag(const char *name);
+
+/* Non-zero when this process is already running under a tier. */
+int cpuTierChild();
+
+/* Re-execute argv once per feature tier (generic, ssse3, aesni, sha-ni,
+   avx2, avx512, vaes) with OPENSSL_ia32cap masking OpenSSL's capability
+   vector down to that tier, and collect each run's JSON output. The run
+   must print a single JSON document on stdout. Tiers the host cannot provide are
+   reported but not run. */
+cJSON *cpuTiersJSON(char **argv);
+
+#endif
@@ -0,0 +1,472 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "cstage.h"
+
+CSETTINGS cSettings = {
+  NULL, 0, 0, 16, 0, keyModeFixed, 0, NULL, NULL
+};
+
+static unsigned char key[64];
+static unsigned char iv[16];
+static unsigned char aad[32];
+
+void cipherKeys() {
+  int fd = open("/dev/urandom", O_RDONLY);
+  assert(fd >= 0);
+
+  ssize_t ret;
+
+  ret = read(fd, key, cSettings.keyLength);
+  assert(ret == cSettings.keyLength);
+
+  ret = read(fd, iv, sizeof(iv));
+  assert(ret == sizeof(iv));
+
+  if (cSettings.tagLength) {
+    ret = read(fd, aad, sizeof(aad));
+    assert(ret == sizeof(aad));
+  }
+
+  close(fd);
+}
+
+/* Each thread keeps one encrypt and one decrypt context. */
+struct c_thread {
+  EVP_CIPHER_CTX *encrypt;
+  EVP_CIPHER_CTX *decrypt;
+  unsigned char *buffer;
+};
+typedef struct c_thread THREAD;
+
+static pthread_key_t threadKey;
+static pthread_once_t threadOnce = PTHREAD_ONCE_INIT;
+
+static void threadDestroy(void *arg) {
+  THREAD *thread = (THREAD *)arg;
+
+  EVP_CIPHER_CTX_free(thread->encrypt);
+  EVP_CIPHER_CTX_free(thread->decrypt);
+  free(thread->buffer);
+  free(thread);
+}
+
+static EVP_CIPHER_CTX *contextNew(int enc) {
+  unsigned int cipherMode = cSettings.cipherMode;
+  int i;
+
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+  assert(ctx);
+
+  i = EVP_CipherInit_ex(ctx, cSettings.cipher, NULL, NULL, NULL, enc);
+  assert(i==1);
+
+  if (cSettings.tagLength) {
+    i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, cSettings.ivLength,
+                            NULL);
+    assert(i==1);
+  }
+  if (cipherMode == cipherModeCCM || cipherMode == cipherModeOCB) {
+    /* CCM and OCB fix the tag size when the key is set. */
+    i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, cSettings.tagLength,
+                            NULL);
+    assert(i==1);
+  }
+
+  i = EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, enc);
+  assert(i==1);
+
+  return ctx;
+}
+
+static void threadKeyCreate() {
+  pthread_key_create(&threadKey, threadDestroy);
+}
+
+static THREAD *threadGet() {
+  pthread_once(&threadOnce, threadKeyCreate);
+
+  THREAD *thread = (THREAD *)pthread_getspecific(threadKey);
+
+  if (!thread) {
+    thread = (THREAD *)calloc(1, sizeof(THREAD));
+    assert(thread);
+    thread->encrypt = contextNew(1);
+    thread->decrypt = contextNew(0);
+
+    pthread_setspecific(threadKey, thread);
+  }
+
+  return thread;
+}
+
+static EVP_CIPHER_CTX *threadContext(int enc) {
+  THREAD *thread = threadGet();
+
+  return enc ? thread->encrypt : thread->decrypt;
+}
+
+/* Start a message: new IV, and the key again in agile mode. */
+static void contextReset(EVP_CIPHER_CTX *ctx, int enc,
+                         const unsigned char *nonce) {
+  int i = EVP_CipherInit_ex(ctx, NULL, NULL,
+                            cSettings.keyMode == keyModeAgile ? key : NULL,
+                            nonce, enc);
+  assert(i==1);
+}
+
+/* XTS encrypts a disk-like sequence of data units, each with its unit
+   number as tweak. A tail shorter than a block is folded into the last
+   unit since XTS needs at least one full block. */
+#define xtsUnitSize 4096
+
+static size_t xtsBuffer(EVP_CIPHER_CTX *ctx, int enc,
+                        const unsigned char *in, size_t size,
+                        unsigned char *out) {
+  unsigned char tweak[16];
+  int i, len;
+
+  size_t offset = 0;
+  for (uint64_t unit = 0; offset < size; unit ++) {
+    size_t length = size - offset;
+    if (length >= xtsUnitSize + 16) length = xtsUnitSize;
+
+    memset(tweak, 0, sizeof(tweak));
+    for (int k = 0; k < 8; k ++) {
+      tweak[k] = (unsigned char)(unit >> (k * 8));
+    }
+    contextReset(ctx, enc, tweak);
+
+    i = EVP_CipherUpdate(ctx, out + offset, &len, in + offset, length);
+    assert(i==1);
+
+    offset += len;
+  }
+
+  return size;
+}
+
+/* Decrypt size bytes from in to out, which may be the same buffer. */
+static size_t decryptBuffer(const unsigned char *in, size_t size,
+                            unsigned char *out) {
+  EVP_CIPHER_CTX *ctx = threadContext(0);
+
+  if (cSettings.cipherMode == cipherModeXTS) {
+    return xtsBuffer(ctx, 0, in, size, out);
+  }
+
+  int i = 0;
+
+  int len;
+  size_t dataLength = size;
+  size_t outSize;
+
+  if (cSettings.tagLength) {
+    dataLength -= cSettings.tagLength;
+    void *tag = (void *)(in + dataLength);
+
+    /* The tag has to be taken before an in place decrypt overwrites
+       it, and before the key and nonce for CCM. */
+    if (cSettings.cipherMode == cipherModeCCM) {
+      i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, cSettings.tagLength,
+                              tag);
+      assert(i==1);
+    }
+
+    contextReset(ctx, 0, iv);
+
+    if (cSettings.cipherMode == cipherModeCCM) {
+      i = EVP_DecryptUpdate(ctx, NULL, &len, NULL, dataLength);
+      assert(i==1);
+    } else {
+      i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, cSettings.tagLength,
+                              tag);
+      assert(i==1);
+    }
+
+    i = EVP_DecryptUpdate(ctx, NULL, &len, aad, sizeof(aad));
+    assert(i==1);
+  } else {
+    contextReset(ctx, 0, iv);
+  }
+
+  i = EVP_DecryptUpdate(ctx, out, &len, in, dataLength);
+  assert(i==1);
+  outSize = len;
+
+  if (cSettings.cipherMode != cipherModeCCM) {
+    i = EVP_DecryptFinal_ex(ctx, out + len, &len);
+    assert(i==1);
+    outSize += len;
+  }
+
+  return outSize;
+}
+
+/* Encrypt size bytes from in to out, which may be the same buffer if it
+   has room for a padding block and the tag. */
+static size_t encryptBuffer(const unsigned char *in, size_t size,
+                            unsigned char *out) {
+  EVP_CIPHER_CTX *ctx = threadContext(1);
+
+  if (cSettings.cipherMode == cipherModeXTS) {
+    return xtsBuffer(ctx, 1, in, size, out);
+  }
+
+  int len;
+  size_t outSize;
+
+  int i = 0;
+
+  contextReset(ctx, 1, iv);
+
+  if (cSettings.tagLength) {
+    if (cSettings.cipherMode == cipherModeCCM) {
+      i = EVP_EncryptUpdate(ctx, NULL, &len, NULL, size);
+      assert(i==1);
+    }
+
+    i = EVP_EncryptUpdate(ctx, NULL, &len, aad, sizeof(aad));
+    assert(i==1);
+  }
+
+  i = EVP_EncryptUpdate(ctx, out, &len, in, size);
+  assert(i==1);
+  outSize = len;
+
+  i = EVP_EncryptFinal_ex(ctx, out + len, &len);
+  assert(i==1);
+  outSize += len;
+
+  if (cSettings.tagLength) {
+    i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, cSettings.tagLength,
+                            out + outSize);
+    assert(i==1);
+    outSize += cSettings.tagLength;
+  }
+
+  return outSize;
+}
+
+size_t encryptedSize(size_t size) {
+  return size + EVP_CIPHER_block_size(cSettings.cipher) + cSettings.tagLength;
+}
+
+CONTENTS *decryptContent(const CONTENTS* data) {
+  CONTENTS* ret = NULL;
+  ret = calloc(1, sizeof(CONTENTS));
+  assert(ret);
+  ret->body = (unsigned char*)malloc(data->size);
+  assert(ret->body);
+
+  ret->size = decryptBuffer(data->body, data->size, ret->body);
+
+  return ret;
+}
+
+CONTENTS *encryptContent(const CONTENTS* data) {
+  CONTENTS* ret = NULL;
+  ret = calloc(1, sizeof(CONTENTS));
+  assert(ret);
+  ret->body = (unsigned char*)malloc(encryptedSize(data->size));
+  assert(ret->body);
+
+  ret->size = encryptBuffer(data->body, data->size, ret->body);
+
+  return ret;
+}
+
+/* In place: each thread encrypts its own working copy of the input and
+   decrypts it back in the same buffer, so no message is allocated or
+   copied. The round trip leaves the plaintext for the next loop. */
+CONTENTS *encryptContentInPlace(const CONTENTS* data) {
+  THREAD *thread = threadGet();
+
+  if (!thread->buffer) {
+    thread->buffer = (unsigned char*)malloc(encryptedSize(data->size));
+    assert(thread->buffer);
+    memcpy(thread->buffer, data->body, data->size);
+  }
+
+  CONTENTS* ret = NULL;
+  ret = calloc(1, sizeof(CONTENTS));
+  assert(ret);
+  ret->body = thread->buffer;
+  ret->borrowed = 1;
+
+  ret->size = encryptBuffer(thread->buffer, data->size, thread->buffer);
+
+  return ret;
+}
+
+CONTENTS *decryptContentInPlace(const CONTENTS* data) {
+  assert(data->body == threadGet()->buffer);
+
+  CONTENTS* ret = NULL;
+  ret = calloc(1, sizeof(CONTENTS));
+  assert(ret);
+  ret->body = data->body;
+  ret->borrowed = 1;
+
+  ret->size = decryptBuffer(data->body, data->size, data->body);
+
+  return ret;
+}
+
+size_t recordCount(size_t size) {
+  return (size + cSettings.recordSize - 1) / cSettings.recordSize;
+}
+
+static void recordNonce(unsigned char *nonce, uint64_t seq) {
+  memcpy(nonce, iv, recordNonceLength);
+  for (int i = 0; i < 8; i ++) {
+    nonce[recordNonceLength - 1 - i] ^= (unsigned char)(seq >> (i * 8));
+  }
+}
+
+static void recordAAD(unsigned char *ad, uint64_t seq, size_t length) {
+  for (int i = 0; i < 8; i ++) {
+    ad[7 - i] = (unsigned char)(seq >> (i * 8));
+  }
+  ad[8] = 23;
+  ad[9] = 3;
+  ad[10] = 3;
+  ad[11] = (unsigned char)(length >> 8);
+  ad[12] = (unsigned char)length;
+}
+
+CONTENTS *sealRecords(const CONTENTS *data) {
+  EVP_CIPHER_CTX *ctx = threadContext(1);
+
+  unsigned char nonce[recordNonceLength];
+  unsigned char ad[recordAADLength];
+  int i, len;
+
+  size_t count = recordCount(data->size);
+
+  CONTENTS* ret = NULL;
+  ret = calloc(1, sizeof(CONTENTS));
+  assert(ret);
+  ret->body = (unsigned char*)malloc(data->size + count * cSettings.tagLength);
+  assert(ret->body);
+
+  for (uint64_t seq = 0; seq < count; seq ++) {
+    unsigned long start = latencyNow();
+
+    size_t offset = seq * cSettings.recordSize;
+    size_t length = data->size - offset < cSettings.recordSize ?
+                    data->size - offset : cSettings.recordSize;
+    unsigned char *out = ret->body + ret->size;
+
+    recordNonce(nonce, seq);
+    recordAAD(ad, seq, length);
+    contextReset(ctx, 1, nonce);
+
+    if (cSettings.cipherMode == cipherModeCCM) {
+      i = EVP_EncryptUpdate(ctx, NULL, &len, NULL, length);
+      assert(i==1);
+    }
+
+    i = EVP_EncryptUpdate(ctx, NULL, &len, ad, sizeof(ad));
+    assert(i==1);
+
+    i = EVP_EncryptUpdate(ctx, out, &len, data->body + offset, length);
+    assert(i==1);
+
+    i = EVP_EncryptFinal_ex(ctx, out + len, &len);
+    assert(i==1);
+
+    i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, cSettings.tagLength,
+                            out + length);
+    assert(i==1);
+
+    ret->size += length + cSettings.tagLength;
+
+    if (cSettings.sealLatency) {
+      latencyAdd(cSettings.sealLatency, latencyNow() - start);
+    }
+  }
+
+  return ret;
+}
+
+CONTENTS *openRecords(const CONTENTS *data) {
+  EVP_CIPHER_CTX *ctx = threadContext(0);
+
+  unsigned char nonce[recordNonceLength];
+  unsigned char ad[recordAADLength];
+  int i, len;
+
+  size_t sealedSize = cSettings.recordSize + cSettings.tagLength;
+  size_t count = (data->size + sealedSize - 1) / sealedSize;
+  int ok = 1;
+
+  CONTENTS* ret = NULL;
+  ret = calloc(1, sizeof(CONTENTS));
+  assert(ret);
+  ret->body = (unsigned char*)malloc(data->size);
+  assert(ret->body);
+
+  for (uint64_t seq = 0; ok && seq < count; seq ++) {
+    unsigned long start = latencyNow();
+
+    size_t offset = seq * sealedSize;
+    size_t sealed = data->size - offset < sealedSize ?
+                    data->size - offset : sealedSize;
+    if (sealed < (size_t)cSettings.tagLength) {
+      ok = 0;
+      break;
+    }
+    size_t length = sealed - cSettings.tagLength;
+    const unsigned char *in = data->body + offset;
+    unsigned char *tag = (unsigned char *)in + length;
+
+    recordNonce(nonce, seq);
+    recordAAD(ad, seq, length);
+
+    if (cSettings.cipherMode == cipherModeCCM) {
+      i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, cSettings.tagLength,
+                              tag);
+      assert(i==1);
+    }
+
+    contextReset(ctx, 0, nonce);
+
+    if (cSettings.cipherMode == cipherModeCCM) {
+      i = EVP_DecryptUpdate(ctx, NULL, &len, NULL, length);
+      assert(i==1);
+    }
+
+    i = EVP_DecryptUpdate(ctx, NULL, &len, ad, sizeof(ad));
+    assert(i==1);
+
+    /* CCM checks the tag here, the others in the final call. */
+    ok = EVP_DecryptUpdate(ctx, ret->body + ret->size, &len, in, length) == 1;
+    if (ok && cSettings.cipherMode != cipherModeCCM) {
+      i = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, cSettings.tagLength,
+                              tag);
+      assert(i==1);
+
+      ok = EVP_DecryptFinal_ex(ctx, ret->body + ret->size + len, &len) == 1;
+    }
+
+    ret->size += length;
+
+    if (cSettings.openLatency) {
+      latencyAdd(cSettings.openLatency, latencyNow() - start);
+    }
+  }
+
+  if (!ok) {
+    destroyContents(ret);
+    free(ret);
+    return NULL;
+  }
+
+  return ret;
+}
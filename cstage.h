@@ -0,0 +1,68 @@
+#ifndef __REALITY_CSTAGE_H
+#define __REALITY_CSTAGE_H
+
+#include <stdlib.h>
+#include <openssl/evp.h>
+
+#include "contents.h"
+#include "latency.h"
+
+#define cipherModeCBC (1 << 0)
+#define cipherModeCFB (1 << 1)
+#define cipherModeOFB (1 << 2)
+#define cipherModeCTR (1 << 3)
+#define cipherModeGCM (1 << 4)
+#define cipherModeCCM (1 << 5)
+#define cipherModeOCB (1 << 6)
+#define cipherModeXTS (1 << 7)
+#define cipherModeChaCha20Poly1305 (1 << 8)
+
+#define keyModeFixed (1 << 0)
+#define keyModeAgile (1 << 1)
+
+/* TLS style records: the input is cut into records of at most
+   recordSize bytes, each sealed with its own nonce (the static IV XOR
+   the sequence number, as TLS 1.3 does) and a 13 byte TLS 1.2 style
+   AAD, and carried as ciphertext followed by the tag. */
+#define recordNonceLength 12
+#define recordAADLength 13
+
+/* The cipher every stage below runs. keyLength is the key actually
+   installed (both AES keys for XTS) and a tagLength marks an AEAD.
+   Fixed keyMode expands the key schedule once per thread and every
+   message only sets a new IV; agile installs the key again for every
+   message, as a server handling a different session per request would.
+   Record latencies are recorded when set. */
+struct c_settings {
+  const EVP_CIPHER *cipher;
+  unsigned int cipherMode;
+  unsigned int keyLength;
+  int ivLength;
+  int tagLength;
+  unsigned int keyMode;
+  size_t recordSize;
+  LATENCY *sealLatency;
+  LATENCY *openLatency;
+};
+typedef struct c_settings CSETTINGS;
+
+extern CSETTINGS cSettings;
+
+/* Draw a random key of keyLength, IV and AAD. Threads set up their
+   contexts on first use, so call this between runs only. */
+void cipherKeys();
+
+size_t encryptedSize(size_t size);
+size_t recordCount(size_t size);
+
+/* Harness stages. Whole messages use the one IV and AAD; in place
+   stages encrypt each thread's own copy of the input and decrypt it
+   back in the same buffer. openRecords returns NULL on a bad tag. */
+CONTENTS *encryptContent(const CONTENTS *data);
+CONTENTS *decryptContent(const CONTENTS *data);
+CONTENTS *encryptContentInPlace(const CONTENTS *data);
+CONTENTS *decryptContentInPlace(const CONTENTS *data);
+CONTENTS *sealRecords(const CONTENTS *data);
+CONTENTS *openRecords(const CONTENTS *data);
+
+#endif
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "document.h"
+
+/* Set by documentGenerate for the generators below. */
+static unsigned int shapeWidth;
+static unsigned int shapeStringPercent;
+
+static const char *words[] = {
+  "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf",
+  "hotel", "india", "juliett", "kilo", "lima", "mike", "november",
+  "oscar", "papa", "quebec", "romeo", "sierra", "tango", "uniform",
+  "victor", "whiskey", "x-ray", "yankee", "zulu", "\"quoted\"",
+  "line\nbreak", "caf\xc3\xa9", "tab\tseparated"
+};
+#define wordCount (sizeof(words) / sizeof(words[0]))
+
+static cJSON *generateString(unsigned int *seed) {
+  char text[128];
+  size_t length = 0;
+  unsigned int n = 1 + rand_r(seed) % 4;
+
+  text[0] = '\0';
+  for (unsigned int i = 0; i < n; i ++) {
+    length += snprintf(text + length, sizeof(text) - length, "%s%s",
+                       i ? " " : "", words[rand_r(seed) % wordCount]);
+  }
+
+  return cJSON_CreateString(text);
+}
+
+static cJSON *generateNumber(unsigned int *seed) {
+  if (rand_r(seed) & 1) {
+    return cJSON_CreateNumber(rand_r(seed) % 1000000);
+  }
+  return cJSON_CreateNumber((double)rand_r(seed) / 1000.0);
+}
+
+static cJSON *generateLeaf(unsigned int *seed) {
+  if ((unsigned int)(rand_r(seed) % 100) < shapeStringPercent) {
+    return generateString(seed);
+  }
+  return generateNumber(seed);
+}
+
+static cJSON *generateRecord(unsigned int level, unsigned int *seed) {
+  cJSON *record = cJSON_CreateObject();
+  assert(record);
+
+  cJSON_AddNumberToObject(record, "id", rand_r(seed));
+  cJSON_AddItemToObject(record, "name", generateString(seed));
+  cJSON_AddBoolToObject(record, "active", rand_r(seed) & 1);
+  cJSON_AddItemToObject(record, "value", generateLeaf(seed));
+  if (rand_r(seed) % 8 == 0) {
+    cJSON_AddNullToObject(record, "deleted");
+  }
+
+  cJSON *tags = cJSON_CreateArray();
+  assert(tags);
+  for (unsigned int i = 0; i < shapeWidth; i ++) {
+    cJSON_AddItemToArray(tags, generateLeaf(seed));
+  }
+  cJSON_AddItemToObject(record, "tags", tags);
+
+  if (level > 1) {
+    cJSON *children = cJSON_CreateArray();
+    assert(children);
+    for (unsigned int i = 0; i < shapeWidth; i ++) {
+      cJSON_AddItemToArray(children, generateRecord(level - 1, seed));
+    }
+    cJSON_AddItemToObject(record, "children", children);
+  }
+
+  return record;
+}
+
+CONTENTS *documentGenerate(size_t size, unsigned int depth,
+                           unsigned int width, unsigned int stringPercent) {
+  unsigned int seed = 1;
+
+  shapeWidth = width;
+  shapeStringPercent = stringPercent;
+
+  cJSON *document = cJSON_CreateObject();
+  assert(document);
+  cJSON *data = cJSON_CreateArray();
+  assert(data);
+  cJSON_AddItemToObject(document, "data", data);
+
+  cJSON *record = generateRecord(depth, &seed);
+  char *text = cJSON_PrintUnformatted(record);
+  assert(text);
+  size_t count = size / (strlen(text) + 1) + 1;
+  free(text);
+  cJSON_AddItemToArray(data, record);
+
+  for (size_t i = 1; i < count; i ++) {
+    cJSON_AddItemToArray(data, generateRecord(depth, &seed));
+  }
+
+  CONTENTS *result = calloc(1, sizeof(CONTENTS));
+  assert(result);
+  result->body = (unsigned char *)cJSON_PrintUnformatted(document);
+  assert(result->body);
+  result->size = strlen((char *)result->body);
+
+  cJSON_Delete(document);
+
+  return result;
+}
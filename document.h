@@ -0,0 +1,17 @@
+#ifndef __REALITY_DOCUMENT_H
+#define __REALITY_DOCUMENT_H
+
+#include <stdlib.h>
+
+#include "contents.h"
+#include "external/cJSON.h"
+
+/* Synthetic API-shaped JSON documents of about size bytes, at least one
+   record: {"data": [record, ...]} where each record holds scalar fields,
+   a tags array of width leaves, and below the top level a children array
+   of width records, depth levels deep. stringPercent of the leaves are
+   strings, the rest numbers. The same arguments give the same document. */
+CONTENTS *documentGenerate(size_t size, unsigned int depth,
+                           unsigned int width, unsigned int stringPercent);
+
+#endif
@@ -0,0 +1,667 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define haveSimd 1
+#else
+#define haveSimd 0
+#endif
+
+#include "contents.h"
+#include "benchmark.h"
+#include "misc.h"
+#include "cpucap.h"
+
+/* kernelFunction for a given instruction set. */
+#define kernelTarget(isa) __attribute__((target(isa), optimize("O3"), noinline))
+
+/* Raw bytes encoded per harness call. */
+#define encodeBatch (1 << 20)
+
+/* Encoders write a NUL after their output, as EVP_EncodeBlock does.
+   Decoders return the decoded size, or -1 on invalid input. */
+typedef size_t (*encodeFunc)(unsigned char *out, const unsigned char *in,
+                             size_t size);
+typedef long (*decodeFunc)(unsigned char *out, const unsigned char *in,
+                           size_t size);
+
+struct e_codec {
+  const char *name;
+  /* CPUID flag the kernels need, NULL for portable code. */
+  const char *requires;
+  int hex;
+  encodeFunc encode;
+  decodeFunc decode;
+};
+typedef struct e_codec CODEC;
+
+static const char base64Alphabet[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char hexAlphabet[] = "0123456789abcdef";
+/* 0xff for characters outside the alphabet. */
+static unsigned char base64Values[256];
+static unsigned char hexValues[256];
+
+static void tablesInit() {
+  memset(base64Values, 0xff, sizeof(base64Values));
+  for (unsigned int i = 0; i < 64; i ++) {
+    base64Values[(unsigned char)base64Alphabet[i]] = i;
+  }
+
+  memset(hexValues, 0xff, sizeof(hexValues));
+  for (unsigned int i = 0; i < 16; i ++) {
+    hexValues[(unsigned char)hexAlphabet[i]] = i;
+    hexValues[(unsigned char)"0123456789ABCDEF"[i]] = i;
+  }
+}
+
+static size_t encodedSize(const CODEC *codec, size_t size) {
+  return codec->hex ? size * 2 : (size + 2) / 3 * 4;
+}
+
+static size_t evpEncode(unsigned char *out, const unsigned char *in,
+                        size_t size) {
+  return EVP_EncodeBlock(out, in, (int)size);
+}
+
+/* EVP_DecodeBlock counts padding as zero bytes. */
+static long evpDecode(unsigned char *out, const unsigned char *in,
+                      size_t size) {
+  long n = EVP_DecodeBlock(out, in, (int)size);
+  if (n < 0 || size < 4) return n;
+
+  if (in[size - 1] == '=') n --;
+  if (in[size - 2] == '=') n --;
+  return n;
+}
+
+kernelFunction static size_t base64EncodeScalar(unsigned char *out,
+                                                const unsigned char *in,
+                                                size_t size) {
+  size_t o = 0;
+  size_t i = 0;
+  for (; i + 3 <= size; i += 3) {
+    uint32_t v = (uint32_t)in[i] << 16 | (uint32_t)in[i + 1] << 8 | in[i + 2];
+    out[o ++] = base64Alphabet[v >> 18];
+    out[o ++] = base64Alphabet[(v >> 12) & 0x3f];
+    out[o ++] = base64Alphabet[(v >> 6) & 0x3f];
+    out[o ++] = base64Alphabet[v & 0x3f];
+  }
+
+  if (i < size) {
+    uint32_t v = (uint32_t)in[i] << 16;
+    if (i + 1 < size) v |= (uint32_t)in[i + 1] << 8;
+    out[o ++] = base64Alphabet[v >> 18];
+    out[o ++] = base64Alphabet[(v >> 12) & 0x3f];
+    out[o ++] = i + 1 < size ? base64Alphabet[(v >> 6) & 0x3f] : '=';
+    out[o ++] = '=';
+  }
+  out[o] = '\0';
+
+  return o;
+}
+
+kernelFunction static long base64DecodeScalar(unsigned char *out,
+                                              const unsigned char *in,
+                                              size_t size) {
+  if (size % 4) return -1;
+
+  size_t o = 0;
+  for (size_t i = 0; i < size; i += 4) {
+    unsigned int pad = 0;
+    if (i + 4 == size) {
+      pad = (in[i + 3] == '=') + (in[i + 2] == '=' && in[i + 3] == '=');
+    }
+
+    uint32_t v = 0;
+    for (unsigned int k = 0; k < 4 - pad; k ++) {
+      unsigned char d = base64Values[in[i + k]];
+      if (d == 0xff) return -1;
+      v = v << 6 | d;
+    }
+    v <<= 6 * pad;
+
+    out[o ++] = v >> 16;
+    if (pad < 2) out[o ++] = v >> 8;
+    if (pad < 1) out[o ++] = v;
+  }
+
+  return o;
+}
+
+kernelFunction static size_t hexEncodeScalar(unsigned char *out,
+                                             const unsigned char *in,
+                                             size_t size) {
+  for (size_t i = 0; i < size; i ++) {
+    out[2 * i] = hexAlphabet[in[i] >> 4];
+    out[2 * i + 1] = hexAlphabet[in[i] & 0x0f];
+  }
+  out[2 * size] = '\0';
+
+  return 2 * size;
+}
+
+kernelFunction static long hexDecodeScalar(unsigned char *out,
+                                           const unsigned char *in,
+                                           size_t size) {
+  if (size % 2) return -1;
+
+  for (size_t i = 0; i < size; i += 2) {
+    unsigned char h = hexValues[in[i]];
+    unsigned char l = hexValues[in[i + 1]];
+    if ((h | l) == 0xff) return -1;
+    out[i / 2] = h << 4 | l;
+  }
+
+  return size / 2;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+/* OPENSSL_buf2hexstr_ex writes upper case, which the decoders take.
+   It and OPENSSL_hexstr2buf_ex are OpenSSL 3 only, so hex-openssl is
+   only offered there. */
+static size_t opensslHexEncode(unsigned char *out, const unsigned char *in,
+                               size_t size) {
+  size_t length = 0;
+  int i = OPENSSL_buf2hexstr_ex((char *)out, 2 * size + 1, &length, in, size,
+                                '\0');
+  assert(i == 1);
+
+  return length - 1;
+}
+
+/* Reads up to the NUL every encoder leaves after its output. */
+static long opensslHexDecode(unsigned char *out, const unsigned char *in,
+                             size_t size) {
+  size_t length = 0;
+  if (!OPENSSL_hexstr2buf_ex(out, size / 2, &length, (const char *)in, '\0')) {
+    return -1;
+  }
+
+  return length;
+}
+#endif
+
+#if haveSimd
+/* Base64 kernels after Muła and Lemire, "Faster Base64 Encoding and
+   Decoding Using AVX2 Instructions": shuffle 3 byte groups into 32 bit
+   lanes, split the 6 bit fields with multiplies, and map them to ASCII
+   by adding an offset looked up per range. Each kernel stops where a
+   full vector no longer fits and the scalar code finishes, padding
+   included. */
+
+/* 12 bytes in, 16 characters out. */
+kernelTarget("ssse3")
+static size_t base64EncodeSsse3(unsigned char *out, const unsigned char *in,
+                                size_t size) {
+  const __m128i shuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                        7, 6, 8, 7, 10, 9, 11, 10);
+  const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '+' - 62,
+                                        '/' - 63, 'A', 0, 0);
+  size_t i = 0;
+  size_t o = 0;
+
+  for (; i + 16 <= size; i += 12, o += 16) {
+    __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i)),
+                                 shuffle);
+    __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)),
+                                 _mm_set1_epi32(0x04000040));
+    __m128i t1 = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)),
+                                 _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(t0, t1);
+
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    __m128i ascii = _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range));
+
+    _mm_storeu_si128((__m128i *)(out + o), ascii);
+  }
+
+  return o + base64EncodeScalar(out + o, in + i, size - i);
+}
+
+/* 24 bytes in, 32 characters out. */
+kernelTarget("avx2")
+static size_t base64EncodeAvx2(unsigned char *out, const unsigned char *in,
+                               size_t size) {
+  const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                           7, 6, 8, 7, 10, 9, 11, 10,
+                                           1, 0, 2, 1, 4, 3, 5, 4,
+                                           7, 6, 8, 7, 10, 9, 11, 10);
+  const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '+' - 62,
+                                           '/' - 63, 'A', 0, 0,
+                                           'a' - 26, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '+' - 62,
+                                           '/' - 63, 'A', 0, 0);
+  size_t i = 0;
+  size_t o = 0;
+
+  for (; i + 28 <= size; i += 24, o += 32) {
+    __m256i v = _mm256_set_m128i(_mm_loadu_si128((const __m128i *)(in + i + 12)),
+                                 _mm_loadu_si128((const __m128i *)(in + i)));
+    v = _mm256_shuffle_epi8(v, shuffle);
+    __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)),
+                                    _mm256_set1_epi32(0x04000040));
+    __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)),
+                                    _mm256_set1_epi32(0x01000010));
+    __m256i indices = _mm256_or_si256(t0, t1);
+
+    __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+    __m256i ascii = _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, range));
+
+    _mm256_storeu_si256((__m256i *)(out + o), ascii);
+  }
+
+  return o + base64EncodeScalar(out + o, in + i, size - i);
+}
+
+/* 16 characters in, 12 bytes out. Characters are classified by their
+   nibbles; any outside the alphabet, '=' included, hands the rest to
+   the scalar code. The last quad always goes there, and enough input
+   is left that the 16 byte store stays inside the output. */
+kernelTarget("ssse3")
+static long base64DecodeSsse3(unsigned char *out, const unsigned char *in,
+                              size_t size) {
+  const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                      0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+                                      0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                      0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                      0x10, 0x10, 0x10, 0x10);
+  const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                        0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask2F = _mm_set1_epi8(0x2f);
+  const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                     14, 13, 12, -1, -1, -1, -1);
+  size_t i = 0;
+  size_t o = 0;
+
+  for (; i + 16 + 8 <= size; i += 16, o += 12) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(v, 4), mask2F);
+    __m128i lo = _mm_shuffle_epi8(lutLo, _mm_and_si128(v, mask2F));
+    __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+    __m128i valid = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+    if (_mm_movemask_epi8(valid) != 0xffff) break;
+
+    __m128i roll = _mm_shuffle_epi8(lutRoll,
+                                    _mm_add_epi8(_mm_cmpeq_epi8(v, mask2F),
+                                                 hiNibbles));
+    v = _mm_add_epi8(v, roll);
+
+    __m128i merged = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    _mm_storeu_si128((__m128i *)(out + o), _mm_shuffle_epi8(merged, pack));
+  }
+
+  long rest = base64DecodeScalar(out + o, in + i, size - i);
+  return rest < 0 ? -1 : (long)o + rest;
+}
+
+/* 32 characters in, 24 bytes out, as the SSSE3 kernel per lane. */
+kernelTarget("avx2")
+static long base64DecodeAvx2(unsigned char *out, const unsigned char *in,
+                             size_t size) {
+  const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+                                         0x1b, 0x1b, 0x1b, 0x1a,
+                                         0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+                                         0x1b, 0x1b, 0x1b, 0x1a);
+  const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                         0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                         0x10, 0x10, 0x10, 0x10,
+                                         0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                         0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                         0x10, 0x10, 0x10, 0x10);
+  const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                           0, 0, 0, 0, 0, 0, 0, 0,
+                                           0, 16, 19, 4, -65, -65, -71, -71,
+                                           0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i mask2F = _mm256_set1_epi8(0x2f);
+  const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                        14, 13, 12, -1, -1, -1, -1,
+                                        2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                        14, 13, 12, -1, -1, -1, -1);
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+  size_t i = 0;
+  size_t o = 0;
+
+  for (; i + 32 + 12 <= size; i += 32, o += 24) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+    __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(v, 4), mask2F);
+    __m256i lo = _mm256_shuffle_epi8(lutLo, _mm256_and_si256(v, mask2F));
+    __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+    if (!_mm256_testz_si256(lo, hi)) break;
+
+    __m256i roll = _mm256_shuffle_epi8(lutRoll,
+                                       _mm256_add_epi8(_mm256_cmpeq_epi8(v, mask2F),
+                                                       hiNibbles));
+    v = _mm256_add_epi8(v, roll);
+
+    __m256i merged = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+    merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+    merged = _mm256_shuffle_epi8(merged, pack);
+    _mm256_storeu_si256((__m256i *)(out + o),
+                        _mm256_permutevar8x32_epi32(merged, lanes));
+  }
+
+  long rest = base64DecodeScalar(out + o, in + i, size - i);
+  return rest < 0 ? -1 : (long)o + rest;
+}
+
+/* 16 bytes in, 32 characters out: both nibbles looked up at once. */
+kernelTarget("ssse3")
+static size_t hexEncodeSsse3(unsigned char *out, const unsigned char *in,
+                             size_t size) {
+  const __m128i lut = _mm_loadu_si128((const __m128i *)hexAlphabet);
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  size_t i = 0;
+
+  for (; i + 16 <= size; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+    __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, nibble));
+    _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i *)(out + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+
+  return 2 * i + hexEncodeScalar(out + 2 * i, in + i, size - i);
+}
+
+/* 16 characters in, 8 bytes out. Digits and either case of a-f are
+   range checked; anything else hands the rest to the scalar code. */
+kernelTarget("ssse3")
+static long hexDecodeSsse3(unsigned char *out, const unsigned char *in,
+                           size_t size) {
+  const __m128i nine = _mm_set1_epi8(9);
+  const __m128i five = _mm_set1_epi8(5);
+  size_t i = 0;
+
+  for (; i + 16 <= size; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, nine), digit);
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)),
+                                  _mm_set1_epi8('a'));
+    __m128i isLetter = _mm_cmpeq_epi8(_mm_min_epu8(letter, five), letter);
+    if (_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xffff) break;
+
+    __m128i value = _mm_or_si128(_mm_and_si128(isDigit, digit),
+                                 _mm_and_si128(isLetter,
+                                               _mm_add_epi8(letter, _mm_set1_epi8(10))));
+    __m128i bytes = _mm_maddubs_epi16(value, _mm_set1_epi16(0x0110));
+    _mm_storel_epi64((__m128i *)(out + i / 2), _mm_packus_epi16(bytes, bytes));
+  }
+
+  long rest = hexDecodeScalar(out + i / 2, in + i, size - i);
+  return rest < 0 ? -1 : (long)(i / 2) + rest;
+}
+#endif
+
+static const CODEC codecs[] = {
+  {"base64-evp", NULL, 0, evpEncode, evpDecode},
+  {"base64-scalar", NULL, 0, base64EncodeScalar, base64DecodeScalar},
+#if haveSimd
+  {"base64-ssse3", "ssse3", 0, base64EncodeSsse3, base64DecodeSsse3},
+  {"base64-avx2", "avx2", 0, base64EncodeAvx2, base64DecodeAvx2},
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  {"hex-openssl", NULL, 1, opensslHexEncode, opensslHexDecode},
+#endif
+  {"hex-scalar", NULL, 1, hexEncodeScalar, hexDecodeScalar},
+#if haveSimd
+  {"hex-ssse3", "ssse3", 1, hexEncodeSsse3, hexDecodeSsse3},
+#endif
+};
+#define codecCount (sizeof(codecs) / sizeof(codecs[0]))
+
+static const CODEC *codec = NULL;
+
+/* Encodes the input batchReps times into one output. */
+static CONTENTS* encodeContent(const CONTENTS* data) {
+  assert(data != NULL);
+  assert(data->body != NULL);
+
+  CONTENTS *result = calloc(1, sizeof(CONTENTS));
+  assert(result);
+  result->body = malloc(encodedSize(codec, data->size) + 1);
+  assert(result->body);
+
+  size_t reps = batchReps(encodeBatch, data->size);
+  for (size_t i = 0; i < reps; i ++) {
+    result->size = codec->encode(result->body, data->body, data->size);
+  }
+
+  return result;
+}
+
+/* Decodes batchReps of the decoded size times, so it batches as encode
+   did. Invalid input fails the round trip. */
+static CONTENTS* decodeContent(const CONTENTS* data) {
+  assert(data != NULL);
+  assert(data->body != NULL);
+
+  size_t capacity = codec->hex ? data->size / 2 : data->size / 4 * 3;
+  CONTENTS *result = calloc(1, sizeof(CONTENTS));
+  assert(result);
+  result->body = malloc(capacity + 1);
+  assert(result->body);
+
+  long size = codec->decode(result->body, data->body, data->size);
+  if (size > 0) {
+    size_t reps = batchReps(encodeBatch, size);
+    for (size_t i = 1; i < reps; i ++) {
+      codec->decode(result->body, data->body, data->size);
+    }
+  }
+
+  if (size < 0) {
+    destroyContents(result);
+    free(result);
+    return NULL;
+  }
+  result->size = size;
+
+  return result;
+}
+
+static RESULT *runTest(unsigned int threads, struct timeval *timeout,
+                       const CONTENTS *input) {
+  TEST *t = testNew();
+  testSetThreads(t, threads);
+  testSetTimeout(t, timeout);
+  testAddRun(t, &encodeContent);
+  testAddRun(t, &decodeContent);
+  testSetInput(t, input);
+  testSetTesting(t, input);
+
+  RESULT *r = testRun(t);
+  assert(r);
+
+  testDestory(t);
+
+  return r;
+}
+
+/* Sizes grow fourfold from 32 bytes, ending on max. */
+static size_t nextSize(size_t size, size_t max) {
+  if (size >= max) return 0;
+  size <<= 2;
+  return size > max ? max : size;
+}
+
+static cJSON *sizesJSON(const unsigned char *buffer, size_t max,
+                        unsigned int threads, struct timeval *timeout,
+                        int verbose) {
+  cJSON *json = cJSON_CreateArray();
+  assert(json);
+
+  for (size_t size = 32; size; size = nextSize(size, max)) {
+    CONTENTS input;
+    memset(&input, 0, sizeof(input));
+    input.body = (unsigned char *)buffer;
+    input.size = size;
+    input.borrowed = 1;
+
+    RESULT *r = runTest(threads, timeout, &input);
+    double encodeInterval = resultAvgIntervalByRun(r, 0);
+    double decodeInterval = resultAvgIntervalByRun(r, 1);
+    size_t reps = batchReps(encodeBatch, size);
+    double bytes = (double)size * reps * resultThreads(r) * 1000000 / (1 << 30);
+
+    cJSON *item = cJSON_CreateObject();
+    assert(item);
+    cJSON_AddNumberToObject(item, "size", size);
+    cJSON_AddNumberToObject(item, "encodedSize", encodedSize(codec, size));
+    cJSON_AddNumberToObject(item, "encodeGBps", bytes / encodeInterval);
+    cJSON_AddNumberToObject(item, "decodeGBps", bytes / decodeInterval);
+    cJSON_AddNumberToObject(item, "encodeNsPerCall", encodeInterval * 1000 / reps);
+    cJSON_AddNumberToObject(item, "decodeNsPerCall", decodeInterval * 1000 / reps);
+    cJSON_AddBoolToObject(item, "correct", isResultCorrect(r));
+    if (verbose) {
+      cJSON_AddItemToObject(item, "result", resultJSON(r, 0));
+    }
+    cJSON_AddItemToArray(json, item);
+
+    resultDestory(r);
+  }
+
+  return json;
+}
+
+static void printUsage() {
+  fprintf(stderr,
+          "Usage: encode_bench \n"
+          "[-r seconds <seconds, default is 3>]\n"
+          "[-t threads <threads, default is logic cpu cores>]\n"
+          "[-c <codecs>, comma separated base64-evp, base64-scalar, base64-ssse3, base64-avx2, hex-openssl (OpenSSL 3), hex-scalar or hex-ssse3, default is all>]\n"
+          "[-s size <largest payload, size can use K, M, G, default is 64M>]\n"
+          "[-v <verbose json output>] [-f <formated json output>]\n");
+}
+
+int main(int argc, char **argv) {
+  int ret = -1;
+  unsigned char *buffer = NULL;
+
+  struct timeval timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 0;
+  unsigned int threads = 0;
+  int verbose = 0;
+  int formated = 0;
+  size_t max = 64 << 20;
+  unsigned int selected = (1 << codecCount) - 1;
+  const char *codecNames[codecCount];
+  for (unsigned int i = 0; i < codecCount; i ++) {
+    codecNames[i] = codecs[i].name;
+  }
+
+  int c;
+  opterr = 0;
+
+  while ((c = getopt(argc, argv, "r:t:c:s:vf")) != -1) {
+    switch (c) {
+    case 'r':
+      timeout.tv_sec = atoi(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'c':
+      selected = parseNameList(optarg, codecNames, codecCount);
+      if (!selected) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 's':
+      max = parseHumanSize(optarg);
+      if (max < 32) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'f':
+      formated = 1;
+      break;
+    case '?':
+      printUsage();
+      goto END;
+    }
+  }
+
+  if (timeout.tv_sec == 0) {
+    timeout.tv_sec = 3;
+  }
+
+  if (threads == 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads == 0)
+      threads = 2;
+  }
+
+  tablesInit();
+
+  buffer = malloc(max);
+  assert(buffer);
+  xorshiftFill(buffer, max);
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddNumberToObject(json, "threads", threads);
+  cJSON_AddNumberToObject(json, "maxSize", max);
+  cJSON_AddItemToObject(json, "cpuFlags", cpuFlagsJSON());
+
+  cJSON *codecsJSON = cJSON_CreateArray();
+  assert(codecsJSON);
+  for (unsigned int i = 0; i < codecCount; i ++) {
+    if (!(selected & (1 << i))) continue;
+    codec = &codecs[i];
+
+    /* Kernels the CPU cannot run are listed but skipped. */
+    int supported = !codec->requires || cpuHasFlag(codec->requires);
+
+    cJSON *item = cJSON_CreateObject();
+    assert(item);
+    cJSON_AddStringToObject(item, "codec", codec->name);
+    cJSON_AddBoolToObject(item, "supported", supported);
+    if (supported) {
+      cJSON_AddItemToObject(item, "sizes",
+                            sizesJSON(buffer, max, threads, &timeout, verbose));
+    }
+    cJSON_AddItemToArray(codecsJSON, item);
+  }
+  cJSON_AddItemToObject(json, "codecs", codecsJSON);
+
+  printJSON(json, formated);
+
+  cJSON_Delete(json);
+
+  ret = 0;
+
+END:
+  free(buffer);
+  return ret;
+}
@@ -0,0 +1,800 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <openssl/evp.h>
+
+#ifdef __NR_io_uring_setup
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#define haveUring 1
+#endif
+
+#include "contents.h"
+#include "benchmark.h"
+#include "misc.h"
+#include "latency.h"
+#include "document.h"
+#include "zstage.h"
+#include "mstage.h"
+
+#define backendPread       (1 << 0)
+#define backendDirect      (1 << 1)
+#define backendUring       (1 << 2)
+#define backendUringDirect (1 << 3)
+
+#define cpuNone    0
+#define cpuDigest  1
+#define cpuInflate 2
+
+/* Smallest block -u fills for -C inflate: room for the one-shot
+   header and a zlib stream of a few bytes. */
+#define inflateBlockMin 64
+
+/* O_DIRECT wants buffers, offsets and lengths aligned to the logical
+   block size; a page covers every common device. */
+#define directAlign 4096
+
+struct i_file {
+  char *path;
+  off_t size;
+  int fd;
+  int directFd;
+};
+typedef struct i_file FILEINFO;
+
+struct i_block {
+  unsigned int file;
+  off_t offset;
+};
+typedef struct i_block BLOCK;
+
+static FILEINFO *files = NULL;
+static unsigned int fileCount = 0;
+static BLOCK *blocks = NULL;
+static size_t blockCount = 0;
+
+static size_t blockSize = 128 << 10;
+static unsigned int queueDepth = 32;
+static unsigned int backend = backendPread;
+static unsigned int cpuStage = cpuNone;
+/* Buffered passes drop the files from the page cache first, so they
+   read from the device rather than from what earlier passes cached. */
+static int warmCache = 0;
+
+/* Per block latency from issuing the read to its data being available. */
+static LATENCY *latency = NULL;
+
+/* What a pass reports and is checked on: bytes read and a fold of the
+   CPU stage's per block results, so every backend must read the same
+   data as the buffered reference pass. */
+struct i_pass {
+  uint64_t bytes;
+  uint64_t fold;
+};
+typedef struct i_pass PASS;
+
+static int fileAdd(const char *path, const struct stat *st, int type,
+                   struct FTW *ftw) {
+  (void)ftw;
+  if (type != FTW_F || !S_ISREG(st->st_mode) || st->st_size == 0) return 0;
+
+  files = realloc(files, sizeof(FILEINFO) * (fileCount + 1));
+  assert(files);
+  FILEINFO *f = &files[fileCount];
+  f->path = strdup(path);
+  assert(f->path);
+  f->size = st->st_size;
+  f->fd = open(path, O_RDONLY);
+  f->directFd = open(path, O_RDONLY | O_DIRECT);
+  if (f->fd < 0) {
+    if (f->directFd >= 0) close(f->directFd);
+    free(f->path);
+    return 0;
+  }
+  fileCount ++;
+
+  return 0;
+}
+
+static void filesClose() {
+  for (unsigned int i = 0; i < fileCount; i ++) {
+    close(files[i].fd);
+    if (files[i].directFd >= 0) close(files[i].directFd);
+    free(files[i].path);
+  }
+  free(files);
+  files = NULL;
+  fileCount = 0;
+  free(blocks);
+  blocks = NULL;
+  blockCount = 0;
+}
+
+static int directAvailable() {
+  if (blockSize % directAlign) return 0;
+  for (unsigned int i = 0; i < fileCount; i ++) {
+    if (files[i].directFd < 0) return 0;
+  }
+  return fileCount > 0;
+}
+
+/* Every block of every file, in file order or shuffled with a fixed
+   seed for random reads. */
+static void blocksBuild(int shuffle) {
+  for (unsigned int i = 0; i < fileCount; i ++) {
+    blockCount += (files[i].size + blockSize - 1) / blockSize;
+  }
+  blocks = malloc(sizeof(BLOCK) * (blockCount ? blockCount : 1));
+  assert(blocks);
+
+  size_t n = 0;
+  for (unsigned int i = 0; i < fileCount; i ++) {
+    for (off_t offset = 0; offset < files[i].size; offset += blockSize) {
+      blocks[n].file = i;
+      blocks[n].offset = offset;
+      n ++;
+    }
+  }
+
+  if (shuffle) {
+    unsigned int seed = 1;
+    for (size_t i = blockCount; i > 1; i --) {
+      size_t j = rand_r(&seed) % i;
+      BLOCK t = blocks[i - 1];
+      blocks[i - 1] = blocks[j];
+      blocks[j] = t;
+    }
+  }
+}
+
+/* Per block CPU stage, folded into the pass: md_bench's digest stage,
+   or zlib_bench's one-shot inflate of the blocks -u writes with
+   -C inflate. */
+static void blockProcess(PASS *pass, const unsigned char *data, size_t size) {
+  CONTENTS block;
+  memset(&block, 0, sizeof(block));
+  block.body = (unsigned char *)data;
+  block.size = size;
+  block.borrowed = 1;
+
+  CONTENTS *result = NULL;
+  if (cpuStage == cpuDigest) {
+    result = mdContent(&block);
+    uint64_t head = 0;
+    memcpy(&head, result->body, sizeof(head));
+    pass->fold ^= head;
+  } else if (cpuStage == cpuInflate) {
+    result = inflateContentOneShot(&block);
+    if (result) pass->fold += result->size;
+  }
+
+  if (result) {
+    destroyContents(result);
+    free(result);
+  }
+}
+
+/* Drop every file from the page cache, unless it is kept warm. */
+static void cacheDrop() {
+  if (warmCache) return;
+
+  for (unsigned int i = 0; i < fileCount; i ++) {
+    posix_fadvise(files[i].fd, 0, 0, POSIX_FADV_DONTNEED);
+  }
+}
+
+static unsigned char *alignedAlloc(size_t size) {
+  void *p = NULL;
+  int i = posix_memalign(&p, directAlign, size);
+  assert(i == 0);
+
+  return (unsigned char *)p;
+}
+
+/* Synchronous reads, one block in flight. */
+static void passPread(PASS *pass, int direct) {
+  unsigned char *buffer = alignedAlloc(blockSize);
+
+  for (size_t i = 0; i < blockCount; i ++) {
+    const FILEINFO *f = &files[blocks[i].file];
+
+    unsigned long start = latencyNow();
+    ssize_t n = pread(direct ? f->directFd : f->fd, buffer, blockSize,
+                      blocks[i].offset);
+    if (latency) latencyAdd(latency, latencyNow() - start);
+    if (n <= 0) continue;
+
+    pass->bytes += n;
+    blockProcess(pass, buffer, n);
+  }
+
+  free(buffer);
+}
+
+#ifdef haveUring
+/* A minimal io_uring over the raw system calls, so no liburing is
+   needed: queueDepth entries and as many registered buffers. */
+struct i_uring {
+  int fd;
+  unsigned int entries;
+  void *sqRing;
+  void *cqRing;
+  size_t sqRingSize;
+  size_t cqRingSize;
+  struct io_uring_sqe *sqes;
+  size_t sqesSize;
+  unsigned int *sqHead, *sqTail, *sqMask, *sqArray;
+  unsigned int *cqHead, *cqTail, *cqMask;
+  struct io_uring_cqe *cqes;
+  unsigned char *buffers;
+};
+typedef struct i_uring URING;
+
+static pthread_key_t uringKey;
+
+static void uringDestroy(void *arg) {
+  URING *u = (URING *)arg;
+
+  if (u->sqes) munmap(u->sqes, u->sqesSize);
+  if (u->cqRing && u->cqRing != u->sqRing) munmap(u->cqRing, u->cqRingSize);
+  if (u->sqRing) munmap(u->sqRing, u->sqRingSize);
+  if (u->fd >= 0) close(u->fd);
+  free(u->buffers);
+  free(u);
+}
+
+static URING *uringNew() {
+  URING *u = calloc(1, sizeof(URING));
+  assert(u);
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  u->fd = syscall(__NR_io_uring_setup, queueDepth, &params);
+  if (u->fd < 0) goto FAIL;
+  u->entries = params.sq_entries;
+
+  u->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  u->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (u->cqRingSize > u->sqRingSize) u->sqRingSize = u->cqRingSize;
+    u->cqRingSize = u->sqRingSize;
+  }
+
+  u->sqRing = mmap(NULL, u->sqRingSize, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (u->sqRing == MAP_FAILED) {
+    u->sqRing = NULL;
+    goto FAIL;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    u->cqRing = u->sqRing;
+  } else {
+    u->cqRing = mmap(NULL, u->cqRingSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if (u->cqRing == MAP_FAILED) {
+      u->cqRing = NULL;
+      goto FAIL;
+    }
+  }
+  u->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = mmap(NULL, u->sqesSize, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED) {
+    u->sqes = NULL;
+    goto FAIL;
+  }
+
+  unsigned char *sq = (unsigned char *)u->sqRing;
+  unsigned char *cq = (unsigned char *)u->cqRing;
+  u->sqHead = (unsigned int *)(sq + params.sq_off.head);
+  u->sqTail = (unsigned int *)(sq + params.sq_off.tail);
+  u->sqMask = (unsigned int *)(sq + params.sq_off.ring_mask);
+  u->sqArray = (unsigned int *)(sq + params.sq_off.array);
+  u->cqHead = (unsigned int *)(cq + params.cq_off.head);
+  u->cqTail = (unsigned int *)(cq + params.cq_off.tail);
+  u->cqMask = (unsigned int *)(cq + params.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  u->buffers = alignedAlloc(blockSize * queueDepth);
+  struct iovec *iovecs = calloc(queueDepth, sizeof(struct iovec));
+  assert(iovecs);
+  for (unsigned int i = 0; i < queueDepth; i ++) {
+    iovecs[i].iov_base = u->buffers + blockSize * i;
+    iovecs[i].iov_len = blockSize;
+  }
+  int ret = syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS,
+                    iovecs, queueDepth);
+  free(iovecs);
+  if (ret < 0) goto FAIL;
+
+  return u;
+
+FAIL:
+  uringDestroy(u);
+  return NULL;
+}
+
+/* Each worker thread sets up its ring on its first pass and keeps it
+   until it exits. */
+static URING *threadUring() {
+  URING *u = (URING *)pthread_getspecific(uringKey);
+  if (!u) {
+    u = uringNew();
+    if (u) pthread_setspecific(uringKey, u);
+  }
+
+  return u;
+}
+
+/* Keeps queueDepth fixed buffer reads in flight, one per buffer slot,
+   refilling each slot as its completion is reaped. Every ready
+   completion is timestamped before any block is processed, so the CPU
+   stage does not count as read latency. */
+static int passUring(PASS *pass, int direct) {
+  URING *u = threadUring();
+  if (!u) return 0;
+
+  unsigned long *issued = calloc(queueDepth, sizeof(unsigned long));
+  unsigned int *freeSlots = malloc(sizeof(unsigned int) * queueDepth);
+  unsigned int *readySlots = malloc(sizeof(unsigned int) * queueDepth);
+  int *readyBytes = malloc(sizeof(int) * queueDepth);
+  assert(issued && freeSlots && readySlots && readyBytes);
+  unsigned int freeCount = queueDepth;
+  for (unsigned int i = 0; i < queueDepth; i ++) {
+    freeSlots[i] = i;
+  }
+
+  size_t next = 0;
+  size_t done = 0;
+  int ok = 1;
+  while (done < blockCount) {
+    unsigned int submit = 0;
+    unsigned int tail = *u->sqTail;
+    while (freeCount && next < blockCount) {
+      unsigned int slot = freeSlots[-- freeCount];
+      const FILEINFO *f = &files[blocks[next].file];
+
+      unsigned int index = tail & *u->sqMask;
+      struct io_uring_sqe *sqe = &u->sqes[index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_READ_FIXED;
+      sqe->fd = direct ? f->directFd : f->fd;
+      sqe->off = blocks[next].offset;
+      sqe->addr = (unsigned long)(u->buffers + blockSize * slot);
+      sqe->len = blockSize;
+      sqe->buf_index = slot;
+      sqe->user_data = slot;
+      u->sqArray[index] = index;
+
+      issued[slot] = latencyNow();
+      tail ++;
+      submit ++;
+      next ++;
+    }
+    __atomic_store_n(u->sqTail, tail, __ATOMIC_RELEASE);
+
+    int ret = syscall(__NR_io_uring_enter, u->fd, submit, 1,
+                      IORING_ENTER_GETEVENTS, NULL, 0);
+    if (ret < 0) {
+      ok = 0;
+      break;
+    }
+
+    unsigned int readyCount = 0;
+    unsigned int head = *u->cqHead;
+    unsigned long now = latencyNow();
+    while (head != __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe *cqe = &u->cqes[head & *u->cqMask];
+      unsigned int slot = cqe->user_data;
+      if (latency) latencyAdd(latency, now - issued[slot]);
+      readySlots[readyCount] = slot;
+      readyBytes[readyCount] = cqe->res;
+      readyCount ++;
+      head ++;
+    }
+    __atomic_store_n(u->cqHead, head, __ATOMIC_RELEASE);
+
+    for (unsigned int i = 0; i < readyCount; i ++) {
+      unsigned int slot = readySlots[i];
+      if (readyBytes[i] > 0) {
+        pass->bytes += readyBytes[i];
+        blockProcess(pass, u->buffers + blockSize * slot, readyBytes[i]);
+      }
+      freeSlots[freeCount ++] = slot;
+      done ++;
+    }
+  }
+
+  free(readyBytes);
+  free(readySlots);
+  free(freeSlots);
+  free(issued);
+
+  return ok;
+}
+#endif
+
+/* One pass over every block with the selected backend. */
+static CONTENTS* passContent(const CONTENTS* data) {
+  (void)data;
+  PASS pass = {0, 0};
+
+  int direct = backend == backendDirect || backend == backendUringDirect;
+  if (!direct) cacheDrop();
+
+  if (backend & (backendUring | backendUringDirect)) {
+#ifdef haveUring
+    if (!passUring(&pass, direct)) return NULL;
+#else
+    return NULL;
+#endif
+  } else {
+    passPread(&pass, direct);
+  }
+
+  CONTENTS *result = calloc(1, sizeof(CONTENTS));
+  assert(result);
+  result->body = malloc(sizeof(PASS));
+  assert(result->body);
+  memcpy(result->body, &pass, sizeof(PASS));
+  result->size = sizeof(PASS);
+
+  return result;
+}
+
+static double cpuSeconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0 +
+    usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+}
+
+static const char *backendNames[] = {"pread", "direct", "io_uring",
+                                     "io_uring-direct"};
+
+static cJSON *backendJSON(unsigned int b, unsigned int threads,
+                          struct timeval *timeout, const CONTENTS *reference,
+                          int verbose) {
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddStringToObject(json, "backend", backendNames[__builtin_ctz(b)]);
+
+  int uring = b == backendUring || b == backendUringDirect;
+  if ((b == backendDirect || b == backendUringDirect) && !directAvailable()) {
+    cJSON_AddStringToObject(json, "error", "O_DIRECT unavailable");
+    return json;
+  }
+#ifndef haveUring
+  if (uring) {
+    cJSON_AddStringToObject(json, "error", "io_uring unavailable");
+    return json;
+  }
+#endif
+  if (uring) {
+    cJSON_AddNumberToObject(json, "queueDepth", queueDepth);
+  }
+
+  backend = b;
+  latencyReset(latency);
+
+  TEST *t = testNew();
+  testSetThreads(t, threads);
+  testSetTimeout(t, timeout);
+  testAddRun(t, &passContent);
+  testSetInput(t, reference);
+  testSetTesting(t, reference);
+
+  double cpuStart = cpuSeconds();
+  RESULT *r = testRun(t);
+  assert(r);
+  double cpu = cpuSeconds() - cpuStart;
+
+  const PASS *pass = (const PASS *)reference->body;
+  double interval = resultAvgIntervalByRun(r, 0);
+  double gigabytes = (double)pass->bytes * resultTotalLoops(r) / (1 << 30);
+
+  if (resultSampleOutputByRun(r, 0) == 0) {
+    cJSON_AddStringToObject(json, "error", "io_uring unavailable");
+  } else {
+    cJSON_AddNumberToObject(json, "MBps",
+                            pass->bytes / interval * 1000000 / (1 << 20) *
+                            resultThreads(r));
+    cJSON_AddNumberToObject(json, "IOPS",
+                            blockCount / interval * 1000000 * resultThreads(r));
+    cJSON_AddItemToObject(json, "latency", latencyToJSON(latency));
+    cJSON_AddNumberToObject(json, "cpuSecondsPerGB", gigabytes > 0 ? cpu / gigabytes : 0);
+  }
+  cJSON_AddBoolToObject(json, "correct", isResultCorrect(r));
+  if (verbose) {
+    cJSON_AddItemToObject(json, "result", resultJSON(r, 0));
+  }
+
+  resultDestory(r);
+  testDestory(t);
+
+  return json;
+}
+
+/* A file of size bytes for -u: random blocks, or with -C inflate blocks
+   each holding as much generated JSON as fits once deflated in the
+   one-shot format, zero padded. */
+static char *fileGenerate(size_t size) {
+  char *path = strdup("/var/tmp/io_bench.XXXXXX");
+  assert(path);
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    free(path);
+    return NULL;
+  }
+
+  unsigned char *block = malloc(blockSize);
+  assert(block);
+  CONTENTS *source = cpuStage == cpuInflate ?
+    documentGenerate(4 * blockSize, 3, 4, 50) : NULL;
+
+  for (size_t written = 0; written < size; written += blockSize) {
+    if (source) {
+      size_t offset = (written / blockSize) % blockSize;
+      if (offset >= source->size) offset = 0;
+
+      CONTENTS slice;
+      memset(&slice, 0, sizeof(slice));
+      slice.body = source->body + offset;
+      slice.size = source->size - offset;
+      if (slice.size > 2 * blockSize) slice.size = 2 * blockSize;
+      slice.borrowed = 1;
+
+      CONTENTS *deflated;
+      for (;;) {
+        deflated = deflateContentOneShot(&slice);
+        if (deflated->size <= blockSize || slice.size == 1) break;
+        destroyContents(deflated);
+        free(deflated);
+        slice.size /= 2;
+      }
+      /* Even one byte does not fit; main rejects such block sizes. */
+      if (deflated->size > blockSize) {
+        destroyContents(deflated);
+        free(deflated);
+        close(fd);
+        unlink(path);
+        free(path);
+        path = NULL;
+        break;
+      }
+      memcpy(block, deflated->body, deflated->size);
+      memset(block + deflated->size, 0, blockSize - deflated->size);
+      destroyContents(deflated);
+      free(deflated);
+    } else {
+      CONTENTS *random = randomContents(blockSize);
+      memcpy(block, random->body, blockSize);
+      destroyContents(random);
+      free(random);
+    }
+
+    size_t length = size - written < blockSize ? size - written : blockSize;
+    if (write(fd, block, length) != (ssize_t)length) {
+      close(fd);
+      unlink(path);
+      free(path);
+      path = NULL;
+      break;
+    }
+  }
+
+  if (source) {
+    destroyContents(source);
+    free(source);
+  }
+  free(block);
+  if (path) close(fd);
+
+  return path;
+}
+
+static void printUsage() {
+  fprintf(stderr,
+          "Usage: io_bench \n"
+          "[-r seconds <seconds, default is 3>]\n"
+          "[-t threads <threads, default is logic cpu cores>]\n"
+          "[-b <backends>, comma separated pread, direct, io_uring or io_uring-direct, default is all]\n"
+          "[-s size <block size, default is 128K, a multiple of 4K for direct>]\n"
+          "[-q depth <io_uring queue depth, default is 32>]\n"
+          "[-C <per block CPU stage>, a digest name such as sha256, or inflate]\n"
+          "[-R <read blocks in random order>]\n"
+          "[-w <keep files in the page cache between buffered passes>]\n"
+          "[-v <verbose json output>] [-f <formated json output>]\n"
+          "-u size <generate a file of size under /var/tmp, size can use K, M, G>|file|directory\n");
+}
+
+int main(int argc, char **argv) {
+  int ret = -1;
+  char *generated = NULL;
+  CONTENTS *reference = NULL;
+
+  struct timeval timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 0;
+  unsigned int threads = 0;
+  int verbose = 0;
+  int formated = 0;
+  int shuffle = 0;
+  size_t randomSize = 0;
+  unsigned int backends = backendPread | backendDirect | backendUring |
+                          backendUringDirect;
+  const char *cpuName = NULL;
+
+  int index;
+  int c;
+  opterr = 0;
+
+  while ((c = getopt(argc, argv, "r:t:b:s:q:C:Rwvfu:")) != -1) {
+    switch (c) {
+    case 'r':
+      timeout.tv_sec = atoi(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'b':
+      backends = parseNameList(optarg, backendNames,
+                               sizeof(backendNames) / sizeof(backendNames[0]));
+      if (!backends) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 's':
+      blockSize = parseHumanSize(optarg);
+      if (blockSize == 0) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'q':
+      queueDepth = atoi(optarg);
+      if (queueDepth == 0) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'C':
+      cpuName = optarg;
+      if (strcmp(optarg, "inflate") == 0) {
+        cpuStage = cpuInflate;
+      } else if ((mSettings.md = EVP_get_digestbyname(optarg))) {
+        cpuStage = cpuDigest;
+      } else {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'R':
+      shuffle = 1;
+      break;
+    case 'w':
+      warmCache = 1;
+      break;
+    case 'u':
+      randomSize = parseHumanSize(optarg);
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'f':
+      formated = 1;
+      break;
+    case '?':
+      printUsage();
+      goto END;
+    }
+  }
+
+  if (timeout.tv_sec == 0) {
+    timeout.tv_sec = 3;
+  }
+
+  if (threads == 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads == 0)
+      threads = 2;
+  }
+
+  if (randomSize && cpuStage == cpuInflate && blockSize < inflateBlockMin) {
+    fprintf(stderr, "-C inflate with -u needs blocks of at least %d bytes\n",
+            inflateBlockMin);
+    goto END;
+  }
+
+  const char *path = NULL;
+  if (randomSize) {
+    generated = fileGenerate(randomSize);
+    if (!generated) {
+      fprintf(stderr, "Cannot generate a file under /var/tmp\n");
+      goto END;
+    }
+    path = generated;
+  } else {
+    index = optind;
+    if (index >= argc) {
+      printUsage();
+      goto END;
+    }
+    path = argv[index];
+  }
+
+  nftw(path, fileAdd, 64, FTW_PHYS);
+  if (fileCount == 0) {
+    fprintf(stderr, "No file to read\n");
+    goto END;
+  }
+  blocksBuild(shuffle);
+
+#ifdef haveUring
+  pthread_key_create(&uringKey, uringDestroy);
+#endif
+  latency = latencyNew();
+
+  /* The buffered pass is the reference every backend is checked on. */
+  backend = backendPread;
+  LATENCY *measured = latency;
+  latency = NULL;
+  reference = passContent(NULL);
+  latency = measured;
+
+  const PASS *pass = (const PASS *)reference->body;
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddNumberToObject(json, "threads", threads);
+  cJSON_AddNumberToObject(json, "files", fileCount);
+  cJSON_AddNumberToObject(json, "bytes", pass->bytes);
+  cJSON_AddNumberToObject(json, "blockSize", blockSize);
+  cJSON_AddNumberToObject(json, "blocks", blockCount);
+  cJSON_AddStringToObject(json, "order", shuffle ? "random" : "sequential");
+  if (cpuName) {
+    cJSON_AddStringToObject(json, "cpuStage", cpuName);
+  }
+  cJSON_AddBoolToObject(json, "warmCache", warmCache);
+
+  cJSON *backendsJSON = cJSON_CreateArray();
+  assert(backendsJSON);
+  for (unsigned int b = backendPread; b <= backendUringDirect; b <<= 1) {
+    if (!(backends & b)) continue;
+    cJSON_AddItemToArray(backendsJSON,
+                         backendJSON(b, threads, &timeout, reference, verbose));
+  }
+  cJSON_AddItemToObject(json, "backends", backendsJSON);
+
+  printJSON(json, formated);
+
+  cJSON_Delete(json);
+
+  ret = 0;
+
+END:
+  if (latency) latencyDestroy(latency);
+  if (reference) {
+    destroyContents(reference);
+    free(reference);
+  }
+  filesClose();
+  if (generated) {
+    unlink(generated);
+    free(generated);
+  }
+  return ret;
+}
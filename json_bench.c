@@ -0,0 +1,429 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "contents.h"
+#include "benchmark.h"
+#include "misc.h"
+#include "allocator.h"
+#include "document.h"
+#include "external/cJSON.h"
+
+#define printModeUnformatted  (1 << 0)
+#define printModePreallocated (1 << 1)
+
+/* Unformatted: cJSON_PrintUnformatted grows its own buffer. Preallocated:
+   cJSON_PrintPreallocated into a buffer sized from the reference output,
+   as a server that knows its typical response size would. */
+static unsigned int printMode = printModeUnformatted;
+static size_t preallocatedSize = 0;
+
+/* cJSON's allocator during measured runs; glibc malloc, or an arena
+   reset at the start of every iteration, or a size-class pool. All of
+   them go through cJSON_InitHooks, so cJSON takes the same code paths
+   for each: with any hooks installed it stops using realloc to grow its
+   print buffer and allocates a new one instead. */
+static const ALLOCATOR *allocator = &allocators[0];
+
+/* cJSON_PrintPreallocated needs a few bytes of slack past the output. */
+#define preallocatedSlack 64
+#define warmupUsec 200000
+
+/* The parse stage hands its tree to the print stage through a borrowed
+   CONTENTS whose body is the cJSON pointer and whose size is the
+   document size. The print stage frees the tree. */
+static CONTENTS* parseContent(const CONTENTS* data) {
+  allocator->reset();
+
+  cJSON *tree = cJSON_Parse((const char *)data->body);
+  if (!tree) return NULL;
+
+  CONTENTS *parsed = calloc(1, sizeof(CONTENTS));
+  assert(parsed);
+  parsed->body = (unsigned char *)tree;
+  parsed->size = data->size;
+  parsed->borrowed = 1;
+
+  return parsed;
+}
+
+static CONTENTS* printContent(const CONTENTS* data) {
+  cJSON *tree = (cJSON *)data->body;
+  char *text = NULL;
+
+  if (printMode == printModePreallocated) {
+    text = malloc(preallocatedSize);
+    assert(text);
+    if (!cJSON_PrintPreallocated(tree, text, preallocatedSize, 0)) {
+      free(text);
+      text = NULL;
+    }
+  } else {
+    text = cJSON_PrintUnformatted(tree);
+  }
+
+  cJSON_Delete(tree);
+
+  if (!text) return NULL;
+
+  CONTENTS *printed = calloc(1, sizeof(CONTENTS));
+  assert(printed);
+  printed->body = (unsigned char *)text;
+  printed->size = strlen(text);
+  if (printMode != printModePreallocated) {
+    printed->release = allocator->free;
+  }
+
+  return printed;
+}
+
+static CONTENTS* roundTrip(const CONTENTS* data) {
+  CONTENTS *parsed = parseContent(data);
+  if (!parsed) return NULL;
+
+  CONTENTS *printed = printContent(parsed);
+  free(parsed);
+
+  return printed;
+}
+
+/* Shape of generated documents, see document.h. */
+static unsigned int depth = 3;
+static unsigned int width = 4;
+static unsigned int stringPercent = 50;
+
+/* cJSON allocations of one round trip, counted single threaded before
+   the measured runs so the counting never contends. The counting hook
+   disables realloc in cJSON exactly as the measured runs' hooks do. */
+static unsigned long allocations = 0;
+
+static void *countingMalloc(size_t size) {
+  allocations ++;
+  return allocator->malloc(size);
+}
+
+static unsigned long roundTripAllocations(const CONTENTS *contents) {
+  allocations = 0;
+  cJSON_Hooks hooks = {countingMalloc, allocator->free};
+  cJSON_InitHooks(&hooks);
+  CONTENTS *printed = roundTrip(contents);
+  cJSON_InitHooks(NULL);
+
+  destroyContents(printed);
+  free(printed);
+
+  return allocations;
+}
+
+static double throughput(const RESULT *r, unsigned int run, size_t bytes) {
+  return (double)bytes / resultAvgIntervalByRun(r, run) * 1000000.0 /
+         (double)(1 << 20) * resultThreads(r);
+}
+
+static double timevalSeconds(const struct timeval *x) {
+  return x->tv_sec + x->tv_usec / 1000000.0;
+}
+
+/* What the process spent around a run besides computing: context
+   switches (voluntary ones are mostly lock waits), page faults, and the
+   share of CPU time in the kernel. */
+static cJSON *stallsJSON(const struct rusage *before, const struct rusage *after,
+                         unsigned long docs) {
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+
+  long voluntary = after->ru_nvcsw - before->ru_nvcsw;
+  long involuntary = after->ru_nivcsw - before->ru_nivcsw;
+  long faults = after->ru_minflt - before->ru_minflt;
+  double user = timevalSeconds(&after->ru_utime) - timevalSeconds(&before->ru_utime);
+  double system = timevalSeconds(&after->ru_stime) - timevalSeconds(&before->ru_stime);
+
+  cJSON_AddNumberToObject(json, "voluntarySwitches", voluntary);
+  cJSON_AddNumberToObject(json, "involuntarySwitches", involuntary);
+  cJSON_AddNumberToObject(json, "minorFaults", faults);
+  cJSON_AddNumberToObject(json, "minorFaultsPerDoc", docs ? (double)faults / docs : 0);
+  cJSON_AddNumberToObject(json, "systemShare",
+                          user + system > 0 ? system / (user + system) : 0);
+
+  return json;
+}
+
+static cJSON *runJSON(const CONTENTS *contents, const CONTENTS *reference,
+                      unsigned int threads, struct timeval *timeout,
+                      unsigned int mode, int verbose) {
+  printMode = mode;
+  preallocatedSize = reference->size + preallocatedSlack;
+
+  TEST *t = testNew();
+  testSetThreads(t, threads);
+  testSetTimeout(t, timeout);
+  testAddRun(t, &parseContent);
+  testAddRun(t, &printContent);
+  testSetInput(t, contents);
+  testSetTesting(t, reference);
+
+  struct rusage before, after;
+  cJSON_Hooks hooks = {allocator->malloc, allocator->free};
+
+  cJSON_InitHooks(&hooks);
+
+  /* An untimed pass first, so the heap growth and page faults of the
+     first run in the process are not charged to whichever allocator
+     happens to run first. Only the process heap is warmed: the pass
+     runs on its own threads, whose arena chunks and pool slabs are
+     freed as they exit, so the measured threads start those cold. */
+  struct timeval warmup;
+  warmup.tv_sec = 0;
+  warmup.tv_usec = warmupUsec;
+  testSetTimeout(t, &warmup);
+  resultDestory(testRun(t));
+  testSetTimeout(t, timeout);
+
+  getrusage(RUSAGE_SELF, &before);
+
+  RESULT *r = testRun(t);
+  assert(r);
+
+  getrusage(RUSAGE_SELF, &after);
+  cJSON_InitHooks(NULL);
+
+  double interval = resultAvgIntervalByRun(r, 0) + resultAvgIntervalByRun(r, 1);
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddNumberToObject(json, "parseMBps", throughput(r, 0, contents->size));
+  cJSON_AddNumberToObject(json, "printMBps", throughput(r, 1, reference->size));
+  cJSON_AddNumberToObject(json, "docsPerSec",
+                          1000000.0 / interval * resultThreads(r));
+  cJSON_AddNumberToObject(json, "allocsPerDoc", roundTripAllocations(contents));
+  cJSON_AddItemToObject(json, "stalls", stallsJSON(&before, &after, resultTotalLoops(r)));
+  cJSON_AddItemToObject(json, "result", resultJSON(r, verbose));
+
+  resultDestory(r);
+  testDestory(t);
+
+  return json;
+}
+
+/* A run with the selected allocator, or one per allocator side by side
+   when selected is NULL. Outside runs cJSON stays on malloc. */
+static cJSON *allocatorJSON(const CONTENTS *contents, const CONTENTS *reference,
+                            unsigned int threads, struct timeval *timeout,
+                            unsigned int mode, const ALLOCATOR *selected,
+                            int verbose) {
+  cJSON *json = NULL;
+
+  if (selected) {
+    allocator = selected;
+    json = runJSON(contents, reference, threads, timeout, mode, verbose);
+    cJSON_AddStringToObject(json, "allocator", allocator->name);
+  } else {
+    json = cJSON_CreateObject();
+    assert(json);
+    for (unsigned int i = 0; i < allocatorCount; i ++) {
+      allocator = &allocators[i];
+      cJSON_AddItemToObject(json, allocator->name,
+                            runJSON(contents, reference, threads, timeout,
+                                    mode, verbose));
+    }
+  }
+  allocator = &allocators[0];
+
+  return json;
+}
+
+static void printUsage() {
+  fprintf(stderr,
+          "Usage: json_bench \n"
+          "[-r seconds <seconds, default is 3>]\n"
+          "[-t threads <threads, default is logic cpu cores>]\n"
+          "[-p <print mode>, should be unformatted, preallocated or all, default is unformatted]\n"
+          "[-A <allocator>, should be malloc, arena, pool or all, default is malloc]\n"
+          "[-d depth <record nesting of generated documents, default is 3>]\n"
+          "[-w width <array width of generated documents, default is 4>]\n"
+          "[-s percent <share of generated leaves that are strings, default is 50>]\n"
+          "[-v <verbose json output>] [-f <formated json output>]\n"
+          "-u size <generate API-shaped documents of about size, size can use K, M, G>|file|url\n");
+}
+
+int main(int argc, char **argv) {
+  int ret = -1;
+  CONTENTS *contents = NULL;
+  CONTENTS *reference = NULL;
+
+  struct timeval timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 0;
+  unsigned int threads = 0;
+  int verbose = 0;
+  int formated = 0;
+  size_t randomSize = 0;
+  unsigned int mode = printModeUnformatted;
+  const ALLOCATOR *selected = &allocators[0];
+
+  int index;
+  int c;
+  opterr = 0;
+
+  while ((c = getopt(argc, argv, "r:t:p:d:w:s:A:vfu:")) != -1) {
+    switch (c) {
+    case 'r':
+      timeout.tv_sec = atoi(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'u':
+      randomSize = parseHumanSize(optarg);
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'f':
+      formated = 1;
+      break;
+    case 'p':
+      if (strcmp(optarg, "unformatted") == 0) {
+        mode = printModeUnformatted;
+      } else if (strcmp(optarg, "preallocated") == 0) {
+        mode = printModePreallocated;
+      } else if (strcmp(optarg, "all") == 0) {
+        mode = printModeUnformatted | printModePreallocated;
+      } else {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'A':
+      if (strcmp(optarg, "all") == 0) {
+        selected = NULL;
+      } else if (!(selected = allocatorByName(optarg))) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'd':
+      depth = atoi(optarg);
+      break;
+    case 'w':
+      width = atoi(optarg);
+      break;
+    case 's':
+      stringPercent = atoi(optarg);
+      if (stringPercent > 100) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case '?':
+      printUsage();
+      goto END;
+    }
+  }
+
+  if (timeout.tv_sec == 0) {
+    timeout.tv_sec = 3;
+  }
+
+  if (threads == 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads == 0)
+      threads = 2;
+  }
+
+  if (depth == 0) {
+    printUsage();
+    goto END;
+  }
+
+  if (randomSize) {
+    contents = documentGenerate(randomSize, depth, width, stringPercent);
+  } else {
+    index = optind;
+    if (index >= argc) {
+      printUsage();
+      goto END;
+    }
+
+    contents = getContents(argv[index]);
+
+    if (contents == NULL) {
+      fprintf(stderr, "Get content error\n");
+      goto END;
+    } else if (contents->size == 0) {
+      fprintf(stderr, "Empty content to parse\n");
+      goto END;
+    }
+
+    /* cJSON_Parse wants a terminated string. */
+    contents->body = realloc(contents->body, contents->size + 1);
+    assert(contents->body);
+    contents->body[contents->size] = '\0';
+  }
+
+  /* The round trip is checked against the first one, which must itself
+     survive another round trip unchanged. */
+  printMode = printModeUnformatted;
+  reference = roundTrip(contents);
+  if (reference == NULL) {
+    fprintf(stderr, "Not a JSON document\n");
+    goto END;
+  }
+  CONTENTS *again = roundTrip(reference);
+  int stable = again && compareContents(again, reference) == 0;
+  destroyContents(again);
+  free(again);
+  if (!stable) {
+    fprintf(stderr, "Round trip is not stable\n");
+    goto END;
+  }
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+
+  cJSON *documentJSON = cJSON_CreateObject();
+  assert(documentJSON);
+  cJSON_AddNumberToObject(documentJSON, "size", contents->size);
+  cJSON_AddNumberToObject(documentJSON, "printedSize", reference->size);
+  if (randomSize) {
+    cJSON_AddNumberToObject(documentJSON, "depth", depth);
+    cJSON_AddNumberToObject(documentJSON, "width", width);
+    cJSON_AddNumberToObject(documentJSON, "stringPercent", stringPercent);
+  }
+  cJSON_AddItemToObject(json, "document", documentJSON);
+
+  if (mode & printModeUnformatted) {
+    cJSON_AddItemToObject(json, "unformatted",
+                          allocatorJSON(contents, reference, threads, &timeout,
+                                        printModeUnformatted, selected,
+                                        verbose));
+  }
+  if (mode & printModePreallocated) {
+    cJSON_AddItemToObject(json, "preallocated",
+                          allocatorJSON(contents, reference, threads, &timeout,
+                                        printModePreallocated, selected,
+                                        verbose));
+  }
+
+  printJSON(json, formated);
+
+  cJSON_Delete(json);
+
+  ret = 0;
+
+END:
+  if (contents) {
+    destroyContents(contents);
+    free(contents);
+    contents = NULL;
+  }
+  if (reference) {
+    destroyContents(reference);
+    free(reference);
+    reference = NULL;
+  }
+  return ret;
+}
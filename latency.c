@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "latency.h"
+
+/* A thread that exits hands its shard back for the next thread. */
+static void shardRelease(void *shard) {
+  __atomic_store_n(&((HISTOGRAM *)shard)->owned, 0, __ATOMIC_RELEASE);
+}
+
+LATENCY *latencyNew() {
+  LATENCY *l = (LATENCY *)calloc(1, sizeof(LATENCY));
+  assert(l);
+
+  int i = pthread_key_create(&(l->key), shardRelease);
+  assert(i == 0);
+  pthread_mutex_init(&(l->lock), NULL);
+
+  return l;
+}
+
+void latencyDestroy(LATENCY *l) {
+  if (!l) return;
+
+  pthread_key_delete(l->key);
+  pthread_mutex_destroy(&(l->lock));
+  for (HISTOGRAM *h = l->shards; h;) {
+    HISTOGRAM *next = h->next;
+    free(h);
+    h = next;
+  }
+  free(l);
+}
+
+void latencyReset(LATENCY *l) {
+  for (HISTOGRAM *h = l->shards; h; h = h->next) {
+    memset(h->buckets, 0, sizeof(h->buckets));
+    h->count = 0;
+    h->max = 0;
+  }
+}
+
+static HISTOGRAM *shardGet(LATENCY *l) {
+  HISTOGRAM *h = (HISTOGRAM *)pthread_getspecific(l->key);
+  if (h) return h;
+
+  pthread_mutex_lock(&(l->lock));
+  for (h = l->shards; h; h = h->next) {
+    if (!__atomic_load_n(&(h->owned), __ATOMIC_ACQUIRE)) break;
+  }
+  if (!h) {
+    h = (HISTOGRAM *)calloc(1, sizeof(HISTOGRAM));
+    assert(h);
+    h->next = l->shards;
+    l->shards = h;
+  }
+  h->owned = 1;
+  pthread_mutex_unlock(&(l->lock));
+
+  pthread_setspecific(l->key, h);
+
+  return h;
+}
+
+/* All shards summed into one histogram. */
+static void shardsMerge(const LATENCY *l, HISTOGRAM *merged) {
+  memset(merged, 0, sizeof(*merged));
+
+  for (const HISTOGRAM *h = l->shards; h; h = h->next) {
+    for (unsigned int i = 0; i < latencyBuckets; i ++) {
+      merged->buckets[i] += h->buckets[i];
+    }
+    merged->count += h->count;
+    if (h->max > merged->max) merged->max = h->max;
+  }
+}
+
+unsigned long latencyNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static unsigned int bucketIndex(unsigned long nsec) {
+  if (nsec < latencySubBuckets) return nsec;
+
+  unsigned int e = 63 - __builtin_clzl(nsec);
+  unsigned int sub = (nsec >> (e - 4)) & (latencySubBuckets - 1);
+
+  return (e - 3) * latencySubBuckets + sub;
+}
+
+/* Midpoint of the values falling into a bucket. */
+static unsigned long bucketValue(unsigned int index) {
+  if (index < latencySubBuckets) return index;
+
+  unsigned int e = index / latencySubBuckets + 3;
+  unsigned long sub = index % latencySubBuckets;
+  unsigned long low = (latencySubBuckets + sub) << (e - 4);
+
+  return low + ((1UL << (e - 4)) >> 1);
+}
+
+void latencyAdd(LATENCY *l, unsigned long nsec) {
+  HISTOGRAM *h = shardGet(l);
+
+  h->buckets[bucketIndex(nsec)] ++;
+  h->count ++;
+  if (nsec > h->max) h->max = nsec;
+}
+
+static unsigned long histogramPercentile(const HISTOGRAM *h, double percent) {
+  if (h->count == 0) return 0;
+
+  unsigned long rank = (unsigned long)(percent / 100.0 * h->count);
+  if (rank >= h->count) rank = h->count - 1;
+
+  unsigned long seen = 0;
+  for (unsigned int i = 0; i < latencyBuckets; i ++) {
+    seen += h->buckets[i];
+    if (seen > rank) {
+      unsigned long value = bucketValue(i);
+      return value > h->max ? h->max : value;
+    }
+  }
+
+  return h->max;
+}
+
+unsigned long latencyPercentile(const LATENCY *l, double percent) {
+  HISTOGRAM *merged = (HISTOGRAM *)malloc(sizeof(HISTOGRAM));
+  assert(merged);
+  shardsMerge(l, merged);
+
+  unsigned long value = histogramPercentile(merged, percent);
+  free(merged);
+
+  return value;
+}
+
+cJSON *latencyToJSON(const LATENCY *l) {
+  HISTOGRAM *merged = (HISTOGRAM *)malloc(sizeof(HISTOGRAM));
+  assert(merged);
+  shardsMerge(l, merged);
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+
+  cJSON_AddNumberToObject(json, "count", merged->count);
+  cJSON_AddNumberToObject(json, "p50", histogramPercentile(merged, 50));
+  cJSON_AddNumberToObject(json, "p90", histogramPercentile(merged, 90));
+  cJSON_AddNumberToObject(json, "p99", histogramPercentile(merged, 99));
+  cJSON_AddNumberToObject(json, "p999", histogramPercentile(merged, 99.9));
+  cJSON_AddNumberToObject(json, "max", merged->max);
+
+  free(merged);
+
+  return json;
+}
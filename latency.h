@@ -0,0 +1,45 @@
+#ifndef __REALITY_LATENCY_H
+#define __REALITY_LATENCY_H
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "external/cJSON.h"
+
+/* Log-linear histogram of nanosecond latencies: exact below 16ns, then
+   16 buckets per power of two (about 6% resolution). Every thread that
+   records gets a shard of its own, so the measured path touches no
+   shared cache line; readers merge the shards. */
+#define latencySubBuckets 16
+#define latencyBuckets ((64 - 3) * latencySubBuckets)
+
+struct l_histogram {
+  unsigned long buckets[latencyBuckets];
+  unsigned long count;
+  unsigned long max;
+  /* Set while a thread records into this shard. */
+  int owned;
+  struct l_histogram *next;
+};
+typedef struct l_histogram HISTOGRAM;
+
+struct l_latency {
+  pthread_key_t key;
+  pthread_mutex_t lock;
+  HISTOGRAM *shards;
+};
+typedef struct l_latency LATENCY;
+
+LATENCY *latencyNew();
+void latencyDestroy(LATENCY *l);
+void latencyReset(LATENCY *l);
+
+unsigned long latencyNow();
+void latencyAdd(LATENCY *l, unsigned long nsec);
+
+/* Readers must not race with latencyAdd; call them, and latencyReset,
+   between runs. */
+unsigned long latencyPercentile(const LATENCY *l, double percent);
+cJSON *latencyToJSON(const LATENCY *l);
+
+#endif
@@ -8,52 +8,946 @@
 #include <sys/uio.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#elif OPENSSL_VERSION_NUMBER >= 0x010100000L
+#include <openssl/hmac.h>
+#endif
 
 #include "contents.h"
 #include "benchmark.h"
 #include "misc.h"
+#include "cpucap.h"
+#include "provider.h"
+#include "parallel.h"
+#include "mstage.h"
 
-const EVP_MD *md;
+/* mSettings.md is the implicit EVP_get_digestbyname() object or the
+   explicitly fetched fetchedMd, resolved once per run. */
+static EVP_MD *fetchedMd = NULL;
+static const char *mdName = "sha256";
+static unsigned int fetchMode = fetchModeDefault;
 
-static CONTENTS* mdContent(const CONTENTS* data) {
-#if OPENSSL_VERSION_NUMBER < 0x010100000L
-    EVP_MD_CTX mdctx;
-#endif
-    EVP_MD_CTX *ctx;
-    CONTENTS *mdResult = NULL;
-    int i = 0;
+/* The mSettings.chunkSize sweep. */
+#define chunkSweepMin 64
+#define chunkSweepMax (1 << 20)
 
-    mdResult = calloc(1, sizeof(CONTENTS));
-    assert(mdResult);
-    mdResult->body = malloc(EVP_MAX_MD_SIZE);
-    assert(mdResult->body);
+/* Tree mode: the input is split into leaves of leafSize bytes, hashed
+   by treeWorkers threads, and combined pairwise up a binary tree, each
+   level in parallel. Leaves hash 0x00 || data and parents 0x01 || left
+   || right, as RFC 6962 does, and an odd node is promoted as it is. */
+static size_t leafSize = 0;
+static unsigned int treeWorkers = 1;
 
-    unsigned int md_len;
+struct m_tree {
+    const CONTENTS *data;
+    unsigned char *from;
+    unsigned char *to;
+    size_t count;
+    unsigned int mdSize;
+};
+typedef struct m_tree TREE;
 
-#if OPENSSL_VERSION_NUMBER < 0x010100000L
-    EVP_MD_CTX_init(&mdctx);
-    ctx = &mdctx;
-#else
-    ctx = EVP_MD_CTX_new();
+static void treeLeaf(size_t index, void *arg) {
+    TREE *tree = (TREE *)arg;
+    static const unsigned char prefix = 0x00;
+
+    size_t offset = index * leafSize;
+    size_t length = tree->data->size - offset < leafSize ?
+                    tree->data->size - offset : leafSize;
+
+    EVP_MD_CTX *ctx = EVP_MD_CTX_create();
+    assert(ctx);
+
+    int i = EVP_DigestInit_ex(ctx, mSettings.md, NULL);
+    assert(i==1);
+    i = EVP_DigestUpdate(ctx, &prefix, 1);
+    assert(i==1);
+    i = EVP_DigestUpdate(ctx, tree->data->body + offset, length);
+    assert(i==1);
+    i = EVP_DigestFinal_ex(ctx, tree->to + index * tree->mdSize, NULL);
+    assert(i==1);
+
+    EVP_MD_CTX_destroy(ctx);
+}
+
+static void treeParent(size_t index, void *arg) {
+    TREE *tree = (TREE *)arg;
+    unsigned char node[1 + 2 * EVP_MAX_MD_SIZE];
+    unsigned int mdSize = tree->mdSize;
+
+    unsigned char *left = tree->from + 2 * index * mdSize;
+    unsigned char *parent = tree->to + index * mdSize;
+
+    if (2 * index + 1 == tree->count) {
+        memcpy(parent, left, mdSize);
+        return;
+    }
+
+    node[0] = 0x01;
+    memcpy(node + 1, left, 2 * mdSize);
+
+    int i = EVP_Digest(node, 1 + 2 * mdSize, parent, NULL, mSettings.md, NULL);
+    assert(i==1);
+}
+
+static CONTENTS* treeContent(const CONTENTS* data) {
+    TREE tree;
+    tree.data = data;
+    tree.mdSize = EVP_MD_size(mSettings.md);
+    tree.count = (data->size + leafSize - 1) / leafSize;
+
+    unsigned char *levels[2];
+    levels[0] = malloc(tree.count * tree.mdSize);
+    levels[1] = malloc((tree.count + 1) / 2 * tree.mdSize);
+    assert(levels[0] && levels[1]);
+
+    tree.to = levels[0];
+    parallelFor(treeWorkers, tree.count, treeLeaf, &tree);
+
+    for (unsigned int level = 1; tree.count > 1; level ++) {
+        tree.from = levels[(level - 1) & 1];
+        tree.to = levels[level & 1];
+        size_t parents = (tree.count + 1) / 2;
+        parallelFor(treeWorkers, parents, treeParent, &tree);
+        tree.count = parents;
+    }
+
+    CONTENTS *treeResult = calloc(1, sizeof(CONTENTS));
+    assert(treeResult);
+    treeResult->body = malloc(tree.mdSize);
+    assert(treeResult->body);
+    memcpy(treeResult->body, tree.to, tree.mdSize);
+    treeResult->size = tree.mdSize;
+
+    free(levels[0]);
+    free(levels[1]);
+
+    return treeResult;
+}
+
+/* Fan-out mode: several digests, and zlib's crc32/adler32, over the same
+   input. The fused pass walks it once in fanoutBlock sized blocks and
+   feeds each block to every algorithm while it is still in cache; the
+   separate passes run one algorithm after the other over all of it. */
+#define fanoutMax 8
+#define fanoutBlockDefault (16 << 10)
+#define fanoutCRC32 1
+#define fanoutAdler32 2
+
+struct m_fanout {
+    char *name;
+    int checksum;
+    const EVP_MD *md;
+    EVP_MD *fetched;
+};
+typedef struct m_fanout FANOUT;
+
+static FANOUT fanouts[fanoutMax];
+static unsigned int fanoutCount = 0;
+static size_t fanoutBlock = fanoutBlockDefault;
+
+/* zlib takes uInt lengths, so feed it at most 1G at a time. */
+static unsigned long checksumUpdate(int checksum, unsigned long value,
+                                    const unsigned char *buf, size_t len) {
+    while (len) {
+        uInt n = len > (1 << 30) ? (1 << 30) : (uInt)len;
+        value = checksum == fanoutCRC32 ? crc32(value, buf, n) :
+                                          adler32(value, buf, n);
+        buf += n;
+        len -= n;
+    }
+    return value;
+}
+
+static CONTENTS* fanoutContent(const CONTENTS* data, size_t block) {
+    EVP_MD_CTX *ctxs[fanoutMax];
+    unsigned long checksums[fanoutMax];
+    int i;
+
+    for (unsigned int k = 0; k < fanoutCount; k ++) {
+        if (fanouts[k].checksum) {
+            checksums[k] = fanouts[k].checksum == fanoutCRC32 ?
+                           crc32(0L, Z_NULL, 0) : adler32(0L, Z_NULL, 0);
+            continue;
+        }
+        ctxs[k] = EVP_MD_CTX_create();
+        assert(ctxs[k]);
+        i = EVP_DigestInit_ex(ctxs[k], fanouts[k].md, NULL);
+        assert(i==1);
+    }
+
+    const unsigned char *body = (const unsigned char *)data->body;
+    for (size_t offset = 0; offset < data->size; offset += block) {
+        size_t length = data->size - offset < block ? data->size - offset : block;
+        for (unsigned int k = 0; k < fanoutCount; k ++) {
+            if (fanouts[k].checksum) {
+                checksums[k] = checksumUpdate(fanouts[k].checksum, checksums[k],
+                                              body + offset, length);
+            } else {
+                i = EVP_DigestUpdate(ctxs[k], body + offset, length);
+                assert(i==1);
+            }
+        }
+    }
+
+    CONTENTS *fanoutResult = calloc(1, sizeof(CONTENTS));
+    assert(fanoutResult);
+    fanoutResult->body = malloc(fanoutMax * EVP_MAX_MD_SIZE);
+    assert(fanoutResult->body);
+
+    unsigned char *out = (unsigned char *)fanoutResult->body;
+    for (unsigned int k = 0; k < fanoutCount; k ++) {
+        if (fanouts[k].checksum) {
+            for (int b = 3; b >= 0; b --) {
+                *out ++ = (unsigned char)(checksums[k] >> (b * 8));
+            }
+            continue;
+        }
+        unsigned int len;
+        i = EVP_DigestFinal_ex(ctxs[k], out, &len);
+        assert(i==1);
+        out += len;
+        EVP_MD_CTX_destroy(ctxs[k]);
+    }
+    fanoutResult->size = out - (unsigned char *)fanoutResult->body;
+
+    return fanoutResult;
+}
+
+static CONTENTS* fanoutFused(const CONTENTS* data) {
+    return fanoutContent(data, fanoutBlock);
+}
+
+/* One whole-input update per algorithm: a pass over memory each. */
+static CONTENTS* fanoutSeparate(const CONTENTS* data) {
+    return fanoutContent(data, data->size);
+}
+
+/* Frees the names of the current fanout list and empties it. */
+static void fanoutClear() {
+    for (unsigned int k = 0; k < fanoutCount; k ++) {
+        free(fanouts[k].name);
+    }
+    memset(fanouts, 0, sizeof(fanouts));
+    fanoutCount = 0;
+}
+
+/* Parse a comma separated fanout list into fanouts, each entry keeping
+   its own copy of the name; 0 on an unknown name or more than fanoutMax
+   entries. Replaces the list, so a repeated -F wins over earlier ones. */
+static int fanoutParse(const char *list) {
+    fanoutClear();
+
+    char *copy = strdup(list);
+    assert(copy);
+
+    int ok = 1;
+    char *save = NULL;
+    for (char *name = strtok_r(copy, ",", &save); name && ok;
+         name = strtok_r(NULL, ",", &save)) {
+        if (fanoutCount == fanoutMax) {
+            ok = 0;
+            break;
+        }
+
+        FANOUT *f = &fanouts[fanoutCount ++];
+        f->name = strdup(name);
+        assert(f->name);
+        if (strcmp(name, "crc32") == 0) {
+            f->checksum = fanoutCRC32;
+        } else if (strcmp(name, "adler32") == 0) {
+            f->checksum = fanoutAdler32;
+        } else if (!EVP_get_digestbyname(name)) {
+            ok = 0;
+        }
+    }
+    free(copy);
+
+    return ok && fanoutCount > 0;
+}
+
+static void fanoutRelease() {
+    for (unsigned int k = 0; k < fanoutCount; k ++) {
+        providerDigestFree(fanouts[k].fetched);
+        fanouts[k].fetched = NULL;
+        fanouts[k].md = NULL;
+    }
+}
+
+/* Resolve every digest of the list for the current fetch mode. */
+static int fanoutApply() {
+    fanoutRelease();
+
+    for (unsigned int k = 0; k < fanoutCount; k ++) {
+        FANOUT *f = &fanouts[k];
+        if (f->checksum) continue;
+
+        if (fetchMode == fetchModeExplicit) {
+            f->fetched = providerDigest(f->name);
+            f->md = f->fetched;
+        } else {
+            f->md = EVP_get_digestbyname(f->name);
+        }
+        if (!f->md) return 0;
+
+        EVP_MD_CTX *ctx = EVP_MD_CTX_create();
+        assert(ctx);
+        int i = EVP_DigestInit_ex(ctx, f->md, NULL);
+        EVP_MD_CTX_destroy(ctx);
+        if (i != 1) return 0;
+    }
+    return 1;
+}
+
+/* HMAC mode: the context is keyed once per run, and each thread keeps a
+   copy of it that every message restarts without installing the key. */
+static int macMode = 0;
+static unsigned char macKey[32];
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX MAC_CTX;
+static EVP_MAC *mac = NULL;
+#elif OPENSSL_VERSION_NUMBER >= 0x010100000L
+typedef HMAC_CTX MAC_CTX;
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x010100000L
+static MAC_CTX *macTemplate = NULL;
+static pthread_key_t threadKey;
 #endif
 
-    i = EVP_DigestInit_ex(ctx, md, NULL);
+#if OPENSSL_VERSION_NUMBER >= 0x010100000L
+static MAC_CTX *macDup(const MAC_CTX *from) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    MAC_CTX *ctx = EVP_MAC_CTX_dup(from);
+    assert(ctx);
+#else
+    MAC_CTX *ctx = HMAC_CTX_new();
+    assert(ctx);
+    int i = HMAC_CTX_copy(ctx, (MAC_CTX *)from);
     assert(i==1);
+#endif
+    return ctx;
+}
+
+static void macFree(void *ctx) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    EVP_MAC_CTX_free((MAC_CTX *)ctx);
+#else
+    HMAC_CTX_free((MAC_CTX *)ctx);
+#endif
+}
 
-    i = EVP_DigestUpdate(ctx, data->body, data->size);
+static size_t macBuffer(MAC_CTX *ctx, const CONTENTS *data,
+                        unsigned char *out) {
+    int i;
+    size_t chunk = mSettings.chunkSize ? mSettings.chunkSize : data->size;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    size_t len;
+
+    i = EVP_MAC_init(ctx, NULL, 0, NULL);
     assert(i==1);
+    for (size_t offset = 0; offset < data->size; offset += chunk) {
+        size_t length = data->size - offset < chunk ? data->size - offset : chunk;
+        i = EVP_MAC_update(ctx, (unsigned char *)data->body + offset, length);
+        assert(i==1);
+    }
+    i = EVP_MAC_final(ctx, out, &len, EVP_MAX_MD_SIZE);
+    assert(i==1);
+#else
+    unsigned int len;
 
-    i = EVP_DigestFinal_ex(ctx, mdResult->body, &md_len);
+    i = HMAC_Init_ex(ctx, NULL, 0, NULL, NULL);
     assert(i==1);
-    mdResult->size = md_len;
+    for (size_t offset = 0; offset < data->size; offset += chunk) {
+        size_t length = data->size - offset < chunk ? data->size - offset : chunk;
+        i = HMAC_Update(ctx, (unsigned char *)data->body + offset, length);
+        assert(i==1);
+    }
+    i = HMAC_Final(ctx, out, &len);
+    assert(i==1);
+#endif
+
+    return len;
+}
+
+static CONTENTS* macContent(const CONTENTS* data) {
+    MAC_CTX *ctx = (MAC_CTX *)pthread_getspecific(threadKey);
+    if (!ctx) {
+        ctx = macDup(macTemplate);
+        pthread_setspecific(threadKey, ctx);
+    }
+
+    CONTENTS *macResult = calloc(1, sizeof(CONTENTS));
+    assert(macResult);
+    macResult->body = malloc(EVP_MAX_MD_SIZE);
+    assert(macResult->body);
+    macResult->size = macBuffer(ctx, data, (unsigned char *)macResult->body);
+
+    return macResult;
+}
+
+/* Reference MAC from a private copy, so no thread keeps a context keyed
+   from a template that is replaced later. */
+static CONTENTS* macReference(const CONTENTS* data) {
+    MAC_CTX *ctx = macDup(macTemplate);
+
+    CONTENTS *macResult = calloc(1, sizeof(CONTENTS));
+    assert(macResult);
+    macResult->body = malloc(EVP_MAX_MD_SIZE);
+    assert(macResult->body);
+    macResult->size = macBuffer(ctx, data, (unsigned char *)macResult->body);
+
+    macFree(ctx);
+
+    return macResult;
+}
+
+static void macRelease() {
+    macFree(macTemplate);
+    macTemplate = NULL;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    EVP_MAC_free(mac);
+    mac = NULL;
+#endif
+}
+
+/* Key the HMAC template over md, 0 if it cannot be. */
+static int macApply() {
+    int i;
+
+    macRelease();
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    const char *propq = providerPropq();
+
+    mac = fetchMode == fetchModeExplicit ? providerMac("HMAC") :
+                                           EVP_MAC_fetch(NULL, "HMAC", NULL);
+    if (!mac) return 0;
+
+    macTemplate = EVP_MAC_CTX_new(mac);
+    assert(macTemplate);
+
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_utf8_string(OSSL_MAC_PARAM_DIGEST,
+                               (char *)EVP_MD_get0_name(mSettings.md), 0),
+        OSSL_PARAM_utf8_string(OSSL_MAC_PARAM_PROPERTIES, (char *)propq, 0),
+        OSSL_PARAM_END
+    };
+    if (!propq || fetchMode != fetchModeExplicit) {
+        params[1] = params[2];
+    }
+    i = EVP_MAC_init(macTemplate, macKey, sizeof(macKey), params);
+#else
+    macTemplate = HMAC_CTX_new();
+    assert(macTemplate);
+
+    i = HMAC_Init_ex(macTemplate, macKey, sizeof(macKey), mSettings.md, NULL);
+#endif
+
+    return i == 1;
+}
+#endif
+
+/* Small-key mode: the input is a pool of keyCount keys, packed at
+   keyOffsets, of keyMin to keyMax bytes each. Every loop hashes all of
+   them and folds the digests together with XOR for the check, so what
+   is measured is the per-call overhead of each way to drive EVP. */
+#define keyPoolBytes (64 << 20)
+#define keyCountMax (1 << 20)
+
+static size_t keyMin = 0;
+static size_t keyMax = 0;
+static size_t keyCount = 0;
+static size_t *keyOffsets = NULL;
+
+static CONTENTS *keyPool() {
+    keyCount = keyPoolBytes / keyMax;
+    if (keyCount > keyCountMax) keyCount = keyCountMax;
+
+    keyOffsets = malloc((keyCount + 1) * sizeof(size_t));
+    assert(keyOffsets);
+
+    unsigned int seed = 1;
+    keyOffsets[0] = 0;
+    for (size_t k = 0; k < keyCount; k ++) {
+        size_t length = keyMin + rand_r(&seed) % (keyMax - keyMin + 1);
+        keyOffsets[k + 1] = keyOffsets[k] + length;
+    }
+
+    return randomContents(keyOffsets[keyCount]);
+}
+
+static CONTENTS *keyResult(const unsigned char *fold) {
+    CONTENTS *keyResult = calloc(1, sizeof(CONTENTS));
+    assert(keyResult);
+    keyResult->size = EVP_MD_size(mSettings.md);
+    keyResult->body = malloc(keyResult->size);
+    assert(keyResult->body);
+    memcpy(keyResult->body, fold, keyResult->size);
+
+    return keyResult;
+}
+
+static void keyFold(unsigned char *fold, const unsigned char *digest,
+                    unsigned int len) {
+    for (unsigned int i = 0; i < len; i ++) {
+        fold[i] ^= digest[i];
+    }
+}
+
+/* mdContent per key: result allocations and a new context per call. */
+static CONTENTS* keysAlloc(const CONTENTS* data) {
+    unsigned char fold[EVP_MAX_MD_SIZE] = {0};
+    CONTENTS key;
+    memset(&key, 0, sizeof(key));
+
+    for (size_t k = 0; k < keyCount; k ++) {
+        key.body = data->body + keyOffsets[k];
+        key.size = keyOffsets[k + 1] - keyOffsets[k];
+
+        CONTENTS *mdResult = mdContent(&key);
+        keyFold(fold, (unsigned char *)mdResult->body, mdResult->size);
+        destroyContents(mdResult);
+        free(mdResult);
+    }
 
+    return keyResult(fold);
+}
+
+static CONTENTS* keysOneShot(const CONTENTS* data) {
+    unsigned char fold[EVP_MAX_MD_SIZE] = {0};
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len;
+
+    for (size_t k = 0; k < keyCount; k ++) {
+        int i = EVP_Digest(data->body + keyOffsets[k],
+                           keyOffsets[k + 1] - keyOffsets[k],
+                           digest, &len, mSettings.md, NULL);
+        assert(i==1);
+        keyFold(fold, digest, len);
+    }
+
+    return keyResult(fold);
+}
+
+/* One context for all keys, reset (reset) or only initialized again
+   (reinit) per key. */
+static CONTENTS* keysReused(const CONTENTS* data, int reset) {
+    unsigned char fold[EVP_MAX_MD_SIZE] = {0};
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len;
+    int i;
+
+    EVP_MD_CTX *ctx = EVP_MD_CTX_create();
+    assert(ctx);
+
+    for (size_t k = 0; k < keyCount; k ++) {
+        if (reset) {
 #if OPENSSL_VERSION_NUMBER < 0x010100000L
-    EVP_MD_CTX_cleanup(&mdctx);
+            EVP_MD_CTX_cleanup(ctx);
 #else
-    EVP_MD_CTX_free(ctx);
+            EVP_MD_CTX_reset(ctx);
+#endif
+        }
+        i = EVP_DigestInit_ex(ctx, mSettings.md, NULL);
+        assert(i==1);
+        i = EVP_DigestUpdate(ctx, data->body + keyOffsets[k],
+                             keyOffsets[k + 1] - keyOffsets[k]);
+        assert(i==1);
+        i = EVP_DigestFinal_ex(ctx, digest, &len);
+        assert(i==1);
+        keyFold(fold, digest, len);
+    }
+
+    EVP_MD_CTX_destroy(ctx);
+
+    return keyResult(fold);
+}
+
+static CONTENTS* keysReset(const CONTENTS* data) {
+    return keysReused(data, 1);
+}
+
+static CONTENTS* keysReinit(const CONTENTS* data) {
+    return keysReused(data, 0);
+}
+
+/* Each key starts from a copy of a template initialized once. */
+static CONTENTS* keysCopy(const CONTENTS* data) {
+    unsigned char fold[EVP_MAX_MD_SIZE] = {0};
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len;
+    int i;
+
+    EVP_MD_CTX *template = EVP_MD_CTX_create();
+    EVP_MD_CTX *ctx = EVP_MD_CTX_create();
+    assert(template && ctx);
+    i = EVP_DigestInit_ex(template, mSettings.md, NULL);
+    assert(i==1);
+
+    for (size_t k = 0; k < keyCount; k ++) {
+        i = EVP_MD_CTX_copy_ex(ctx, template);
+        assert(i==1);
+        i = EVP_DigestUpdate(ctx, data->body + keyOffsets[k],
+                             keyOffsets[k + 1] - keyOffsets[k]);
+        assert(i==1);
+        i = EVP_DigestFinal_ex(ctx, digest, &len);
+        assert(i==1);
+        keyFold(fold, digest, len);
+    }
+
+    EVP_MD_CTX_destroy(ctx);
+    EVP_MD_CTX_destroy(template);
+
+    return keyResult(fold);
+}
+
+struct m_method {
+    const char *name;
+    CONTENTS *(*run)(const CONTENTS *);
+};
+typedef struct m_method METHOD;
+
+static const METHOD keyMethods[] = {
+    {"alloc", &keysAlloc},
+    {"oneshot", &keysOneShot},
+    {"reset", &keysReset},
+    {"reinit", &keysReinit},
+    {"copy", &keysCopy},
+};
+
+/* Resolve mdName for the current fetch mode, and key the HMAC when in
+   HMAC mode. 0 if no loaded provider implements them. */
+static int mdApply() {
+    providerDigestFree(fetchedMd);
+    fetchedMd = NULL;
+
+    if (fetchMode == fetchModeExplicit) {
+        fetchedMd = providerDigest(mdName);
+        mSettings.md = fetchedMd;
+    } else {
+        mSettings.md = EVP_get_digestbyname(mdName);
+    }
+    if (!mSettings.md) return 0;
+
+    EVP_MD_CTX *ctx = EVP_MD_CTX_create();
+    assert(ctx);
+    int i = EVP_DigestInit_ex(ctx, mSettings.md, NULL);
+    EVP_MD_CTX_destroy(ctx);
+
+#if OPENSSL_VERSION_NUMBER >= 0x010100000L
+    if (i == 1 && macMode) {
+        return macApply();
+    }
+#endif
+    return i == 1;
+}
+
+struct m_bench {
+    const CONTENTS *contents;
+    unsigned int threads;
+    struct timeval *timeout;
+    int sweep;
+    int tree;
+    int verbose;
+};
+typedef struct m_bench BENCH;
+
+static RESULT *runTest(const BENCH *b) {
+    CONTENTS *(*run)(const CONTENTS *) = &mdContent;
+    CONTENTS *reference = NULL;
+
+#if OPENSSL_VERSION_NUMBER >= 0x010100000L
+    if (macMode) {
+        run = &macContent;
+        reference = macReference(b->contents);
+    }
+#endif
+    if (b->tree) {
+        run = &treeContent;
+        unsigned int workers = treeWorkers;
+        treeWorkers = 1;
+        reference = treeContent(b->contents);
+        treeWorkers = workers;
+    }
+    if (!reference) {
+        reference = mdContent(b->contents);
+    }
+
+    TEST *t = testNew();
+    testSetThreads(t, b->threads);
+    testSetTimeout(t, b->timeout);
+    testAddRun(t, run);
+    testSetInput(t, b->contents);
+    testSetTesting(t, reference);
+
+    RESULT *r = testRun(t);
+    assert(r);
+
+    testDestory(t);
+    destroyContents(reference);
+    free(reference);
+
+    return r;
+}
+
+static double runMBps(const RESULT *r, size_t size) {
+    return size / resultAvgIntervalByRun(r, 0) * resultThreads(r) *
+           1000000.0 / (double)(1 << 20);
+}
+
+/* Throughput by update granularity, doubling the chunk from 64 bytes
+   up to 1M. */
+static cJSON *sweepJSON(const BENCH *b) {
+    size_t chunk = mSettings.chunkSize;
+
+    cJSON *json = cJSON_CreateArray();
+    assert(json);
+
+    for (mSettings.chunkSize = chunkSweepMin;
+         mSettings.chunkSize <= chunkSweepMax; mSettings.chunkSize <<= 1) {
+        RESULT *r = runTest(b);
+
+        cJSON *point = cJSON_CreateObject();
+        assert(point);
+        cJSON_AddNumberToObject(point, "chunk", mSettings.chunkSize);
+        cJSON_AddBoolToObject(point, "correct", isResultCorrect(r));
+        cJSON_AddNumberToObject(point, "MBps", runMBps(r, b->contents->size));
+        if (b->verbose) {
+            cJSON_AddItemToObject(point, "result", resultJSON(r, 0));
+        }
+        cJSON_AddItemToArray(json, point);
+
+        resultDestory(r);
+    }
+
+    mSettings.chunkSize = chunk;
+
+    return json;
+}
+
+static void hexToJSON(cJSON *json, const char *name, const CONTENTS *c) {
+    char *hex = malloc(c->size * 2 + 1);
+    assert(hex);
+    for (size_t i = 0; i < c->size; i ++) {
+        sprintf(hex + i * 2, "%02x", (unsigned char)c->body[i]);
+    }
+    cJSON_AddStringToObject(json, name, hex);
+    free(hex);
+}
+
+/* Latency of one object against the number of tree workers, each point
+   measured by a single harness thread. Every point is checked against
+   the root a single worker computes, so a correct run is deterministic
+   across worker counts. */
+static cJSON *treeJSON(const BENCH *b) {
+    cJSON *json = cJSON_CreateObject();
+    assert(json);
+    cJSON_AddNumberToObject(json, "leafSize", leafSize);
+    cJSON_AddNumberToObject(json, "leaves",
+                            (b->contents->size + leafSize - 1) / leafSize);
+
+    treeWorkers = 1;
+    CONTENTS *root = treeContent(b->contents);
+    hexToJSON(json, "root", root);
+    destroyContents(root);
+    free(root);
+
+    BENCH single = *b;
+    single.threads = 1;
+
+    cJSON *pointsJSON = cJSON_CreateArray();
+    assert(pointsJSON);
+
+    double baseLatency = 0;
+    int deterministic = 1;
+    for (unsigned int w = 1; w; w = parallelNextWorkers(w, b->threads)) {
+        treeWorkers = w;
+
+        RESULT *r = runTest(&single);
+        double latency = resultAvgIntervalByRun(r, 0);
+        if (w == 1) baseLatency = latency;
+        deterministic &= isResultCorrect(r);
+
+        cJSON *point = cJSON_CreateObject();
+        assert(point);
+        cJSON_AddNumberToObject(point, "workers", w);
+        cJSON_AddNumberToObject(point, "latency", latency);
+        cJSON_AddNumberToObject(point, "MBps", runMBps(r, b->contents->size));
+        cJSON_AddNumberToObject(point, "speedup", baseLatency / latency);
+        cJSON_AddItemToObject(point, "result", resultJSON(r, b->verbose));
+        cJSON_AddItemToArray(pointsJSON, point);
+
+        resultDestory(r);
+    }
+    cJSON_AddItemToObject(json, "tree", pointsJSON);
+    cJSON_AddBoolToObject(json, "deterministic", deterministic);
+
+    return json;
+}
+
+static RESULT *stageTest(const BENCH *b, CONTENTS *(*run)(const CONTENTS *),
+                         const CONTENTS *reference) {
+    TEST *t = testNew();
+    testSetThreads(t, b->threads);
+    testSetTimeout(t, b->timeout);
+    testAddRun(t, run);
+    testSetInput(t, b->contents);
+    testSetTesting(t, reference);
+
+    RESULT *r = testRun(t);
+    assert(r);
+
+    testDestory(t);
+
+    return r;
+}
+
+/* Fused and separate passes side by side, both checked against the
+   separate result. */
+static cJSON *fanoutJSON(const BENCH *b) {
+    cJSON *json = cJSON_CreateObject();
+    assert(json);
+
+    if (!fanoutApply()) {
+        cJSON_AddStringToObject(json, "error", "digest unavailable");
+        return json;
+    }
+
+    cJSON *namesJSON = cJSON_CreateArray();
+    assert(namesJSON);
+    for (unsigned int k = 0; k < fanoutCount; k ++) {
+        cJSON_AddItemToArray(namesJSON, cJSON_CreateString(fanouts[k].name));
+    }
+    cJSON_AddItemToObject(json, "fanout", namesJSON);
+    cJSON_AddNumberToObject(json, "block", fanoutBlock);
+
+    CONTENTS *reference = fanoutSeparate(b->contents);
+
+    RESULT *fused = stageTest(b, &fanoutFused, reference);
+    RESULT *separate = stageTest(b, &fanoutSeparate, reference);
+    double fusedMBps = runMBps(fused, b->contents->size);
+    double separateMBps = runMBps(separate, b->contents->size);
+
+    cJSON_AddNumberToObject(json, "fusedMBps", fusedMBps);
+    cJSON_AddNumberToObject(json, "separateMBps", separateMBps);
+    cJSON_AddNumberToObject(json, "speedup", fusedMBps / separateMBps);
+    cJSON_AddItemToObject(json, "fused", resultJSON(fused, b->verbose));
+    cJSON_AddItemToObject(json, "separate", resultJSON(separate, b->verbose));
+
+    resultDestory(fused);
+    resultDestory(separate);
+    destroyContents(reference);
+    free(reference);
+
+    return json;
+}
+
+/* Every key method over the same pool, in hashes/s across all threads
+   and ns per hash on one. */
+static cJSON *keysJSON(const BENCH *b) {
+    cJSON *json = cJSON_CreateObject();
+    assert(json);
+    cJSON_AddNumberToObject(json, "keys", keyCount);
+    cJSON_AddNumberToObject(json, "keyMin", keyMin);
+    cJSON_AddNumberToObject(json, "keyMax", keyMax);
+
+    CONTENTS *reference = keysOneShot(b->contents);
+
+    cJSON *methodsJSON = cJSON_CreateArray();
+    assert(methodsJSON);
+    for (unsigned int m = 0; m < sizeof(keyMethods) / sizeof(keyMethods[0]); m ++) {
+        RESULT *r = stageTest(b, keyMethods[m].run, reference);
+        double interval = resultAvgIntervalByRun(r, 0);
+
+        cJSON *method = cJSON_CreateObject();
+        assert(method);
+        cJSON_AddStringToObject(method, "method", keyMethods[m].name);
+        cJSON_AddBoolToObject(method, "correct", isResultCorrect(r));
+        cJSON_AddNumberToObject(method, "hashesPerSec",
+                                keyCount / interval * 1000000.0 * resultThreads(r));
+        cJSON_AddNumberToObject(method, "nsPerHash", interval * 1000.0 / keyCount);
+        if (b->verbose) {
+            cJSON_AddItemToObject(method, "result", resultJSON(r, 0));
+        }
+        cJSON_AddItemToArray(methodsJSON, method);
+
+        resultDestory(r);
+    }
+    cJSON_AddItemToObject(json, "methods", methodsJSON);
+
+    destroyContents(reference);
+    free(reference);
+
+    return json;
+}
+
+static cJSON *benchJSON(const BENCH *b) {
+    if (fanoutCount) {
+        return fanoutJSON(b);
+    }
+
+    if (!mdApply()) {
+        cJSON *json = cJSON_CreateObject();
+        assert(json);
+        cJSON_AddStringToObject(json, "error", "digest unavailable");
+        return json;
+    }
+
+    if (b->tree) {
+        return treeJSON(b);
+    }
+
+    if (keyMax) {
+        return keysJSON(b);
+    }
+
+    if (b->sweep) {
+        cJSON *json = cJSON_CreateObject();
+        assert(json);
+        cJSON_AddItemToObject(json, "sweep", sweepJSON(b));
+        return json;
+    }
+
+    RESULT *r = runTest(b);
+
+    cJSON *json = resultJSON(r, b->verbose);
+
+    resultDestory(r);
+
+    return json;
+}
+
+/* One result per selected fetch mode, side by side when both are.
+   Fetched algorithms are released before their providers are. */
+static cJSON *fetchJSON(void *arg) {
+    const BENCH *b = (const BENCH *)arg;
+    cJSON *json = NULL;
+
+    if (fetchMode != (fetchModeImplicit | fetchModeExplicit)) {
+        json = benchJSON(b);
+    } else {
+        json = cJSON_CreateObject();
+        assert(json);
+        fetchMode = fetchModeImplicit;
+        cJSON_AddItemToObject(json, "implicit", benchJSON(b));
+        fetchMode = fetchModeExplicit;
+        cJSON_AddItemToObject(json, "explicit", benchJSON(b));
+        fetchMode = fetchModeImplicit | fetchModeExplicit;
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x010100000L
+    macRelease();
 #endif
+    fanoutRelease();
+    providerDigestFree(fetchedMd);
+    fetchedMd = NULL;
+    mSettings.md = NULL;
 
-    return mdResult;
+    return json;
 }
 
 static void printUsage() {
@@ -62,6 +956,16 @@ static void printUsage() {
           "[-r seconds <seconds, default is 3>]\n"
           "[-t threads <threads, default is logic cpu cores>]\n"
           "[-m <digestname>, should be md5, sha1, sha224, sha256, sha512, dss, dss1, mdc2, ripemd160, default is sha256]\n"
+          "[-c size <update with chunks of size, default is the whole input at once, or 16K with -F>]\n"
+          "[-S <sweep update chunk sizes from 64 to 1M>]\n"
+          "[-M <HMAC with the digest, keyed once per run>]\n"
+          "[-T size <tree hash one object in leaves of size across up to threads workers>]\n"
+          "[-F <list>, comma separated digests, crc32 or adler32 computed in one pass, against a pass each>]\n"
+          "[-s size[-size] <hash a pool of small keys of size, or a range of sizes, one call each, up to 64M>]\n"
+          "[-e <fetch mode>, should be implicit, explicit or all, default is explicit on OpenSSL 3]\n"
+          "[-P <provider sets>, comma separated sets of '+' joined providers to compare, e.g. default,fips+base]\n"
+          "[-Q <property query>, e.g. provider=default or fips=yes]\n"
+          "[-H <rerun under each OpenSSL CPU feature tier, generic to vaes>]\n"
           "[-v <verbose json output>] [-f <formated json output>]\n"
           "-u size <use random data block, size can use K, M, G>|file|url\n");
 }
@@ -69,7 +973,6 @@ static void printUsage() {
 int main(int argc, char **argv) {
     int ret = -1;
     CONTENTS *contents = NULL;
-    CONTENTS *mdResult = NULL;
 
     struct timeval timeout;
     timeout.tv_sec = 0;
@@ -78,14 +981,20 @@ int main(int argc, char **argv) {
     int verbose = 0;
     int formated = 0;
     size_t randomSize = 0;
+    int hwTiers = 0;
+    int sweep = 0;
+    const char *providerSets = NULL;
+    const char *propq = NULL;
 
     int index;
     int c;
     opterr = 0;
 
+#if OPENSSL_VERSION_NUMBER < 0x010100000L
     OpenSSL_add_all_digests();
+#endif
 
-    while ((c = getopt(argc, argv, "r:t:m:vfu:")) != -1) {
+    while ((c = getopt(argc, argv, "r:t:m:vfu:He:P:Q:c:SMT:F:s:")) != -1) {
         switch (c) {
         case 'r':
             timeout.tv_sec = atoi(optarg);
@@ -100,8 +1009,8 @@ int main(int argc, char **argv) {
             verbose = 1;
             break;
         case 'm':
-            md = EVP_get_digestbyname(optarg);
-            if (!md) {
+            mdName = optarg;
+            if (!EVP_get_digestbyname(mdName)) {
                 printUsage();
                 goto END;
             }
@@ -109,12 +1018,90 @@ int main(int argc, char **argv) {
         case 'f':
             formated = 1;
             break;
+        case 'H':
+            hwTiers = 1;
+            break;
+        case 'c':
+            mSettings.chunkSize = parseHumanSize(optarg);
+            break;
+        case 'S':
+            sweep = 1;
+            break;
+        case 'M':
+#if OPENSSL_VERSION_NUMBER < 0x010100000L
+            fprintf(stderr, "HMAC needs OpenSSL 1.1\n");
+            goto END;
+#endif
+            macMode = 1;
+            break;
+        case 'T':
+            leafSize = parseHumanSize(optarg);
+            if (leafSize == 0) {
+                printUsage();
+                goto END;
+            }
+            break;
+        case 'F':
+            if (!fanoutParse(optarg)) {
+                printUsage();
+                goto END;
+            }
+            break;
+        case 's': {
+            char *lower = strdup(optarg);
+            assert(lower);
+            char *upper = strchr(lower, '-');
+            if (upper) *upper ++ = '\0';
+            keyMin = parseHumanSize(lower);
+            keyMax = upper ? parseHumanSize(upper) : keyMin;
+            free(lower);
+            /* The pool must hold at least one key of the largest size. */
+            if (keyMin == 0 || keyMax < keyMin || keyMax > keyPoolBytes) {
+                printUsage();
+                goto END;
+            }
+            break;
+        }
+        case 'P':
+            providerSets = optarg;
+            break;
+        case 'Q':
+            propq = optarg;
+            break;
+        case 'e':
+            if (strcmp(optarg, "implicit") == 0) {
+                fetchMode = fetchModeImplicit;
+            } else if (strcmp(optarg, "explicit") == 0) {
+                fetchMode = fetchModeExplicit;
+            } else if (strcmp(optarg, "all") == 0) {
+                fetchMode = fetchModeImplicit | fetchModeExplicit;
+            } else {
+                printUsage();
+                goto END;
+            }
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+            if (fetchMode & fetchModeExplicit) {
+                fprintf(stderr, "Explicit fetch needs OpenSSL 3\n");
+                goto END;
+            }
+#endif
+            break;
         case '?':
             printUsage();
             goto END;
         }
     }
 
+    if (fanoutCount && mSettings.chunkSize) {
+        fanoutBlock = mSettings.chunkSize;
+    }
+
+    if (((leafSize || fanoutCount || keyMax) && (macMode || sweep)) ||
+        (!!leafSize + !!fanoutCount + !!keyMax > 1)) {
+        printUsage();
+        goto END;
+    }
+
     if (timeout.tv_sec == 0) {
     timeout.tv_sec = 3;
     }
@@ -125,7 +1112,22 @@ int main(int argc, char **argv) {
         threads = 2;
     }
 
-    if (randomSize) {
+    if (hwTiers && !cpuTierChild()) {
+        cJSON *json = cJSON_CreateObject();
+        assert(json);
+        cJSON_AddItemToObject(json, "cpuFlags", cpuFlagsJSON());
+        cJSON_AddItemToObject(json, "tiers", cpuTiersJSON(argv));
+
+        printJSON(json, formated);
+
+        cJSON_Delete(json);
+        ret = 0;
+        goto END;
+    }
+
+    if (keyMax) {
+    contents = keyPool();
+    } else if (randomSize) {
     contents = randomContents(randomSize);
     } else {
     index = optind;
@@ -145,21 +1147,33 @@ int main(int argc, char **argv) {
     }
     }
 
-    mdResult = mdContent(contents);
+    if (macMode) {
+        int fd = open("/dev/urandom", O_RDONLY);
+        assert(fd >= 0);
+        ssize_t n = read(fd, macKey, sizeof(macKey));
+        assert(n == sizeof(macKey));
+        close(fd);
 
-    TEST *t = testNew();
-    testSetThreads(t, threads);
-    testSetTimeout(t, &timeout);
-    testAddRun(t, &mdContent);
-    testSetInput(t, contents);
-    testSetTesting(t, mdResult);
+#if OPENSSL_VERSION_NUMBER >= 0x010100000L
+        pthread_key_create(&threadKey, macFree);
+#endif
+    }
 
-    RESULT *r = testRun(t);
-    assert(r);
+    BENCH bench = {contents, threads, &timeout, sweep, leafSize != 0, verbose};
+    cJSON *json = NULL;
+
+    if (providerSets) {
+        json = providerCompareJSON(providerSets, propq, fetchJSON, &bench);
+    } else if (providerLoad(NULL, propq)) {
+        json = fetchJSON(&bench);
+    } else {
+        fprintf(stderr, "Bad property query\n");
+        goto END;
+    }
 
-    printResult(r, verbose, formated);
+    printJSON(json, formated);
 
-    resultDestory(r);
+    cJSON_Delete(json);
 
     ret = 0;
 
@@ -169,10 +1183,9 @@ END:
         free(contents);
         contents = NULL;
     }
-    if (mdResult) {
-        destroyContents(mdResult);
-        free(mdResult);
-        mdResult = NULL;
-    }
+    fanoutRelease();
+    fanoutClear();
+    providerUnload();
+    free(keyOffsets);
     return ret;
 }
\ No newline at end of file
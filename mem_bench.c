@@ -0,0 +1,594 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "contents.h"
+#include "benchmark.h"
+#include "misc.h"
+
+#define kernelCopy  0
+#define kernelScale 1
+#define kernelAdd   2
+#define kernelTriad 3
+
+#define scalar 3.0
+#define lineSize 64
+#define chaseSteps (1 << 20)
+/* Bytes memcpy moves per harness call. */
+#define memcpyBatch (8 << 20)
+
+#define testStream  (1 << 0)
+#define testMemcpy  (1 << 1)
+#define testLatency (1 << 2)
+
+static const char *testNames[] = {"stream", "memcpy", "latency"};
+
+static const char *kernelNames[] = {"copy", "scale", "add", "triad"};
+/* Arrays moved per element: STREAM counts bytes read plus written. */
+static const unsigned int kernelArrays[] = {2, 2, 3, 3};
+/* Every kernel rewrites one array from the others, starting from
+   a = 1, b = 2, c = 3, so its destination always ends up holding the
+   same value: c = a, b = q * c, c = a + b, a = b + q * c. */
+static const double kernelResults[] = {1.0, scalar * 3.0, 1.0 + 2.0,
+                                       2.0 + scalar * 3.0};
+
+static unsigned int kernel = kernelCopy;
+static int nonTemporal = 0;
+static size_t elements = 0;
+static size_t copySize = 0;
+static void **chaseStart = NULL;
+
+struct m_arrays {
+  double *a;
+  double *b;
+  double *c;
+  unsigned char *src;
+  unsigned char *dst;
+};
+typedef struct m_arrays ARRAYS;
+
+/* Arrays for each worker thread, allocated and filled before the
+   measured runs; a worker claims the next slot on its first call. */
+static ARRAYS *slots = NULL;
+static unsigned int slotCount = 0;
+static unsigned int slotNext = 0;
+static pthread_key_t slotKey;
+
+static void *alignedAlloc(size_t size) {
+  void *p = NULL;
+  int i = posix_memalign(&p, lineSize, size ? size : lineSize);
+  assert(i == 0);
+
+  return p;
+}
+
+static void slotsNew(unsigned int count, size_t arrayElements, size_t copyMax) {
+  slots = calloc(count, sizeof(ARRAYS));
+  assert(slots);
+  slotCount = count;
+
+  for (unsigned int s = 0; s < count; s ++) {
+    if (arrayElements) {
+      slots[s].a = alignedAlloc(arrayElements * sizeof(double));
+      slots[s].b = alignedAlloc(arrayElements * sizeof(double));
+      slots[s].c = alignedAlloc(arrayElements * sizeof(double));
+    }
+    if (copyMax) {
+      slots[s].src = alignedAlloc(copyMax);
+      slots[s].dst = alignedAlloc(copyMax);
+      for (size_t i = 0; i < copyMax; i ++) {
+        slots[s].src[i] = i & 0xff;
+      }
+      memset(slots[s].dst, 0, copyMax);
+    }
+  }
+}
+
+static void slotsFree() {
+  for (unsigned int s = 0; s < slotCount; s ++) {
+    free(slots[s].a);
+    free(slots[s].b);
+    free(slots[s].c);
+    free(slots[s].src);
+    free(slots[s].dst);
+  }
+  free(slots);
+  slots = NULL;
+  slotCount = 0;
+}
+
+/* Every kernel starts from a = 1, b = 2, c = 3. */
+static void slotsReset() {
+  for (unsigned int s = 0; s < slotCount; s ++) {
+    for (size_t i = 0; i < elements && slots[s].a; i ++) {
+      slots[s].a[i] = 1.0;
+      slots[s].b[i] = 2.0;
+      slots[s].c[i] = 3.0;
+    }
+  }
+  slotNext = 0;
+}
+
+static ARRAYS *threadArrays() {
+  ARRAYS *arrays = (ARRAYS *)pthread_getspecific(slotKey);
+  if (arrays) return arrays;
+
+  unsigned int s = __atomic_fetch_add(&slotNext, 1, __ATOMIC_RELAXED);
+  assert(s < slotCount);
+  arrays = &slots[s];
+  pthread_setspecific(slotKey, arrays);
+
+  return arrays;
+}
+
+kernelFunction static void streamKernel(ARRAYS *arrays) {
+  double *restrict a = arrays->a;
+  double *restrict b = arrays->b;
+  double *restrict c = arrays->c;
+  size_t n = elements;
+
+  switch (kernel) {
+  case kernelCopy:
+    for (size_t i = 0; i < n; i ++) c[i] = a[i];
+    break;
+  case kernelScale:
+    for (size_t i = 0; i < n; i ++) b[i] = scalar * c[i];
+    break;
+  case kernelAdd:
+    for (size_t i = 0; i < n; i ++) c[i] = a[i] + b[i];
+    break;
+  case kernelTriad:
+    for (size_t i = 0; i < n; i ++) a[i] = b[i] + scalar * c[i];
+    break;
+  }
+}
+
+#ifdef __SSE2__
+/* Streaming stores bypass the caches, saving the read for ownership of
+   every destination line. Arrays are line aligned and elements even. */
+kernelFunction static void streamKernelNT(ARRAYS *arrays) {
+  double *restrict a = arrays->a;
+  double *restrict b = arrays->b;
+  double *restrict c = arrays->c;
+  size_t n = elements;
+  const __m128d q = _mm_set1_pd(scalar);
+
+  switch (kernel) {
+  case kernelCopy:
+    for (size_t i = 0; i < n; i += 2) {
+      _mm_stream_pd(c + i, _mm_load_pd(a + i));
+    }
+    break;
+  case kernelScale:
+    for (size_t i = 0; i < n; i += 2) {
+      _mm_stream_pd(b + i, _mm_mul_pd(q, _mm_load_pd(c + i)));
+    }
+    break;
+  case kernelAdd:
+    for (size_t i = 0; i < n; i += 2) {
+      _mm_stream_pd(c + i, _mm_add_pd(_mm_load_pd(a + i), _mm_load_pd(b + i)));
+    }
+    break;
+  case kernelTriad:
+    for (size_t i = 0; i < n; i += 2) {
+      _mm_stream_pd(a + i, _mm_add_pd(_mm_load_pd(b + i),
+                                      _mm_mul_pd(q, _mm_load_pd(c + i))));
+    }
+    break;
+  }
+  _mm_sfence();
+}
+#endif
+
+static CONTENTS *valueContents(const void *value, size_t size) {
+  CONTENTS *result = calloc(1, sizeof(CONTENTS));
+  assert(result);
+  result->body = malloc(size);
+  assert(result->body);
+  memcpy(result->body, value, size);
+  result->size = size;
+
+  return result;
+}
+
+/* Outputs the kernel's destination's last element. */
+static CONTENTS* streamContent(const CONTENTS* data) {
+  (void)data;
+  ARRAYS *arrays = threadArrays();
+
+#ifdef __SSE2__
+  if (nonTemporal) {
+    streamKernelNT(arrays);
+  } else {
+    streamKernel(arrays);
+  }
+#else
+  streamKernel(arrays);
+#endif
+
+  double *destinations[] = {arrays->c, arrays->b, arrays->c, arrays->a};
+  return valueContents(&destinations[kernel][elements - 1], sizeof(double));
+}
+
+/* Outputs the copy's last bytes, which the source pattern fixes. */
+static CONTENTS* memcpyContent(const CONTENTS* data) {
+  (void)data;
+  ARRAYS *arrays = threadArrays();
+
+  size_t reps = batchReps(memcpyBatch, copySize);
+  for (size_t i = 0; i < reps; i ++) {
+    memcpy(arrays->dst, arrays->src, copySize);
+  }
+
+  size_t tail = copySize < sizeof(uint64_t) ? copySize : sizeof(uint64_t);
+  return valueContents(arrays->dst + copySize - tail, tail);
+}
+
+kernelFunction static void **chase(void **p, size_t steps) {
+  for (size_t i = 0; i < steps; i ++) {
+    p = (void **)*p;
+  }
+  return p;
+}
+
+/* Outputs where the chase stopped. */
+static CONTENTS* chaseContent(const CONTENTS* data) {
+  (void)data;
+  void **end = chase(chaseStart, chaseSteps);
+
+  return valueContents(&end, sizeof(end));
+}
+
+/* One pointer per line of size bytes, linked into a single random cycle
+   (Sattolo's algorithm) so hardware prefetchers cannot follow it. */
+static void **chaseBuild(size_t size) {
+  size_t lines = size / lineSize;
+  if (lines < 2) lines = 2;
+
+  unsigned char *buffer = alignedAlloc(lines * lineSize);
+  size_t *order = malloc(sizeof(size_t) * lines);
+  assert(order);
+  for (size_t i = 0; i < lines; i ++) {
+    order[i] = i;
+  }
+
+  unsigned int seed = 1;
+  for (size_t i = lines - 1; i > 0; i --) {
+    size_t j = ((size_t)rand_r(&seed) << 16 ^ rand_r(&seed)) % i;
+    size_t t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+  for (size_t i = 0; i < lines; i ++) {
+    *(void **)(buffer + order[i] * lineSize) = buffer + order[(i + 1) % lines] * lineSize;
+  }
+  free(order);
+
+  return (void **)buffer;
+}
+
+static RESULT *runTest(CONTENTS* (*run)(const CONTENTS*), unsigned int threads,
+                       struct timeval *timeout, const CONTENTS *input,
+                       const CONTENTS *reference) {
+  TEST *t = testNew();
+  testSetThreads(t, threads);
+  testSetTimeout(t, timeout);
+  testAddRun(t, run);
+  testSetInput(t, input);
+  testSetTesting(t, reference);
+
+  RESULT *r = testRun(t);
+  assert(r);
+
+  testDestory(t);
+
+  return r;
+}
+
+static double runMBps(const RESULT *r, double bytes) {
+  return bytes / resultAvgIntervalByRun(r, 0) * 1000000 / (1 << 20) *
+    resultThreads(r);
+}
+
+/* STREAM kernels with regular and, where SSE2 is available, streaming
+   stores. The fastest regular copy and triad go into the baseline. */
+static cJSON *streamJSON(unsigned int threads, struct timeval *timeout,
+                         const CONTENTS *input, cJSON *baseline, int verbose) {
+  cJSON *json = cJSON_CreateArray();
+  assert(json);
+
+#ifdef __SSE2__
+  unsigned int storeKinds = 2;
+#else
+  unsigned int storeKinds = 1;
+#endif
+
+  for (kernel = kernelCopy; kernel <= kernelTriad; kernel ++) {
+    for (unsigned int nt = 0; nt < storeKinds; nt ++) {
+      nonTemporal = nt;
+
+      CONTENTS *reference = valueContents(&kernelResults[kernel], sizeof(double));
+      slotsReset();
+      RESULT *r = runTest(&streamContent, threads, timeout, input, reference);
+      double mbps = runMBps(r, (double)elements * sizeof(double) *
+                            kernelArrays[kernel]);
+
+      cJSON *item = cJSON_CreateObject();
+      assert(item);
+      cJSON_AddStringToObject(item, "kernel", kernelNames[kernel]);
+      cJSON_AddStringToObject(item, "stores", nt ? "non-temporal" : "regular");
+      cJSON_AddNumberToObject(item, "MBps", mbps);
+      cJSON_AddBoolToObject(item, "correct", isResultCorrect(r));
+      if (verbose) {
+        cJSON_AddItemToObject(item, "result", resultJSON(r, 0));
+      }
+      cJSON_AddItemToArray(json, item);
+
+      if (!nt && (kernel == kernelCopy || kernel == kernelTriad)) {
+        cJSON_AddNumberToObject(baseline, kernel == kernelCopy ?
+                                "copyMBps" : "triadMBps", mbps);
+      }
+
+      resultDestory(r);
+      destroyContents(reference);
+      free(reference);
+    }
+  }
+
+  return json;
+}
+
+/* memcpy of sizes doubling from 1K to max, from L1 out to DRAM. */
+static cJSON *memcpyJSON(size_t max, unsigned int threads,
+                         struct timeval *timeout, const CONTENTS *input,
+                         cJSON *baseline, int verbose) {
+  cJSON *json = cJSON_CreateArray();
+  assert(json);
+
+  double last = 0;
+  for (copySize = 1 << 10; copySize <= max; copySize <<= 1) {
+    unsigned char tail[sizeof(uint64_t)];
+    for (size_t i = 0; i < sizeof(tail); i ++) {
+      tail[i] = (copySize - sizeof(tail) + i) & 0xff;
+    }
+    CONTENTS *reference = valueContents(tail, sizeof(tail));
+
+    slotsReset();
+    RESULT *r = runTest(&memcpyContent, threads, timeout, input, reference);
+    last = runMBps(r, (double)copySize * batchReps(memcpyBatch, copySize));
+
+    cJSON *item = cJSON_CreateObject();
+    assert(item);
+    cJSON_AddNumberToObject(item, "size", copySize);
+    cJSON_AddNumberToObject(item, "MBps", last);
+    cJSON_AddBoolToObject(item, "correct", isResultCorrect(r));
+    if (verbose) {
+      cJSON_AddItemToObject(item, "result", resultJSON(r, 0));
+    }
+    cJSON_AddItemToArray(json, item);
+
+    resultDestory(r);
+    destroyContents(reference);
+    free(reference);
+  }
+  copySize = 0;
+
+  cJSON_AddNumberToObject(baseline, "memcpyMBps", last);
+
+  return json;
+}
+
+static size_t cacheSize(int name, size_t fallback) {
+  long size = sysconf(name);
+  return size > 0 ? (size_t)size : fallback;
+}
+
+static size_t clampSize(size_t size, size_t min, size_t max) {
+  if (size < min) return min;
+  if (size > max) return max;
+  return size;
+}
+
+/* Load to use latency on one thread, with working sets of half of each
+   cache level and a DRAM set well past the last level. */
+static cJSON *latencyJSON(size_t l1, size_t l2, size_t l3, size_t dram,
+                          struct timeval *timeout, const CONTENTS *input,
+                          cJSON *baseline, int verbose) {
+  const char *levels[] = {"L1", "L2", "L3", "DRAM"};
+  size_t sizes[] = {l1 / 2, l2 / 2, l3 / 2, dram};
+
+  cJSON *json = cJSON_CreateArray();
+  assert(json);
+  cJSON *latencies = cJSON_CreateObject();
+  assert(latencies);
+
+  for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i ++) {
+    chaseStart = chaseBuild(sizes[i]);
+    CONTENTS *reference = chaseContent(NULL);
+
+    RESULT *r = runTest(&chaseContent, 1, timeout, input, reference);
+    double ns = resultAvgIntervalByRun(r, 0) * 1000 / chaseSteps;
+
+    cJSON *item = cJSON_CreateObject();
+    assert(item);
+    cJSON_AddStringToObject(item, "level", levels[i]);
+    cJSON_AddNumberToObject(item, "size", sizes[i]);
+    cJSON_AddNumberToObject(item, "nsPerLoad", ns);
+    cJSON_AddBoolToObject(item, "correct", isResultCorrect(r));
+    if (verbose) {
+      cJSON_AddItemToObject(item, "result", resultJSON(r, 0));
+    }
+    cJSON_AddItemToArray(json, item);
+    cJSON_AddNumberToObject(latencies, levels[i], ns);
+
+    resultDestory(r);
+    destroyContents(reference);
+    free(reference);
+    free(chaseStart);
+    chaseStart = NULL;
+  }
+
+  cJSON_AddItemToObject(baseline, "latencyNs", latencies);
+
+  return json;
+}
+
+static void printUsage() {
+  fprintf(stderr,
+          "Usage: mem_bench \n"
+          "[-r seconds <seconds, default is 3>]\n"
+          "[-t threads <threads, default is logic cpu cores>]\n"
+          "[-s size <STREAM array size across threads, default is 4 times the last level cache, 32M to 256M>]\n"
+          "[-c size <largest memcpy size per thread, default is the DRAM latency set across threads>]\n"
+          "[-m <tests>, comma separated stream, memcpy or latency, default is all]\n"
+          "[-v <verbose json output>] [-f <formated json output>]\n");
+}
+
+int main(int argc, char **argv) {
+  int ret = -1;
+
+  struct timeval timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 0;
+  unsigned int threads = 0;
+  int verbose = 0;
+  int formated = 0;
+  size_t arraySize = 0;
+  size_t copyMax = 0;
+  unsigned int tests = testStream | testMemcpy | testLatency;
+
+  int c;
+  opterr = 0;
+
+  while ((c = getopt(argc, argv, "r:t:s:c:m:vf")) != -1) {
+    switch (c) {
+    case 'r':
+      timeout.tv_sec = atoi(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 's':
+      arraySize = parseHumanSize(optarg);
+      if (arraySize == 0) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'c':
+      copyMax = parseHumanSize(optarg);
+      if (copyMax == 0) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'm':
+      tests = parseNameList(optarg, testNames,
+                            sizeof(testNames) / sizeof(testNames[0]));
+      if (!tests) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'f':
+      formated = 1;
+      break;
+    case '?':
+      printUsage();
+      goto END;
+    }
+  }
+
+  if (timeout.tv_sec == 0) {
+    timeout.tv_sec = 3;
+  }
+
+  if (threads == 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads == 0)
+      threads = 2;
+  }
+
+  size_t l1 = cacheSize(_SC_LEVEL1_DCACHE_SIZE, 32 << 10);
+  size_t l2 = cacheSize(_SC_LEVEL2_CACHE_SIZE, 1 << 20);
+  size_t l3 = cacheSize(_SC_LEVEL3_CACHE_SIZE, 32 << 20);
+  size_t dram = clampSize(4 * l3, 64 << 20, 512 << 20);
+  if (l3 / 2 > dram / 4) l3 = dram / 2;
+
+  if (arraySize == 0) {
+    arraySize = clampSize(4 * l3, 32 << 20, 256 << 20);
+  }
+  /* Per thread, a whole number of lines. */
+  elements = arraySize / threads / sizeof(double) & ~(size_t)(lineSize / sizeof(double) - 1);
+  if (elements == 0) elements = lineSize / sizeof(double);
+  /* Together the threads' copies still reach well past the caches. */
+  if (copyMax == 0) copyMax = clampSize(dram / threads, 4 << 20, dram);
+
+  pthread_key_create(&slotKey, NULL);
+  slotsNew(threads, tests & testStream ? elements : 0,
+           tests & testMemcpy ? copyMax : 0);
+
+  CONTENTS input;
+  memset(&input, 0, sizeof(input));
+  input.borrowed = 1;
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddNumberToObject(json, "threads", threads);
+
+  cJSON *caches = cJSON_CreateObject();
+  assert(caches);
+  cJSON_AddNumberToObject(caches, "L1", l1);
+  cJSON_AddNumberToObject(caches, "L2", l2);
+  cJSON_AddNumberToObject(caches, "L3", cacheSize(_SC_LEVEL3_CACHE_SIZE, 0));
+  cJSON_AddItemToObject(json, "caches", caches);
+
+  cJSON *baseline = cJSON_CreateObject();
+  assert(baseline);
+
+  if (tests & testStream) {
+    cJSON *stream = cJSON_CreateObject();
+    assert(stream);
+    cJSON_AddNumberToObject(stream, "arrayBytesPerThread", elements * sizeof(double));
+    cJSON_AddItemToObject(stream, "kernels",
+                          streamJSON(threads, &timeout, &input, baseline, verbose));
+    cJSON_AddItemToObject(json, "stream", stream);
+  }
+  elements = 0;
+
+  if (tests & testMemcpy) {
+    cJSON_AddItemToObject(json, "memcpy",
+                          memcpyJSON(copyMax, threads, &timeout, &input,
+                                     baseline, verbose));
+  }
+
+  if (tests & testLatency) {
+    cJSON_AddItemToObject(json, "latency",
+                          latencyJSON(l1, l2, l3, dram, &timeout, &input,
+                                      baseline, verbose));
+  }
+
+  cJSON_AddItemToObject(json, "baseline", baseline);
+
+  printJSON(json, formated);
+
+  cJSON_Delete(json);
+  slotsFree();
+  pthread_key_delete(slotKey);
+
+  ret = 0;
+
+END:
+  return ret;
+}
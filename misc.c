@@ -1,6 +1,12 @@
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <assert.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #include "misc.h"
 
@@ -118,4 +124,63 @@ uintmax_t parseHumanSize (const char* s) {
   return x;
 ERROR:
   return 0;
-}
\ No newline at end of file
+}
+
+unsigned int parseNameList(const char *list, const char **names,
+                           unsigned int count) {
+  unsigned int bits = 0;
+  char *copy = strdup(list);
+  assert(copy);
+
+  char *save = NULL;
+  for (char *name = strtok_r(copy, ",", &save); name;
+       name = strtok_r(NULL, ",", &save)) {
+    unsigned int i;
+    for (i = 0; i < count; i ++) {
+      if (strcasecmp(name, names[i]) == 0) break;
+    }
+    if (i == count) {
+      bits = 0;
+      break;
+    }
+    bits |= 1 << i;
+  }
+  free(copy);
+
+  return bits;
+}
+
+size_t batchReps(size_t batch, size_t size) {
+  size_t reps = batch / size;
+  return reps ? reps : 1;
+}
+
+void xorshiftFill(unsigned char *buffer, size_t size) {
+  uint64_t x = 88172645463325252ULL;
+  for (size_t i = 0; i < size; i ++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    buffer[i] = (unsigned char)x;
+  }
+}
+
+/* Time stamp counter rate, calibrated against the wall clock for 100ms.
+   Returns 0 where there is no usable cycle counter. */
+double cpuCyclesPerSecond() {
+#if defined(__x86_64__) || defined(__i386__)
+  struct timeval start, now, diff;
+
+  gettimeofday(&start, NULL);
+  uint64_t begin = __rdtsc();
+  do {
+    gettimeofday(&now, NULL);
+    timevalSubtract(&diff, &now, &start);
+  } while (timevalToUsec(&diff) < 100000);
+  uint64_t end = __rdtsc();
+
+  return (double)(end - begin) / (double)timevalToUsec(&diff) * 1000000.0;
+#else
+  return 0;
+#endif
+}
@@ -19,4 +19,24 @@ unsigned long timevalToUsec(const struct timeval *x);
 
 uintmax_t parseHumanSize (const char* s);
 
+/* The suite builds without optimization, which would leave hand written
+   kernels measuring instruction overhead next to optimized libraries,
+   so the kernels alone are optimized. */
+#define kernelFunction __attribute__((optimize("O3"), noinline))
+
+/* Repetitions of a size byte operation that make up batch bytes per
+   harness call, at least one, so small sizes are not all harness
+   overhead. */
+size_t batchReps(size_t batch, size_t size);
+
+/* Parse a comma separated list against names, ignoring case, returning
+   bit i for names[i]; 0 on an unknown name. */
+unsigned int parseNameList(const char *list, const char **names,
+                           unsigned int count);
+
+/* Fills buffer with a fixed xorshift64 sequence, the same every run. */
+void xorshiftFill(unsigned char *buffer, size_t size);
+
+double cpuCyclesPerSecond();
+
 #endif
\ No newline at end of file
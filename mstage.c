@@ -0,0 +1,53 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <openssl/evp.h>
+
+#include "mstage.h"
+
+MSETTINGS mSettings = {NULL, 0};
+
+CONTENTS *mdContent(const CONTENTS *data) {
+#if OPENSSL_VERSION_NUMBER < 0x010100000L
+    EVP_MD_CTX mdctx;
+#endif
+    EVP_MD_CTX *ctx;
+    CONTENTS *mdResult = NULL;
+    int i = 0;
+
+    mdResult = calloc(1, sizeof(CONTENTS));
+    assert(mdResult);
+    mdResult->body = malloc(EVP_MAX_MD_SIZE);
+    assert(mdResult->body);
+
+    unsigned int md_len;
+
+#if OPENSSL_VERSION_NUMBER < 0x010100000L
+    EVP_MD_CTX_init(&mdctx);
+    ctx = &mdctx;
+#else
+    ctx = EVP_MD_CTX_new();
+#endif
+
+    i = EVP_DigestInit_ex(ctx, mSettings.md, NULL);
+    assert(i==1);
+
+    size_t chunk = mSettings.chunkSize ? mSettings.chunkSize : data->size;
+    for (size_t offset = 0; offset < data->size; offset += chunk) {
+        size_t length = data->size - offset < chunk ?
+                        data->size - offset : chunk;
+        i = EVP_DigestUpdate(ctx, data->body + offset, length);
+        assert(i==1);
+    }
+
+    i = EVP_DigestFinal_ex(ctx, mdResult->body, &md_len);
+    assert(i==1);
+    mdResult->size = md_len;
+
+#if OPENSSL_VERSION_NUMBER < 0x010100000L
+    EVP_MD_CTX_cleanup(&mdctx);
+#else
+    EVP_MD_CTX_free(ctx);
+#endif
+
+    return mdResult;
+}
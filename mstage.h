@@ -0,0 +1,23 @@
+#ifndef __REALITY_MSTAGE_H
+#define __REALITY_MSTAGE_H
+
+#include <stdlib.h>
+#include <openssl/evp.h>
+
+#include "contents.h"
+
+/* The digest the stage below runs, and the bytes per update, as an
+   upload hashed while it streams in would feed them. A chunkSize of 0
+   updates with the whole input at once. */
+struct m_settings {
+  const EVP_MD *md;
+  size_t chunkSize;
+};
+typedef struct m_settings MSETTINGS;
+
+extern MSETTINGS mSettings;
+
+/* Harness stage: the digest of the data. */
+CONTENTS *mdContent(const CONTENTS *data);
+
+#endif
@@ -0,0 +1,692 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+
+#include "contents.h"
+#include "benchmark.h"
+#include "misc.h"
+#include "latency.h"
+#include "document.h"
+#include "transform.h"
+
+#define pathWrite    (1 << 0)
+#define pathWritev   (1 << 1)
+#define pathSendfile (1 << 2)
+#define pathSplice   (1 << 3)
+
+#define modeEcho 0
+#define modeSink 1
+
+/* Every message is a header of its body length and sequence number
+   followed by the body, as a framed protocol would send it. */
+#define headerSize 16
+
+#define serverBuffer (256 << 10)
+#define serverEvents 64
+
+static const char *pathNames[] = {"write", "writev", "sendfile", "splice"};
+
+static int unixSocket = 0;
+static int mode = modeEcho;
+static unsigned int path = pathWrite;
+static const TRANSFORM *transform = NULL;
+static const TRANSFORM *untransform = NULL;
+
+static struct sockaddr_storage address;
+static socklen_t addressLength = 0;
+static char unixPath[64];
+
+static LATENCY *latency = NULL;
+/* Client threads add what they counted once, as they exit. */
+static unsigned long clientSyscalls = 0;
+
+/* Syscalls are counted by the thread making them: the server thread in
+   its SERVER and each client thread in its CLIENT. */
+#define serverCounted(call) (s->syscalls ++, (call))
+#define clientCounted(call) (c->syscalls ++, (call))
+
+/* Server side of one connection. Echo keeps what it could not write
+   yet, in buffer or in the pipe when splicing, and stops reading until
+   it is flushed. */
+struct n_connection {
+  int fd;
+  int pipe[2];
+  unsigned char *buffer;
+  size_t offset;
+  size_t pending;
+};
+typedef struct n_connection CONNECTION;
+
+struct n_server {
+  int listenFd;
+  int epollFd;
+  int stopFd[2];
+  int nullFd;
+  pthread_t thread;
+  unsigned long syscalls;
+};
+typedef struct n_server SERVER;
+
+static void connectionFree(CONNECTION *c) {
+  close(c->fd);
+  if (c->pipe[0] >= 0) {
+    close(c->pipe[0]);
+    close(c->pipe[1]);
+  }
+  free(c->buffer);
+  free(c);
+}
+
+static void serverWatch(SERVER *s, CONNECTION *c, unsigned int events) {
+  struct epoll_event event;
+  event.events = events;
+  event.data.ptr = c;
+  serverCounted(epoll_ctl(s->epollFd, EPOLL_CTL_MOD, c->fd, &event));
+}
+
+/* Flushes what echo holds; returns 0 when the connection is done. */
+static int serverFlush(SERVER *s, CONNECTION *c) {
+  while (c->pending) {
+    ssize_t n;
+    if (c->pipe[0] >= 0) {
+      n = serverCounted(splice(c->pipe[0], NULL, c->fd, NULL, c->pending,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+    } else {
+      n = serverCounted(write(c->fd, c->buffer + c->offset, c->pending));
+    }
+    if (n < 0 && errno == EAGAIN) {
+      serverWatch(s, c, EPOLLOUT);
+      return 1;
+    }
+    if (n <= 0) return 0;
+    c->offset += n;
+    c->pending -= n;
+  }
+  c->offset = 0;
+
+  return 1;
+}
+
+static int serverRead(SERVER *s, CONNECTION *c) {
+  ssize_t n;
+
+  if (c->pipe[0] >= 0) {
+    n = serverCounted(splice(c->fd, NULL, c->pipe[1], NULL, serverBuffer,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+    if (n > 0 && mode == modeSink) {
+      ssize_t drained = serverCounted(splice(c->pipe[0], NULL, s->nullFd, NULL, n,
+                                             SPLICE_F_MOVE));
+      return drained == n;
+    }
+  } else {
+    n = serverCounted(read(c->fd, c->buffer, serverBuffer));
+  }
+  if (n < 0 && errno == EAGAIN) return 1;
+  if (n <= 0) return 0;
+  if (mode == modeSink) return 1;
+
+  c->pending = n;
+  return serverFlush(s, c);
+}
+
+static void *serverThread(void *arg) {
+  SERVER *s = (SERVER *)arg;
+  struct epoll_event events[serverEvents];
+
+  for (;;) {
+    int n = serverCounted(epoll_wait(s->epollFd, events, serverEvents, -1));
+    if (n < 0 && errno == EINTR) continue;
+    assert(n >= 0);
+
+    for (int i = 0; i < n; i ++) {
+      if (events[i].data.ptr == NULL) {
+        int fd;
+        while ((fd = serverCounted(accept4(s->listenFd, NULL, NULL,
+                                           SOCK_NONBLOCK))) >= 0) {
+          CONNECTION *c = calloc(1, sizeof(CONNECTION));
+          assert(c);
+          c->fd = fd;
+          c->pipe[0] = c->pipe[1] = -1;
+          if (path == pathSplice) {
+            int ok = pipe2(c->pipe, O_NONBLOCK) == 0;
+            assert(ok);
+            fcntl(c->pipe[0], F_SETPIPE_SZ, serverBuffer);
+          } else {
+            c->buffer = malloc(serverBuffer);
+            assert(c->buffer);
+          }
+
+          struct epoll_event event;
+          event.events = EPOLLIN;
+          event.data.ptr = c;
+          serverCounted(epoll_ctl(s->epollFd, EPOLL_CTL_ADD, fd, &event));
+        }
+        continue;
+      }
+      if (events[i].data.ptr == s) {
+        return NULL;
+      }
+
+      CONNECTION *c = (CONNECTION *)events[i].data.ptr;
+      int alive;
+      if (c->pending) {
+        alive = serverFlush(s, c);
+        if (alive && !c->pending) serverWatch(s, c, EPOLLIN);
+      } else {
+        alive = serverRead(s, c);
+      }
+      if (!alive) {
+        serverCounted(epoll_ctl(s->epollFd, EPOLL_CTL_DEL, c->fd, NULL));
+        connectionFree(c);
+      }
+    }
+  }
+}
+
+/* Listens on an ephemeral loopback port or a Unix socket and serves
+   every connection from one epoll thread. Connections still open when
+   it stops are left to process exit. */
+static SERVER *serverStart() {
+  SERVER *s = calloc(1, sizeof(SERVER));
+  assert(s);
+
+  memset(&address, 0, sizeof(address));
+  if (unixSocket) {
+    struct sockaddr_un *un = (struct sockaddr_un *)&address;
+    un->sun_family = AF_UNIX;
+    snprintf(unixPath, sizeof(unixPath), "/tmp/net_bench.%d.sock", (int)getpid());
+    unlink(unixPath);
+    strcpy(un->sun_path, unixPath);
+    addressLength = sizeof(struct sockaddr_un);
+    s->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  } else {
+    struct sockaddr_in *in = (struct sockaddr_in *)&address;
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    in->sin_port = 0;
+    addressLength = sizeof(struct sockaddr_in);
+    s->listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  }
+  assert(s->listenFd >= 0);
+
+  int i = bind(s->listenFd, (struct sockaddr *)&address, addressLength);
+  assert(i == 0);
+  i = getsockname(s->listenFd, (struct sockaddr *)&address, &addressLength);
+  assert(i == 0);
+  i = listen(s->listenFd, 1024);
+  assert(i == 0);
+
+  s->nullFd = open("/dev/null", O_WRONLY);
+  assert(s->nullFd >= 0);
+  i = pipe(s->stopFd);
+  assert(i == 0);
+
+  s->epollFd = epoll_create1(0);
+  assert(s->epollFd >= 0);
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  epoll_ctl(s->epollFd, EPOLL_CTL_ADD, s->listenFd, &event);
+  event.data.ptr = s;
+  epoll_ctl(s->epollFd, EPOLL_CTL_ADD, s->stopFd[0], &event);
+
+  pthread_create(&s->thread, NULL, serverThread, s);
+
+  return s;
+}
+
+/* Returns the syscalls the server thread made. */
+static unsigned long serverStop(SERVER *s) {
+  ssize_t n = write(s->stopFd[1], "", 1);
+  assert(n == 1);
+  pthread_join(s->thread, NULL);
+
+  close(s->epollFd);
+  close(s->listenFd);
+  close(s->stopFd[0]);
+  close(s->stopFd[1]);
+  close(s->nullFd);
+  if (unixSocket) unlink(unixPath);
+  unsigned long syscalls = s->syscalls;
+  free(s);
+
+  return syscalls;
+}
+
+/* Client side, one per worker thread: the socket, the message buffer
+   write copies header and body into, a memfd holding the body for
+   sendfile and splice, and a pipe for splice. */
+struct n_client {
+  int fd;
+  int file;
+  int pipe[2];
+  size_t piped;
+  unsigned char *buffer;
+  size_t bufferSize;
+  unsigned char *received;
+  size_t receivedSize;
+  uint64_t sequence;
+  unsigned long syscalls;
+};
+typedef struct n_client CLIENT;
+
+static pthread_key_t clientKey;
+
+static void clientDestroy(void *arg) {
+  CLIENT *c = (CLIENT *)arg;
+  __atomic_add_fetch(&clientSyscalls, c->syscalls, __ATOMIC_RELAXED);
+  close(c->fd);
+  if (c->file >= 0) close(c->file);
+  if (c->pipe[0] >= 0) {
+    close(c->pipe[0]);
+    close(c->pipe[1]);
+  }
+  free(c->buffer);
+  free(c->received);
+  free(c);
+}
+
+static CLIENT *threadClient() {
+  CLIENT *c = (CLIENT *)pthread_getspecific(clientKey);
+  if (c) return c;
+
+  c = calloc(1, sizeof(CLIENT));
+  assert(c);
+  c->fd = socket(address.ss_family, SOCK_STREAM, 0);
+  assert(c->fd >= 0);
+  int i = connect(c->fd, (struct sockaddr *)&address, addressLength);
+  assert(i == 0);
+  if (!unixSocket) {
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  fcntl(c->fd, F_SETFL, O_NONBLOCK);
+
+  c->file = c->pipe[0] = c->pipe[1] = -1;
+  if (path == pathSendfile || path == pathSplice) {
+    c->file = memfd_create("net_bench", 0);
+    assert(c->file >= 0);
+  }
+  if (path == pathSplice) {
+    i = pipe(c->pipe);
+    assert(i == 0);
+    fcntl(c->pipe[0], F_SETPIPE_SZ, serverBuffer);
+  }
+
+  pthread_setspecific(clientKey, c);
+
+  return c;
+}
+
+/* Sends from offset sent of header and body by the selected path;
+   returns what went out, 0 if the socket is full, -1 on error. */
+static ssize_t clientSend(CLIENT *c, const unsigned char *header,
+                          const CONTENTS *body, size_t sent, off_t *fileOffset) {
+  size_t total = headerSize + body->size;
+  ssize_t n;
+
+  if (path == pathWrite) {
+    n = clientCounted(write(c->fd, c->buffer + sent, total - sent));
+  } else if (path == pathWritev || sent < headerSize) {
+    struct iovec iov[2];
+    int count = 0;
+    if (sent < headerSize) {
+      iov[count].iov_base = (void *)(header + sent);
+      iov[count ++].iov_len = headerSize - sent;
+    }
+    if (path == pathWritev) {
+      size_t bodySent = sent < headerSize ? 0 : sent - headerSize;
+      iov[count].iov_base = body->body + bodySent;
+      iov[count ++].iov_len = body->size - bodySent;
+      n = clientCounted(writev(c->fd, iov, count));
+    } else {
+      n = clientCounted(send(c->fd, iov[0].iov_base, iov[0].iov_len, MSG_MORE));
+    }
+  } else if (path == pathSendfile) {
+    n = clientCounted(sendfile(c->fd, c->file, fileOffset, body->size - *fileOffset));
+  } else {
+    if (c->piped == 0) {
+      n = clientCounted(splice(c->file, fileOffset, c->pipe[1], NULL,
+                               body->size - *fileOffset, SPLICE_F_MOVE));
+      if (n <= 0) return -1;
+      c->piped = n;
+    }
+    n = clientCounted(splice(c->pipe[0], NULL, c->fd, NULL, c->piped,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+    if (n > 0) c->piped -= n;
+  }
+
+  if (n < 0 && errno == EAGAIN) return 0;
+  return n;
+}
+
+/* One message: transform the payload, send header and body, and in echo
+   mode read it all back and undo the transform. Sending and receiving
+   interleave so large echoes never fill both directions. */
+static CONTENTS* messageContent(const CONTENTS* data) {
+  CLIENT *c = threadClient();
+  unsigned long start = latencyNow();
+
+  CONTENTS *body = transform ? transform->run(data) : (CONTENTS *)data;
+  if (!body) return NULL;
+
+  size_t total = headerSize + body->size;
+  unsigned char header[headerSize];
+  uint64_t fields[2] = {body->size, c->sequence ++};
+  memcpy(header, fields, headerSize);
+
+  if (path == pathWrite) {
+    if (c->bufferSize < total) {
+      c->buffer = realloc(c->buffer, total);
+      assert(c->buffer);
+      c->bufferSize = total;
+    }
+    memcpy(c->buffer, header, headerSize);
+    memcpy(c->buffer + headerSize, body->body, body->size);
+  } else if (c->file >= 0 && (transform || c->sequence == 1)) {
+    ssize_t n = clientCounted(pwrite(c->file, body->body, body->size, 0));
+    assert(n == (ssize_t)body->size);
+  }
+
+  size_t expected = mode == modeEcho ? total : 0;
+  if (c->receivedSize < expected) {
+    c->received = realloc(c->received, expected);
+    assert(c->received);
+    c->receivedSize = expected;
+  }
+
+  size_t sent = 0;
+  size_t received = 0;
+  off_t fileOffset = 0;
+  int ok = 1;
+  while (ok && (sent < total || received < expected)) {
+    int progress = 0;
+    if (sent < total) {
+      ssize_t n = clientSend(c, header, body, sent, &fileOffset);
+      if (n < 0) ok = 0;
+      if (n > 0) {
+        sent += n;
+        progress = 1;
+      }
+    }
+    if (ok && received < expected) {
+      ssize_t n = clientCounted(read(c->fd, c->received + received, expected - received));
+      if (n == 0 || (n < 0 && errno != EAGAIN)) ok = 0;
+      if (n > 0) {
+        received += n;
+        progress = 1;
+      }
+    }
+    if (ok && !progress) {
+      struct pollfd p;
+      p.fd = c->fd;
+      p.events = (sent < total ? POLLOUT : 0) | (received < expected ? POLLIN : 0);
+      clientCounted(poll(&p, 1, -1));
+    }
+  }
+
+  if (body != data) {
+    destroyContents(body);
+    free(body);
+  }
+
+  CONTENTS *result = NULL;
+  if (ok && mode == modeEcho) {
+    CONTENTS echoed;
+    memset(&echoed, 0, sizeof(echoed));
+    echoed.body = c->received + headerSize;
+    echoed.size = total - headerSize;
+    echoed.borrowed = 1;
+    result = untransform ? untransform->run(&echoed) : cloneContents(&echoed);
+  } else if (ok) {
+    result = calloc(1, sizeof(CONTENTS));
+    assert(result);
+    result->body = malloc(1);
+    assert(result->body);
+    result->body[0] = 1;
+    result->size = 1;
+  }
+
+  latencyAdd(latency, latencyNow() - start);
+
+  return result;
+}
+
+static cJSON *pathJSON(unsigned int p, unsigned int threads,
+                       struct timeval *timeout, const CONTENTS *payload,
+                       int verbose) {
+  path = p;
+  latencyReset(latency);
+
+  CONTENTS *reference = NULL;
+  if (mode == modeEcho) {
+    reference = cloneContents((CONTENTS *)payload);
+  } else {
+    reference = calloc(1, sizeof(CONTENTS));
+    assert(reference);
+    reference->body = malloc(1);
+    assert(reference->body);
+    reference->body[0] = 1;
+    reference->size = 1;
+  }
+
+  SERVER *s = serverStart();
+  pthread_key_create(&clientKey, clientDestroy);
+  clientSyscalls = 0;
+
+  TEST *t = testNew();
+  testSetThreads(t, threads);
+  testSetTimeout(t, timeout);
+  testAddRun(t, &messageContent);
+  testSetInput(t, payload);
+  testSetTesting(t, reference);
+
+  RESULT *r = testRun(t);
+  assert(r);
+
+  testDestory(t);
+  unsigned long serverSyscalls = serverStop(s);
+  pthread_key_delete(clientKey);
+
+  double interval = resultAvgIntervalByRun(r, 0);
+  unsigned long messages = resultTotalLoops(r);
+  size_t wire = headerSize + payload->size;
+  if (transform) {
+    CONTENTS *body = transform->run(payload);
+    assert(body);
+    wire = headerSize + body->size;
+    destroyContents(body);
+    free(body);
+  }
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddStringToObject(json, "path", pathNames[__builtin_ctz(p)]);
+  cJSON_AddStringToObject(json, "serverPath", p == pathSplice ? "splice" : "read/write");
+  cJSON_AddNumberToObject(json, "messagesPerSec",
+                          1000000.0 / interval * resultThreads(r));
+  cJSON_AddNumberToObject(json, "Gbps",
+                          wire * 8 / interval * 1000000 / 1e9 * resultThreads(r));
+  cJSON_AddNumberToObject(json, "clientSyscallsPerMessage",
+                          messages ? (double)clientSyscalls / messages : 0);
+  cJSON_AddNumberToObject(json, "serverSyscallsPerMessage",
+                          messages ? (double)serverSyscalls / messages : 0);
+  cJSON_AddItemToObject(json, "latency", latencyToJSON(latency));
+  cJSON_AddBoolToObject(json, "correct", isResultCorrect(r));
+  if (verbose) {
+    cJSON_AddItemToObject(json, "result", resultJSON(r, 0));
+  }
+
+  resultDestory(r);
+  destroyContents(reference);
+  free(reference);
+
+  return json;
+}
+
+static void printUsage() {
+  fprintf(stderr,
+          "Usage: net_bench \n"
+          "[-r seconds <seconds, default is 3>]\n"
+          "[-t threads <client threads, default is logic cpu cores>]\n"
+          "[-p <paths>, comma separated write, writev, sendfile or splice, default is all]\n"
+          "[-m <server mode>, should be echo or sink, default is echo]\n"
+          "[-U <unix socket instead of loopback tcp>]\n"
+          "[-T <per message transform>, should be aes-gcm or deflate]\n"
+          "[-v <verbose json output>] [-f <formated json output>]\n"
+          "[-u size <message size, default is 16K, size can use K, M, G>]\n");
+}
+
+int main(int argc, char **argv) {
+  int ret = -1;
+  CONTENTS *contents = NULL;
+
+  struct timeval timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 0;
+  unsigned int threads = 0;
+  int verbose = 0;
+  int formated = 0;
+  size_t messageSize = 16 << 10;
+  unsigned int paths = pathWrite | pathWritev | pathSendfile | pathSplice;
+  const char *transformName = NULL;
+
+  int c;
+  opterr = 0;
+
+  while ((c = getopt(argc, argv, "r:t:p:m:UT:vfu:")) != -1) {
+    switch (c) {
+    case 'r':
+      timeout.tv_sec = atoi(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'p':
+      paths = parseNameList(optarg, pathNames,
+                            sizeof(pathNames) / sizeof(pathNames[0]));
+      if (!paths) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'm':
+      if (strcmp(optarg, "echo") == 0) {
+        mode = modeEcho;
+      } else if (strcmp(optarg, "sink") == 0) {
+        mode = modeSink;
+      } else {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'U':
+      unixSocket = 1;
+      break;
+    case 'T':
+      transformName = optarg;
+      if (strcmp(optarg, "aes-gcm") == 0) {
+        transform = transformByName("seal");
+        untransform = transformByName("open");
+      } else if (strcmp(optarg, "deflate") == 0) {
+        transform = transformByName("deflate");
+        untransform = transformByName("inflate");
+      } else {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'u':
+      messageSize = parseHumanSize(optarg);
+      if (messageSize == 0) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'f':
+      formated = 1;
+      break;
+    case '?':
+      printUsage();
+      goto END;
+    }
+  }
+
+  if (timeout.tv_sec == 0) {
+    timeout.tv_sec = 3;
+  }
+
+  if (threads == 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads == 0)
+      threads = 2;
+  }
+
+  transformInit(Z_DEFAULT_COMPRESSION);
+
+  /* Compressible text when deflating, random bytes otherwise. */
+  if (transform && strcmp(transform->name, "deflate") == 0) {
+    contents = documentGenerate(messageSize, 3, 4, 50);
+    contents->size = messageSize;
+  } else {
+    contents = randomContents(messageSize);
+  }
+
+  latency = latencyNew();
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddNumberToObject(json, "threads", threads);
+  cJSON_AddStringToObject(json, "socket", unixSocket ? "unix" : "tcp");
+  cJSON_AddStringToObject(json, "mode", mode == modeEcho ? "echo" : "sink");
+  cJSON_AddNumberToObject(json, "messageSize", messageSize);
+  if (transformName) {
+    cJSON_AddStringToObject(json, "transform", transformName);
+  }
+
+  cJSON *pathsJSON = cJSON_CreateArray();
+  assert(pathsJSON);
+  for (unsigned int p = pathWrite; p <= pathSplice; p <<= 1) {
+    if (!(paths & p)) continue;
+    cJSON_AddItemToArray(pathsJSON,
+                         pathJSON(p, threads, &timeout, contents, verbose));
+  }
+  cJSON_AddItemToObject(json, "paths", pathsJSON);
+
+  printJSON(json, formated);
+
+  cJSON_Delete(json);
+
+  latencyDestroy(latency);
+
+  ret = 0;
+
+END:
+  if (contents) {
+    destroyContents(contents);
+    free(contents);
+    contents = NULL;
+  }
+  return ret;
+}
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "parallel.h"
+
+struct p_job {
+  parallelTask task;
+  void *arg;
+  size_t count;
+  size_t next;
+  /* Pool threads allowed on the job, and those working on it. */
+  unsigned int wanted;
+  unsigned int helpers;
+  struct p_job *nextJob;
+};
+typedef struct p_job JOB;
+
+/* Pool threads live for the whole process, so a parallelFor inside a
+   timed stage pays for a wake up rather than a thread spawn. Every
+   call reserves the threads it wants, growing the pool when all are
+   reserved, so concurrent callers each get their worker count. */
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolWork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t poolDone = PTHREAD_COND_INITIALIZER;
+static JOB *poolJobs = NULL;
+static unsigned int poolFree = 0;
+
+static void jobRun(JOB *job) {
+  for (;;) {
+    size_t index = __atomic_fetch_add(&(job->next), 1, __ATOMIC_RELAXED);
+    if (index >= job->count) break;
+
+    job->task(index, job->arg);
+  }
+}
+
+static JOB *poolJob() {
+  for (JOB *job = poolJobs; job; job = job->nextJob) {
+    if (job->helpers < job->wanted) return job;
+  }
+  return NULL;
+}
+
+static void *poolThread(void *arg) {
+  (void)arg;
+
+  pthread_mutex_lock(&poolLock);
+  for (;;) {
+    JOB *job = poolJob();
+    if (!job) {
+      pthread_cond_wait(&poolWork, &poolLock);
+      continue;
+    }
+
+    job->helpers ++;
+    pthread_mutex_unlock(&poolLock);
+
+    jobRun(job);
+
+    pthread_mutex_lock(&poolLock);
+    job->helpers --;
+    if (job->helpers == 0) {
+      pthread_cond_broadcast(&poolDone);
+    }
+  }
+
+  return NULL;
+}
+
+void parallelFor(unsigned int workers, size_t count, parallelTask task,
+                 void *arg) {
+  assert(task);
+
+  JOB job;
+  job.task = task;
+  job.arg = arg;
+  job.count = count;
+  job.next = 0;
+  job.helpers = 0;
+
+  if (workers > count) workers = count;
+  if (workers <= 1) {
+    jobRun(&job);
+    return;
+  }
+  job.wanted = workers - 1;
+
+  pthread_mutex_lock(&poolLock);
+  while (poolFree < job.wanted) {
+    pthread_t pid;
+    int i = pthread_create(&pid, NULL, poolThread, NULL);
+    assert(i == 0);
+    pthread_detach(pid);
+    poolFree ++;
+  }
+  poolFree -= job.wanted;
+
+  job.nextJob = poolJobs;
+  poolJobs = &job;
+  pthread_cond_broadcast(&poolWork);
+  pthread_mutex_unlock(&poolLock);
+
+  jobRun(&job);
+
+  /* Every index is taken; wait for the helpers still running one. */
+  pthread_mutex_lock(&poolLock);
+  for (JOB **p = &poolJobs; *p; p = &(*p)->nextJob) {
+    if (*p == &job) {
+      *p = job.nextJob;
+      break;
+    }
+  }
+  while (job.helpers > 0) {
+    pthread_cond_wait(&poolDone, &poolLock);
+  }
+  poolFree += job.wanted;
+  pthread_mutex_unlock(&poolLock);
+}
+
+unsigned int parallelNextWorkers(unsigned int workers, unsigned int max) {
+  if (workers >= max) return 0;
+  if (workers * 2 > max) return max;
+  return workers * 2;
+}
@@ -0,0 +1,19 @@
+#ifndef __REALITY_PARALLEL_H
+#define __REALITY_PARALLEL_H
+
+#include <stdlib.h>
+
+typedef void (*parallelTask)(size_t index, void *arg);
+
+/* Run task(0..count-1, arg) on workers threads, the caller included.
+   Indices are handed out dynamically so uneven tasks balance out. The
+   other threads come from a pool kept for the process, created on
+   first use. Safe to call from several threads at once. */
+void parallelFor(unsigned int workers, size_t count, parallelTask task,
+                 void *arg);
+
+/* Step through 1, 2, 4, ... max worker counts for speedup sweeps,
+   returning 0 after max. */
+unsigned int parallelNextWorkers(unsigned int workers, unsigned int max);
+
+#endif
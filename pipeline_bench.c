@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "contents.h"
+#include "benchmark.h"
+#include "misc.h"
+#include "latency.h"
+#include "document.h"
+#include "transform.h"
+#include "external/cJSON.h"
+
+static const char *defaultChain = "json,deflate,seal,tag,check,open,inflate,json";
+
+static int level = Z_DEFAULT_COMPRESSION;
+
+#define chainMax 32
+
+static const TRANSFORM *chain[chainMax];
+static unsigned int chainLength = 0;
+
+static int chainParse(const char *list) {
+  char *copy = strdup(list);
+  assert(copy);
+
+  chainLength = 0;
+  char *save = NULL;
+  for (char *name = strtok_r(copy, ",", &save); name;
+       name = strtok_r(NULL, ",", &save)) {
+    const TRANSFORM *t = transformByName(name);
+    if (!t || chainLength == chainMax) {
+      chainLength = 0;
+      break;
+    }
+    chain[chainLength ++] = t;
+  }
+  free(copy);
+
+  return chainLength > 0;
+}
+
+static RESULT *runTest(const TRANSFORM **runs, unsigned int count,
+                       unsigned int threads, struct timeval *timeout,
+                       const CONTENTS *input, const CONTENTS *reference) {
+  TEST *t = testNew();
+  testSetThreads(t, threads);
+  testSetTimeout(t, timeout);
+
+  for (unsigned int i = 0; i < count; i ++) {
+    testAddRun(t, runs[i]->run);
+  }
+  testSetInput(t, input);
+  testSetTesting(t, reference);
+
+  RESULT *r = testRun(t);
+  assert(r);
+
+  testDestory(t);
+
+  return r;
+}
+
+/* End to end latency of every request, summed from its stage intervals. */
+static cJSON *requestLatencyJSON(const RESULT *r) {
+  LATENCY *latency = latencyNew();
+
+  for (const RESULT *re = r; re; re = re->next) {
+    for (const LOOP *l = re->loops; l; l = l->next) {
+      unsigned long usec = 0;
+      for (const RUN *run = l->runs; run; run = run->next) {
+        usec += run->interval.tv_sec * 1000000 + run->interval.tv_usec;
+      }
+      latencyAdd(latency, usec * 1000);
+    }
+  }
+
+  cJSON *json = latencyToJSON(latency);
+  latencyDestroy(latency);
+
+  return json;
+}
+
+/* Each stage's share of the chain, and its time in the chain against
+   running alone on its own input. Interference above 1 means the other
+   stages slow it down, through evicted caches or shared cores. */
+static cJSON *pipelineJSON(unsigned int threads, struct timeval *timeout,
+                           CONTENTS **inputs, int verbose) {
+  RESULT *r = runTest(chain, chainLength, threads, timeout,
+                      inputs[0], inputs[chainLength]);
+
+  double total = 0;
+  for (unsigned int i = 0; i < chainLength; i ++) {
+    total += resultAvgIntervalByRun(r, i);
+  }
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddBoolToObject(json, "correct", isResultCorrect(r));
+
+  cJSON *request = cJSON_CreateObject();
+  assert(request);
+  cJSON_AddNumberToObject(request, "usPerRequest", total);
+  cJSON_AddNumberToObject(request, "requestsPerSec",
+                          1000000.0 / total * resultThreads(r));
+  cJSON_AddItemToObject(request, "latency", requestLatencyJSON(r));
+  cJSON_AddItemToObject(json, "request", request);
+
+  cJSON *stagesJSON = cJSON_CreateArray();
+  assert(stagesJSON);
+  for (unsigned int i = 0; i < chainLength; i ++) {
+    double interval = resultAvgIntervalByRun(r, i);
+
+    RESULT *alone = runTest(&chain[i], 1, threads, timeout,
+                            inputs[i], inputs[i + 1]);
+    double isolated = resultAvgIntervalByRun(alone, 0);
+
+    cJSON *stage = cJSON_CreateObject();
+    assert(stage);
+    cJSON_AddStringToObject(stage, "stage", chain[i]->name);
+    cJSON_AddNumberToObject(stage, "inputBytes", inputs[i]->size);
+    cJSON_AddNumberToObject(stage, "outputBytes", inputs[i + 1]->size);
+    cJSON_AddNumberToObject(stage, "usPerCall", interval);
+    cJSON_AddNumberToObject(stage, "share", interval / total);
+    cJSON_AddNumberToObject(stage, "MBps",
+                            inputs[i]->size / interval * 1000000 / (1 << 20) *
+                            resultThreads(r));
+    cJSON_AddNumberToObject(stage, "isolatedUsPerCall", isolated);
+    cJSON_AddNumberToObject(stage, "interference", interval / isolated);
+    cJSON_AddBoolToObject(stage, "isolatedCorrect", isResultCorrect(alone));
+    cJSON_AddItemToArray(stagesJSON, stage);
+
+    resultDestory(alone);
+  }
+  cJSON_AddItemToObject(json, "stages", stagesJSON);
+
+  if (verbose) {
+    cJSON_AddItemToObject(json, "result", resultJSON(r, 0));
+  }
+
+  resultDestory(r);
+
+  return json;
+}
+
+static void printUsage() {
+  fprintf(stderr,
+          "Usage: pipeline_bench \n"
+          "[-r seconds <seconds, default is 3>]\n"
+          "[-t threads <threads, default is logic cpu cores>]\n"
+          "[-c <chain>, comma separated json, deflate, inflate, seal, open, tag or check, default is json,deflate,seal,tag,check,open,inflate,json]\n"
+          "[-l level <compression level, default is zlib default>]\n"
+          "[-d depth <record nesting of generated documents, default is 3>]\n"
+          "[-w width <array width of generated documents, default is 4>]\n"
+          "[-s percent <share of generated leaves that are strings, default is 50>]\n"
+          "[-v <verbose json output>] [-f <formated json output>]\n"
+          "-u size <generate API-shaped documents of about size, size can use K, M, G>|file|url\n");
+}
+
+int main(int argc, char **argv) {
+  int ret = -1;
+  CONTENTS *inputs[chainMax + 1];
+  unsigned int made = 0;
+
+  struct timeval timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 0;
+  unsigned int threads = 0;
+  int verbose = 0;
+  int formated = 0;
+  size_t randomSize = 0;
+  unsigned int depth = 3;
+  unsigned int width = 4;
+  unsigned int stringPercent = 50;
+
+  int index;
+  int c;
+  opterr = 0;
+
+  chainParse(defaultChain);
+
+  while ((c = getopt(argc, argv, "r:t:c:l:d:w:s:vfu:")) != -1) {
+    switch (c) {
+    case 'r':
+      timeout.tv_sec = atoi(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'c':
+      if (!chainParse(optarg)) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'l':
+      level = atoi(optarg);
+      if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'd':
+      depth = atoi(optarg);
+      break;
+    case 'w':
+      width = atoi(optarg);
+      break;
+    case 's':
+      stringPercent = atoi(optarg);
+      if (stringPercent > 100) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'u':
+      randomSize = parseHumanSize(optarg);
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'f':
+      formated = 1;
+      break;
+    case '?':
+      printUsage();
+      goto END;
+    }
+  }
+
+  if (timeout.tv_sec == 0) {
+    timeout.tv_sec = 3;
+  }
+
+  if (threads == 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads == 0)
+      threads = 2;
+  }
+
+  if (depth == 0) {
+    printUsage();
+    goto END;
+  }
+
+  if (randomSize) {
+    inputs[0] = documentGenerate(randomSize, depth, width, stringPercent);
+  } else {
+    index = optind;
+    if (index >= argc) {
+      printUsage();
+      goto END;
+    }
+
+    inputs[0] = getContents(argv[index]);
+
+    if (inputs[0] == NULL) {
+      fprintf(stderr, "Get content error\n");
+      goto END;
+    } else if (inputs[0]->size == 0) {
+      fprintf(stderr, "Empty content to process\n");
+      made = 1;
+      goto END;
+    }
+
+    inputs[0]->body = realloc(inputs[0]->body, inputs[0]->size + 1);
+    assert(inputs[0]->body);
+    inputs[0]->body[inputs[0]->size] = '\0';
+  }
+  made = 1;
+
+  transformInit(level);
+
+  /* One single threaded pass keeps every stage's input for the isolated
+     runs, and the chain's output as the reference. */
+  for (; made <= chainLength; made ++) {
+    inputs[made] = chain[made - 1]->run(inputs[made - 1]);
+    if (!inputs[made]) {
+      fprintf(stderr, "Stage %s cannot process its input\n",
+              chain[made - 1]->name);
+      goto END;
+    }
+  }
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddNumberToObject(json, "threads", threads);
+  cJSON_AddNumberToObject(json, "payload", inputs[0]->size);
+  if (randomSize) {
+    cJSON *documentJSON = cJSON_CreateObject();
+    assert(documentJSON);
+    cJSON_AddNumberToObject(documentJSON, "depth", depth);
+    cJSON_AddNumberToObject(documentJSON, "width", width);
+    cJSON_AddNumberToObject(documentJSON, "stringPercent", stringPercent);
+    cJSON_AddItemToObject(json, "document", documentJSON);
+  }
+  cJSON_AddNumberToObject(json, "level", level);
+
+  cJSON *chainJSON = cJSON_CreateArray();
+  assert(chainJSON);
+  for (unsigned int s = 0; s < chainLength; s ++) {
+    cJSON_AddItemToArray(chainJSON, cJSON_CreateString(chain[s]->name));
+  }
+  cJSON_AddItemToObject(json, "chain", chainJSON);
+  cJSON_AddItemToObject(json, "pipeline",
+                        pipelineJSON(threads, &timeout, inputs, verbose));
+
+  printJSON(json, formated);
+
+  cJSON_Delete(json);
+
+  ret = 0;
+
+END:
+  for (unsigned int s = 0; s < made; s ++) {
+    destroyContents(inputs[s]);
+    free(inputs[s]);
+  }
+  return ret;
+}
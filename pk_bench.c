@@ -0,0 +1,555 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/rsa.h>
+#include <openssl/obj_mac.h>
+
+#include "contents.h"
+#include "benchmark.h"
+#include "misc.h"
+#include "parallel.h"
+
+#define keyTypeRSA 1
+#define keyTypeEC 2
+#define keyTypeEd25519 3
+#define keyTypeX25519 4
+
+#define opKeygen  (1 << 0)
+#define opSign    (1 << 1)
+#define opEncrypt (1 << 2)
+#define opDerive  (1 << 3)
+
+/* Registered algorithms; ops are what each key type supports. Sign
+   covers verify and encrypt covers decrypt, measured as a second stage
+   on the first one's output. */
+struct p_algorithm {
+  const char *name;
+  int keyType;
+  int param; /* RSA bits or EC curve NID */
+  unsigned int ops;
+};
+typedef struct p_algorithm ALGORITHM;
+
+static const ALGORITHM algorithms[] = {
+  {"RSA-2048", keyTypeRSA, 2048, opKeygen | opSign | opEncrypt},
+  {"RSA-3072", keyTypeRSA, 3072, opKeygen | opSign | opEncrypt},
+  {"RSA-4096", keyTypeRSA, 4096, opKeygen | opSign | opEncrypt},
+  {"P-256", keyTypeEC, NID_X9_62_prime256v1, opKeygen | opSign | opDerive},
+  {"P-384", keyTypeEC, NID_secp384r1, opKeygen | opSign | opDerive},
+  {"Ed25519", keyTypeEd25519, 0, opKeygen | opSign},
+  {"X25519", keyTypeX25519, 0, opKeygen | opDerive},
+};
+#define algorithmCount (sizeof(algorithms) / sizeof(algorithms[0]))
+
+static const char *opNames[] = {"keygen", "sign", "encrypt", "derive"};
+
+/* The algorithm under test, its pre-generated key, a second key as the
+   peer for derive, and the message signed and encrypted. */
+static const ALGORITHM *algorithm = NULL;
+static EVP_PKEY *key = NULL;
+static EVP_PKEY *peer = NULL;
+static const CONTENTS *message = NULL;
+
+/* Each thread works on its own copy of the key and the peer, so threads
+   do not contend on the reference counts and locks of shared keys. */
+struct p_thread {
+  EVP_PKEY *key;
+  EVP_PKEY *peer;
+};
+typedef struct p_thread THREAD;
+
+static pthread_key_t threadKey;
+
+static void threadDestroy(void *arg) {
+  THREAD *thread = (THREAD *)arg;
+
+  EVP_PKEY_free(thread->key);
+  EVP_PKEY_free(thread->peer);
+  free(thread);
+}
+
+/* EVP_PKEY_dup is OpenSSL 3 only; before it threads share a reference
+   to the one key. */
+static EVP_PKEY *keyCopy(EVP_PKEY *pkey) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  return EVP_PKEY_dup(pkey);
+#else
+  EVP_PKEY_up_ref(pkey);
+  return pkey;
+#endif
+}
+
+static THREAD *threadGet() {
+  THREAD *thread = (THREAD *)pthread_getspecific(threadKey);
+
+  if (!thread) {
+    thread = (THREAD *)calloc(1, sizeof(THREAD));
+    assert(thread);
+    thread->key = keyCopy(key);
+    assert(thread->key);
+    if (peer) {
+      thread->peer = keyCopy(peer);
+      assert(thread->peer);
+    }
+
+    pthread_setspecific(threadKey, thread);
+  }
+
+  return thread;
+}
+
+static EVP_PKEY *keyGenerate(const ALGORITHM *a) {
+  EVP_PKEY *pkey = NULL;
+  EVP_PKEY_CTX *ctx = NULL;
+  int i;
+
+  switch (a->keyType) {
+  case keyTypeRSA:
+    ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+    break;
+  case keyTypeEC:
+    ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+    break;
+  case keyTypeEd25519:
+    ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_ED25519, NULL);
+    break;
+  case keyTypeX25519:
+    ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, NULL);
+    break;
+  }
+  assert(ctx);
+
+  i = EVP_PKEY_keygen_init(ctx);
+  assert(i==1);
+  if (a->keyType == keyTypeRSA) {
+    i = EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, a->param);
+    assert(i==1);
+  } else if (a->keyType == keyTypeEC) {
+    i = EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, a->param);
+    assert(i==1);
+  }
+
+  i = EVP_PKEY_keygen(ctx, &pkey);
+  assert(i==1);
+
+  EVP_PKEY_CTX_free(ctx);
+
+  return pkey;
+}
+
+static CONTENTS *contentsNew(size_t size) {
+  CONTENTS *result = calloc(1, sizeof(CONTENTS));
+  assert(result);
+  result->body = malloc(size ? size : 1);
+  assert(result->body);
+  result->size = size;
+
+  return result;
+}
+
+static CONTENTS *okContents(int ok) {
+  CONTENTS *result = contentsNew(1);
+  result->body[0] = ok ? 1 : 0;
+
+  return result;
+}
+
+static CONTENTS* keygenContent(const CONTENTS* data) {
+  (void)data;
+  EVP_PKEY *pkey = keyGenerate(algorithm);
+  EVP_PKEY_free(pkey);
+
+  return okContents(pkey != NULL);
+}
+
+/* The 32 byte message is signed as a SHA-256 digest, except by Ed25519
+   which signs the message itself. */
+static CONTENTS* signContent(const CONTENTS* data) {
+  EVP_PKEY *key = threadGet()->key;
+  CONTENTS *signature = contentsNew(EVP_PKEY_size(key));
+  size_t length = signature->size;
+  int i;
+
+  if (algorithm->keyType == keyTypeEd25519) {
+    EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
+    assert(mdctx);
+    i = EVP_DigestSignInit(mdctx, NULL, NULL, NULL, key);
+    assert(i==1);
+    i = EVP_DigestSign(mdctx, signature->body, &length, data->body, data->size);
+    assert(i==1);
+    EVP_MD_CTX_free(mdctx);
+  } else {
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(key, NULL);
+    assert(ctx);
+    i = EVP_PKEY_sign_init(ctx);
+    assert(i==1);
+    i = EVP_PKEY_CTX_set_signature_md(ctx, EVP_sha256());
+    assert(i==1);
+    i = EVP_PKEY_sign(ctx, signature->body, &length, data->body, data->size);
+    assert(i==1);
+    EVP_PKEY_CTX_free(ctx);
+  }
+  signature->size = length;
+
+  return signature;
+}
+
+static CONTENTS* verifyContent(const CONTENTS* data) {
+  EVP_PKEY *key = threadGet()->key;
+  int ok;
+
+  if (algorithm->keyType == keyTypeEd25519) {
+    EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
+    assert(mdctx);
+    int i = EVP_DigestVerifyInit(mdctx, NULL, NULL, NULL, key);
+    assert(i==1);
+    ok = EVP_DigestVerify(mdctx, data->body, data->size,
+                          message->body, message->size);
+    EVP_MD_CTX_free(mdctx);
+  } else {
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(key, NULL);
+    assert(ctx);
+    int i = EVP_PKEY_verify_init(ctx);
+    assert(i==1);
+    i = EVP_PKEY_CTX_set_signature_md(ctx, EVP_sha256());
+    assert(i==1);
+    ok = EVP_PKEY_verify(ctx, data->body, data->size,
+                         message->body, message->size);
+    EVP_PKEY_CTX_free(ctx);
+  }
+
+  return okContents(ok == 1);
+}
+
+/* RSA encryption with OAEP padding. */
+static CONTENTS* rsaCrypt(const CONTENTS* data, int enc) {
+  EVP_PKEY *key = threadGet()->key;
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(key, NULL);
+  assert(ctx);
+
+  int i = enc ? EVP_PKEY_encrypt_init(ctx) : EVP_PKEY_decrypt_init(ctx);
+  assert(i==1);
+  i = EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_OAEP_PADDING);
+  assert(i==1);
+
+  CONTENTS *result = contentsNew(EVP_PKEY_size(key));
+  size_t length = result->size;
+  if (enc) {
+    i = EVP_PKEY_encrypt(ctx, result->body, &length, data->body, data->size);
+  } else {
+    i = EVP_PKEY_decrypt(ctx, result->body, &length, data->body, data->size);
+  }
+  EVP_PKEY_CTX_free(ctx);
+
+  if (i != 1) {
+    destroyContents(result);
+    free(result);
+    return NULL;
+  }
+  result->size = length;
+
+  return result;
+}
+
+static CONTENTS* encryptContent(const CONTENTS* data) {
+  return rsaCrypt(data, 1);
+}
+
+static CONTENTS* decryptContent(const CONTENTS* data) {
+  return rsaCrypt(data, 0);
+}
+
+/* ECDH or X25519 agreement between the key and the peer's public key. */
+static CONTENTS* derive(EVP_PKEY *key, EVP_PKEY *peer) {
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(key, NULL);
+  assert(ctx);
+
+  int i = EVP_PKEY_derive_init(ctx);
+  assert(i==1);
+  i = EVP_PKEY_derive_set_peer(ctx, peer);
+  assert(i==1);
+
+  size_t length = 0;
+  i = EVP_PKEY_derive(ctx, NULL, &length);
+  assert(i==1);
+
+  CONTENTS *secret = contentsNew(length);
+  i = EVP_PKEY_derive(ctx, secret->body, &length);
+  assert(i==1);
+  secret->size = length;
+
+  EVP_PKEY_CTX_free(ctx);
+
+  return secret;
+}
+
+static CONTENTS* deriveContent(const CONTENTS* data) {
+  (void)data;
+  THREAD *thread = threadGet();
+
+  return derive(thread->key, thread->peer);
+}
+
+/* One operation of the current algorithm on threads threads. */
+static RESULT *runTest(unsigned int op, unsigned int threads,
+                       struct timeval *timeout) {
+  CONTENTS *reference = NULL;
+
+  TEST *t = testNew();
+  testSetThreads(t, threads);
+  testSetTimeout(t, timeout);
+
+  switch (op) {
+  case opKeygen:
+    testAddRun(t, &keygenContent);
+    reference = okContents(1);
+    break;
+  case opSign:
+    testAddRun(t, &signContent);
+    testAddRun(t, &verifyContent);
+    reference = okContents(1);
+    break;
+  case opEncrypt:
+    testAddRun(t, &encryptContent);
+    testAddRun(t, &decryptContent);
+    reference = cloneContents((CONTENTS *)message);
+    break;
+  case opDerive:
+    testAddRun(t, &deriveContent);
+    reference = derive(key, peer);
+    break;
+  }
+  testSetInput(t, message);
+  testSetTesting(t, reference);
+
+  RESULT *r = testRun(t);
+  assert(r);
+
+  testDestory(t);
+  destroyContents(reference);
+  free(reference);
+
+  return r;
+}
+
+static const char *secondStage(unsigned int op) {
+  if (op == opSign) return "verify";
+  if (op == opEncrypt) return "decrypt";
+  return NULL;
+}
+
+static double opsPerSec(const RESULT *r, unsigned int run) {
+  return 1000000.0 / resultAvgIntervalByRun(r, run) * resultThreads(r);
+}
+
+static cJSON *stageJSON(const char *name, const RESULT *r, unsigned int run) {
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddStringToObject(json, "operation", name);
+  cJSON_AddNumberToObject(json, "opsPerSec", opsPerSec(r, run));
+  cJSON_AddNumberToObject(json, "opsPerSecPerThread",
+                          opsPerSec(r, run) / resultThreads(r));
+  cJSON_AddNumberToObject(json, "usPerOp", resultAvgIntervalByRun(r, run));
+
+  return json;
+}
+
+/* Ops/s at 1, 2, 4 ... threads, with the efficiency of each point
+   against perfect scaling of the single thread rate. */
+static cJSON *scalingJSON(unsigned int op, unsigned int threads,
+                          struct timeval *timeout) {
+  cJSON *json = cJSON_CreateArray();
+  assert(json);
+
+  double base[2] = {0, 0};
+  for (unsigned int w = 1; w; w = parallelNextWorkers(w, threads)) {
+    RESULT *r = runTest(op, w, timeout);
+
+    cJSON *point = cJSON_CreateObject();
+    assert(point);
+    cJSON_AddNumberToObject(point, "threads", w);
+    cJSON_AddBoolToObject(point, "correct", isResultCorrect(r));
+    for (unsigned int run = 0; run < (secondStage(op) ? 2 : 1); run ++) {
+      double rate = opsPerSec(r, run);
+      if (w == 1) base[run] = rate;
+      cJSON *stage = stageJSON(run ? secondStage(op) : opNames[__builtin_ctz(op)], r, run);
+      cJSON_AddNumberToObject(stage, "efficiency", rate / (base[run] * w));
+      cJSON_AddItemToObject(point, run ? "second" : "first", stage);
+    }
+    cJSON_AddItemToArray(json, point);
+
+    resultDestory(r);
+  }
+
+  return json;
+}
+
+static cJSON *algorithmJSON(const ALGORITHM *a, unsigned int ops,
+                            unsigned int threads, struct timeval *timeout,
+                            int scaling, int verbose) {
+  algorithm = a;
+  key = keyGenerate(a);
+  peer = a->ops & opDerive ? keyGenerate(a) : NULL;
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddStringToObject(json, "algorithm", a->name);
+  cJSON_AddNumberToObject(json, "bits", EVP_PKEY_bits(key));
+
+  cJSON *opsJSON = cJSON_CreateArray();
+  assert(opsJSON);
+  for (unsigned int op = opKeygen; op <= opDerive; op <<= 1) {
+    if (!(op & ops & a->ops)) continue;
+
+    if (scaling) {
+      cJSON *opJSON = cJSON_CreateObject();
+      assert(opJSON);
+      cJSON_AddStringToObject(opJSON, "operation", opNames[__builtin_ctz(op)]);
+      cJSON_AddItemToObject(opJSON, "scaling", scalingJSON(op, threads, timeout));
+      cJSON_AddItemToArray(opsJSON, opJSON);
+      continue;
+    }
+
+    RESULT *r = runTest(op, threads, timeout);
+
+    cJSON *first = stageJSON(opNames[__builtin_ctz(op)], r, 0);
+    cJSON_AddBoolToObject(first, "correct", isResultCorrect(r));
+    if (verbose) {
+      cJSON_AddItemToObject(first, "result", resultJSON(r, 0));
+    }
+    cJSON_AddItemToArray(opsJSON, first);
+    if (secondStage(op)) {
+      cJSON *second = stageJSON(secondStage(op), r, 1);
+      cJSON_AddBoolToObject(second, "correct", isResultCorrect(r));
+      cJSON_AddItemToArray(opsJSON, second);
+    }
+
+    resultDestory(r);
+  }
+  cJSON_AddItemToObject(json, "operations", opsJSON);
+
+  EVP_PKEY_free(key);
+  EVP_PKEY_free(peer);
+  key = peer = NULL;
+
+  return json;
+}
+
+static void printUsage() {
+  fprintf(stderr,
+          "Usage: pk_bench \n"
+          "[-r seconds <seconds, default is 3>]\n"
+          "[-t threads <threads, default is logic cpu cores>]\n"
+          "[-a <algorithms>, comma separated RSA-2048, RSA-3072, RSA-4096, P-256, P-384, Ed25519, X25519, default is all]\n"
+          "[-o <operations>, comma separated keygen, sign (and verify), encrypt (and decrypt, RSA) or derive, default is all]\n"
+          "[-s <scale from 1 thread up to threads>]\n"
+          "[-v <verbose json output>] [-f <formated json output>]\n");
+}
+
+int main(int argc, char **argv) {
+  int ret = -1;
+  CONTENTS *contents = NULL;
+
+  struct timeval timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 0;
+  unsigned int threads = 0;
+  int verbose = 0;
+  int formated = 0;
+  int scaling = 0;
+  unsigned int selected = (1 << algorithmCount) - 1;
+  unsigned int ops = opKeygen | opSign | opEncrypt | opDerive;
+
+  const char *algorithmNames[algorithmCount];
+  for (unsigned int i = 0; i < algorithmCount; i ++) {
+    algorithmNames[i] = algorithms[i].name;
+  }
+
+  int c;
+  opterr = 0;
+
+  while ((c = getopt(argc, argv, "r:t:a:o:svf")) != -1) {
+    switch (c) {
+    case 'r':
+      timeout.tv_sec = atoi(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'a':
+      selected = parseNameList(optarg, algorithmNames, algorithmCount);
+      if (!selected) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'o':
+      ops = parseNameList(optarg, opNames, sizeof(opNames) / sizeof(opNames[0]));
+      if (!ops) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 's':
+      scaling = 1;
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'f':
+      formated = 1;
+      break;
+    case '?':
+      printUsage();
+      goto END;
+    }
+  }
+
+  if (timeout.tv_sec == 0) {
+    timeout.tv_sec = 3;
+  }
+
+  if (threads == 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads == 0)
+      threads = 2;
+  }
+
+  pthread_key_create(&threadKey, threadDestroy);
+
+  contents = randomContents(32);
+  message = contents;
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddNumberToObject(json, "threads", threads);
+
+  cJSON *algorithmsJSON = cJSON_CreateArray();
+  assert(algorithmsJSON);
+  for (unsigned int i = 0; i < algorithmCount; i ++) {
+    if (!(selected & (1 << i))) continue;
+    cJSON_AddItemToArray(algorithmsJSON,
+                         algorithmJSON(&algorithms[i], ops, threads, &timeout,
+                                       scaling, verbose));
+  }
+  cJSON_AddItemToObject(json, "algorithms", algorithmsJSON);
+
+  printJSON(json, formated);
+
+  cJSON_Delete(json);
+
+  ret = 0;
+
+END:
+  if (contents) {
+    destroyContents(contents);
+    free(contents);
+    contents = NULL;
+  }
+  return ret;
+}
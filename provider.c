@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/provider.h>
+#include <openssl/core_names.h>
+#endif
+
+#include "provider.h"
+
+#define providerMax 8
+
+static char *loadedSet = NULL;
+static char *loadedPropq = NULL;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static OSSL_LIB_CTX *libctx = NULL;
+static OSSL_PROVIDER *implicitProviders[providerMax];
+static OSSL_PROVIDER *explicitProviders[providerMax];
+static unsigned int providers = 0;
+#endif
+
+int providerLoad(const char *set, const char *propq) {
+  providerUnload();
+
+  if (set && *set) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    libctx = OSSL_LIB_CTX_new();
+    assert(libctx);
+
+    char *names = strdup(set);
+    assert(names);
+
+    char *save = NULL;
+    for (char *name = strtok_r(names, "+", &save); name;
+         name = strtok_r(NULL, "+", &save)) {
+      if (providers == providerMax) break;
+
+      implicitProviders[providers] = OSSL_PROVIDER_load(NULL, name);
+      explicitProviders[providers] = OSSL_PROVIDER_load(libctx, name);
+      if (!implicitProviders[providers] || !explicitProviders[providers]) {
+        if (implicitProviders[providers]) {
+          OSSL_PROVIDER_unload(implicitProviders[providers]);
+        }
+        if (explicitProviders[providers]) {
+          OSSL_PROVIDER_unload(explicitProviders[providers]);
+        }
+        free(names);
+        providerUnload();
+        return 0;
+      }
+      providers ++;
+    }
+    free(names);
+#else
+    return 0;
+#endif
+    loadedSet = strdup(set);
+  }
+
+  if (propq && *propq) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    if (!EVP_set_default_properties(NULL, propq)) {
+      providerUnload();
+      return 0;
+    }
+#endif
+    loadedPropq = strdup(propq);
+  }
+
+  return 1;
+}
+
+void providerUnload() {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  for (unsigned int i = 0; i < providers; i ++) {
+    OSSL_PROVIDER_unload(implicitProviders[i]);
+    OSSL_PROVIDER_unload(explicitProviders[i]);
+  }
+  providers = 0;
+
+  OSSL_LIB_CTX_free(libctx);
+  libctx = NULL;
+
+  if (loadedPropq) {
+    EVP_set_default_properties(NULL, "");
+  }
+#endif
+
+  free(loadedSet);
+  loadedSet = NULL;
+  free(loadedPropq);
+  loadedPropq = NULL;
+}
+
+EVP_CIPHER *providerCipher(const char *name) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  return EVP_CIPHER_fetch(libctx, name, loadedPropq);
+#else
+  (void)name;
+  return NULL;
+#endif
+}
+
+void providerCipherFree(EVP_CIPHER *cipher) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  EVP_CIPHER_free(cipher);
+#endif
+}
+
+EVP_MD *providerDigest(const char *name) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  return EVP_MD_fetch(libctx, name, loadedPropq);
+#else
+  (void)name;
+  return NULL;
+#endif
+}
+
+void providerDigestFree(EVP_MD *md) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  EVP_MD_free(md);
+#endif
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+EVP_MAC *providerMac(const char *name) {
+  return EVP_MAC_fetch(libctx, name, loadedPropq);
+}
+#endif
+
+const char *providerPropq() {
+  return loadedPropq;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int providerAddJSON(OSSL_PROVIDER *provider, void *arg) {
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddStringToObject(json, "name", OSSL_PROVIDER_get0_name(provider));
+
+  char *version = NULL;
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_utf8_ptr(OSSL_PROV_PARAM_VERSION, &version, 0),
+    OSSL_PARAM_END
+  };
+  if (OSSL_PROVIDER_get_params(provider, params) && version) {
+    cJSON_AddStringToObject(json, "version", version);
+  }
+
+  cJSON_AddItemToArray((cJSON *)arg, json);
+
+  return 1;
+}
+#endif
+
+cJSON *providerJSON() {
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+
+  cJSON *providersJSON = cJSON_CreateArray();
+  assert(providersJSON);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  OSSL_PROVIDER_do_all(libctx, providerAddJSON, providersJSON);
+#endif
+  cJSON_AddItemToObject(json, "providers", providersJSON);
+  if (loadedPropq) {
+    cJSON_AddStringToObject(json, "propq", loadedPropq);
+  }
+
+  return json;
+}
+
+cJSON *providerCompareJSON(const char *sets, const char *propq,
+                           providerRun run, void *arg) {
+  cJSON *json = cJSON_CreateArray();
+  assert(json);
+
+  char *list = strdup(sets);
+  assert(list);
+
+  char *save = NULL;
+  for (char *set = strtok_r(list, ",", &save); set;
+       set = strtok_r(NULL, ",", &save)) {
+    cJSON *setJSON = cJSON_CreateObject();
+    assert(setJSON);
+    cJSON_AddStringToObject(setJSON, "set", set);
+
+    if (providerLoad(set, propq)) {
+      cJSON_AddItemToObject(setJSON, "provider", providerJSON());
+      cJSON_AddItemToObject(setJSON, "result", run(arg));
+    } else {
+      cJSON_AddStringToObject(setJSON, "error", "cannot load providers");
+    }
+    providerUnload();
+
+    cJSON_AddItemToArray(json, setJSON);
+  }
+
+  free(list);
+
+  return json;
+}
@@ -0,0 +1,51 @@
+#ifndef __REALITY_PROVIDER_H
+#define __REALITY_PROVIDER_H
+
+#include <openssl/evp.h>
+
+#include "external/cJSON.h"
+
+/* Implicit: the EVP_aes_*()/EVP_get_digestbyname() objects, resolved by
+   OpenSSL 3 on every init that is handed one. Explicit: fetched once per
+   run from a dedicated library context. Explicit needs OpenSSL 3. */
+#define fetchModeImplicit (1 << 0)
+#define fetchModeExplicit (1 << 1)
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#define fetchModeDefault fetchModeExplicit
+#else
+#define fetchModeDefault fetchModeImplicit
+#endif
+
+/* Load a provider set, providers joined with '+' (e.g. "fips+base"),
+   into both the default library context, for implicit fetches, and a
+   fresh one for explicit fetches, with propq as property query (may be
+   NULL). A NULL or empty set keeps OpenSSL's defaults. Returns 0 if a
+   provider cannot be loaded. */
+int providerLoad(const char *set, const char *propq);
+void providerUnload();
+
+/* Explicit fetches, NULL when unavailable in the loaded providers. */
+EVP_CIPHER *providerCipher(const char *name);
+void providerCipherFree(EVP_CIPHER *cipher);
+EVP_MD *providerDigest(const char *name);
+void providerDigestFree(EVP_MD *md);
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+EVP_MAC *providerMac(const char *name);
+#endif
+
+/* Property query of the loaded set, NULL if none. */
+const char *providerPropq();
+
+/* Loaded providers with their versions, and the property query. */
+cJSON *providerJSON();
+
+/* Run run(arg) once per provider set of the comma separated list sets,
+   reporting each set with its result, or its error if it cannot be
+   loaded. */
+typedef cJSON *(*providerRun)(void *arg);
+cJSON *providerCompareJSON(const char *sets, const char *propq,
+                           providerRun run, void *arg);
+
+#endif
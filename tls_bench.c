@@ -0,0 +1,648 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/rsa.h>
+#include <openssl/obj_mac.h>
+#include <openssl/x509.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "contents.h"
+#include "benchmark.h"
+#include "misc.h"
+
+#define modeFull   (1 << 0)
+#define modeResume (1 << 1)
+#define modeBulk   (1 << 2)
+
+static const char *modeNames[] = {"full", "resume", "bulk"};
+
+#define recordMax 16384
+/* Room for a few full records in each direction of a BIO pair. */
+#define pairBuffer (4 * (recordMax + 512))
+
+static const char *defaultSuitesEC =
+  "TLS_AES_128_GCM_SHA256,TLS_AES_256_GCM_SHA384,TLS_CHACHA20_POLY1305_SHA256,"
+  "ECDHE-ECDSA-AES128-GCM-SHA256,ECDHE-ECDSA-AES256-GCM-SHA384,"
+  "ECDHE-ECDSA-CHACHA20-POLY1305";
+static const char *defaultSuitesRSA =
+  "TLS_AES_128_GCM_SHA256,TLS_AES_256_GCM_SHA384,TLS_CHACHA20_POLY1305_SHA256,"
+  "ECDHE-RSA-AES128-GCM-SHA256,ECDHE-RSA-AES256-GCM-SHA384,"
+  "ECDHE-RSA-CHACHA20-POLY1305";
+
+/* Contexts for the suite under test and the record size bulk
+   transfers write. */
+static SSL_CTX *serverCtx = NULL;
+static SSL_CTX *clientCtx = NULL;
+static size_t recordSize = recordMax;
+
+static pthread_key_t connectionKey;
+static pthread_key_t sessionKey;
+
+struct t_connection {
+  SSL *client;
+  SSL *server;
+};
+typedef struct t_connection CONNECTION;
+
+/* Sessions and connections made before a run, one per worker thread,
+   so no worker times a full handshake on its first call. */
+static SSL_SESSION **seeds = NULL;
+static CONNECTION *connections = NULL;
+static unsigned int preparedCount = 0;
+static unsigned int preparedNext = 0;
+
+static EVP_PKEY *keyGenerate(int rsa) {
+  EVP_PKEY *pkey = NULL;
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(rsa ? EVP_PKEY_RSA : EVP_PKEY_EC, NULL);
+  assert(ctx);
+
+  int i = EVP_PKEY_keygen_init(ctx);
+  assert(i==1);
+  if (rsa) {
+    i = EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048);
+  } else {
+    i = EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1);
+  }
+  assert(i==1);
+  i = EVP_PKEY_keygen(ctx, &pkey);
+  assert(i==1);
+
+  EVP_PKEY_CTX_free(ctx);
+
+  return pkey;
+}
+
+/* Self-signed certificate for localhost valid for a day. */
+static X509 *certificateNew(EVP_PKEY *pkey) {
+  X509 *cert = X509_new();
+  assert(cert);
+
+  X509_set_version(cert, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+  X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+  X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 60 * 60);
+  X509_set_pubkey(cert, pkey);
+
+  X509_NAME *name = X509_get_subject_name(cert);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                             (const unsigned char *)"localhost", -1, -1, 0);
+  X509_set_issuer_name(cert, name);
+
+  int i = X509_sign(cert, pkey, EVP_sha256());
+  assert(i > 0);
+
+  return cert;
+}
+
+static int suiteIsTLS13(const char *suite) {
+  return strncmp(suite, "TLS_", 4) == 0;
+}
+
+/* Client and server contexts pinned to the suite's protocol version and
+   to the suite itself. The client trusts the certificate and verifies
+   the server as a real one would. Returns 0 if the suite is unknown. */
+static int contextsNew(const char *suite, EVP_PKEY *pkey, X509 *cert) {
+  int version = suiteIsTLS13(suite) ? TLS1_3_VERSION : TLS1_2_VERSION;
+
+  serverCtx = SSL_CTX_new(TLS_server_method());
+  clientCtx = SSL_CTX_new(TLS_client_method());
+  assert(serverCtx && clientCtx);
+
+  SSL_CTX *ctxs[] = {serverCtx, clientCtx};
+  for (unsigned int i = 0; i < 2; i ++) {
+    SSL_CTX_set_min_proto_version(ctxs[i], version);
+    SSL_CTX_set_max_proto_version(ctxs[i], version);
+    int ok = version == TLS1_3_VERSION ?
+      SSL_CTX_set_ciphersuites(ctxs[i], suite) :
+      SSL_CTX_set_cipher_list(ctxs[i], suite);
+    if (!ok) {
+      ERR_clear_error();
+      return 0;
+    }
+  }
+
+  int i = SSL_CTX_use_certificate(serverCtx, cert);
+  assert(i==1);
+  i = SSL_CTX_use_PrivateKey(serverCtx, pkey);
+  assert(i==1);
+  /* Resumption relies on tickets rather than the server's cache. */
+  SSL_CTX_set_session_cache_mode(serverCtx, SSL_SESS_CACHE_OFF);
+
+  i = X509_STORE_add_cert(SSL_CTX_get_cert_store(clientCtx), cert);
+  assert(i==1);
+  SSL_CTX_set_verify(clientCtx, SSL_VERIFY_PEER, NULL);
+  SSL_CTX_set_session_cache_mode(clientCtx, SSL_SESS_CACHE_CLIENT);
+
+  return 1;
+}
+
+static void contextsFree() {
+  SSL_CTX_free(serverCtx);
+  serverCtx = NULL;
+  SSL_CTX_free(clientCtx);
+  clientCtx = NULL;
+}
+
+/* Whether a non-blocking call failed for a reason other than waiting on
+   its peer. */
+static int failed(SSL *ssl, int ret) {
+  int error = SSL_get_error(ssl, ret);
+  return error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE;
+}
+
+/* Client and server joined by a BIO pair, handshaken by stepping both
+   until neither wants more. Offers s when not NULL. */
+static int connectionOpen(CONNECTION *c, SSL_SESSION *s) {
+  BIO *clientBio = NULL;
+  BIO *serverBio = NULL;
+
+  c->client = SSL_new(clientCtx);
+  c->server = SSL_new(serverCtx);
+  assert(c->client && c->server);
+
+  int i = BIO_new_bio_pair(&clientBio, pairBuffer, &serverBio, pairBuffer);
+  assert(i==1);
+  SSL_set_bio(c->client, clientBio, clientBio);
+  SSL_set_bio(c->server, serverBio, serverBio);
+  SSL_set_connect_state(c->client);
+  SSL_set_accept_state(c->server);
+  if (s) {
+    SSL_set_session(c->client, s);
+  }
+
+  int clientDone = 0;
+  int serverDone = 0;
+  while (!clientDone || !serverDone) {
+    if (!clientDone) {
+      int ret = SSL_do_handshake(c->client);
+      if (ret == 1) clientDone = 1;
+      else if (failed(c->client, ret)) return 0;
+    }
+    if (!serverDone) {
+      int ret = SSL_do_handshake(c->server);
+      if (ret == 1) serverDone = 1;
+      else if (failed(c->server, ret)) return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* Freeing a connection that was not shut down makes its session
+   unresumable, so both ends are marked closed first. */
+static void connectionClose(CONNECTION *c) {
+  if (c->client) {
+    SSL_set_shutdown(c->client, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+  }
+  if (c->server) {
+    SSL_set_shutdown(c->server, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+  }
+  SSL_free(c->client);
+  SSL_free(c->server);
+  c->client = c->server = NULL;
+}
+
+/* Reading on the client processes the TLS 1.3 tickets the server sent
+   after its handshake, so the session can be resumed. */
+static SSL_SESSION *connectionSession(CONNECTION *c) {
+  unsigned char buffer[1];
+  int ret = SSL_read(c->client, buffer, sizeof(buffer));
+  if (ret <= 0 && failed(c->client, ret)) return NULL;
+
+  return SSL_get1_session(c->client);
+}
+
+static CONTENTS *okContents(int ok) {
+  CONTENTS *result = calloc(1, sizeof(CONTENTS));
+  assert(result);
+  result->body = malloc(1);
+  assert(result->body);
+  result->body[0] = ok ? 1 : 0;
+  result->size = 1;
+
+  return result;
+}
+
+static CONTENTS* fullContent(const CONTENTS* data) {
+  (void)data;
+  CONNECTION c;
+
+  int ok = connectionOpen(&c, NULL);
+  connectionClose(&c);
+  ERR_clear_error();
+
+  return okContents(ok);
+}
+
+static unsigned int preparedTake() {
+  unsigned int i = __atomic_fetch_add(&preparedNext, 1, __ATOMIC_RELAXED);
+  assert(i < preparedCount);
+
+  return i;
+}
+
+/* TLS 1.3 clients use a ticket once, so each worker thread resumes
+   with the session from its previous connection's new ticket, starting
+   from its seed. The thread keeps its seed slot for the run. */
+static CONTENTS* resumeContent(const CONTENTS* data) {
+  (void)data;
+  CONNECTION c;
+
+  SSL_SESSION **slot = (SSL_SESSION **)pthread_getspecific(sessionKey);
+  if (!slot) {
+    slot = &seeds[preparedTake()];
+    pthread_setspecific(sessionKey, slot);
+  }
+  if (!*slot) return okContents(0);
+
+  int ok = connectionOpen(&c, *slot) && SSL_session_reused(c.client);
+  SSL_SESSION_free(*slot);
+  *slot = ok ? connectionSession(&c) : NULL;
+  connectionClose(&c);
+  ERR_clear_error();
+
+  return okContents(ok && *slot);
+}
+
+/* Each worker thread takes a prepared connection on its first transfer
+   and keeps it for the run. */
+static CONNECTION *threadConnection() {
+  CONNECTION *c = (CONNECTION *)pthread_getspecific(connectionKey);
+  if (!c) {
+    c = &connections[preparedTake()];
+    pthread_setspecific(connectionKey, c);
+  }
+
+  return c;
+}
+
+/* A seed session per thread for resume, made by a full handshake, or a
+   handshaken connection per thread for bulk. 0 if a handshake failed. */
+static int prepare(unsigned int mode, unsigned int threads) {
+  int ok = 1;
+  preparedCount = threads;
+  preparedNext = 0;
+
+  if (mode == modeResume) {
+    seeds = (SSL_SESSION **)calloc(threads, sizeof(SSL_SESSION *));
+    assert(seeds);
+    for (unsigned int i = 0; i < threads; i ++) {
+      CONNECTION c;
+      if (connectionOpen(&c, NULL)) {
+        seeds[i] = connectionSession(&c);
+      }
+      connectionClose(&c);
+      if (!seeds[i]) ok = 0;
+    }
+  } else if (mode == modeBulk) {
+    connections = (CONNECTION *)calloc(threads, sizeof(CONNECTION));
+    assert(connections);
+    for (unsigned int i = 0; i < threads; i ++) {
+      if (!connectionOpen(&connections[i], NULL)) ok = 0;
+    }
+  }
+  ERR_clear_error();
+
+  return ok;
+}
+
+static void prepareRelease() {
+  for (unsigned int i = 0; i < preparedCount; i ++) {
+    if (seeds) SSL_SESSION_free(seeds[i]);
+    if (connections) connectionClose(&connections[i]);
+  }
+  free(seeds);
+  seeds = NULL;
+  free(connections);
+  connections = NULL;
+  preparedCount = 0;
+}
+
+/* Sends data from client to server in SSL_write calls of recordSize,
+   draining the server after each, and returns what the server read. */
+static CONTENTS* bulkContent(const CONTENTS* data) {
+  CONNECTION *c = threadConnection();
+
+  CONTENTS *result = calloc(1, sizeof(CONTENTS));
+  assert(result);
+  result->body = malloc(data->size ? data->size : 1);
+  assert(result->body);
+
+  size_t sent = 0;
+  while (sent < data->size || result->size < data->size) {
+    if (sent < data->size) {
+      size_t length = data->size - sent;
+      if (length > recordSize) length = recordSize;
+      int ret = SSL_write(c->client, data->body + sent, length);
+      if (ret > 0) sent += ret;
+      else if (failed(c->client, ret)) break;
+    }
+
+    int ret;
+    while (result->size < data->size &&
+           (ret = SSL_read(c->server, result->body + result->size,
+                           data->size - result->size)) > 0) {
+      result->size += ret;
+    }
+    if (result->size < data->size && failed(c->server, ret)) break;
+  }
+
+  return result;
+}
+
+/* NULL when the connections it needs cannot be handshaken. */
+static RESULT *runTest(unsigned int mode, unsigned int threads,
+                       struct timeval *timeout, const CONTENTS *payload) {
+  CONTENTS *reference = NULL;
+  RESULT *r = NULL;
+
+  TEST *t = testNew();
+  testSetThreads(t, threads);
+  testSetTimeout(t, timeout);
+
+  switch (mode) {
+  case modeFull:
+    testAddRun(t, &fullContent);
+    reference = okContents(1);
+    break;
+  case modeResume:
+    testAddRun(t, &resumeContent);
+    reference = okContents(1);
+    break;
+  case modeBulk:
+    testAddRun(t, &bulkContent);
+    reference = cloneContents((CONTENTS *)payload);
+    break;
+  }
+  testSetInput(t, payload);
+  testSetTesting(t, reference);
+
+  if (prepare(mode, threads)) {
+    r = testRun(t);
+    assert(r);
+  }
+  prepareRelease();
+
+  testDestory(t);
+  destroyContents(reference);
+  free(reference);
+
+  return r;
+}
+
+static cJSON *handshakeJSON(unsigned int mode, unsigned int threads,
+                            struct timeval *timeout, const CONTENTS *payload,
+                            int verbose) {
+  RESULT *r = runTest(mode, threads, timeout, payload);
+  if (!r) return NULL;
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddNumberToObject(json, "handshakesPerSec",
+                          1000000.0 / resultAvgIntervalByRun(r, 0) * resultThreads(r));
+  cJSON_AddNumberToObject(json, "usPerHandshake", resultAvgIntervalByRun(r, 0));
+  cJSON_AddBoolToObject(json, "correct", isResultCorrect(r));
+  if (verbose) {
+    cJSON_AddItemToObject(json, "result", resultJSON(r, 0));
+  }
+
+  resultDestory(r);
+
+  return json;
+}
+
+static cJSON *bulkJSON(unsigned int threads, struct timeval *timeout,
+                       const CONTENTS *payload, int verbose) {
+  RESULT *r = runTest(modeBulk, threads, timeout, payload);
+  if (!r) return NULL;
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddNumberToObject(json, "recordSize", recordSize);
+  cJSON_AddNumberToObject(json, "MBps",
+                          payload->size / resultAvgIntervalByRun(r, 0) * 1000000 /
+                          (1 << 20) * resultThreads(r));
+  cJSON_AddBoolToObject(json, "correct", isResultCorrect(r));
+  if (verbose) {
+    cJSON_AddItemToObject(json, "result", resultJSON(r, 0));
+  }
+
+  resultDestory(r);
+
+  return json;
+}
+
+static cJSON *suiteJSON(const char *suite, EVP_PKEY *pkey, X509 *cert,
+                        unsigned int modes, unsigned int threads,
+                        struct timeval *timeout, const CONTENTS *payload,
+                        int sweep, int verbose) {
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddStringToObject(json, "suite", suite);
+  cJSON_AddStringToObject(json, "protocol",
+                          suiteIsTLS13(suite) ? "TLSv1.3" : "TLSv1.2");
+
+  if (!contextsNew(suite, pkey, cert)) {
+    cJSON_AddStringToObject(json, "error", "suite unavailable");
+    contextsFree();
+    return json;
+  }
+
+  if (modes & modeFull) {
+    cJSON_AddItemToObject(json, "full",
+                          handshakeJSON(modeFull, threads, timeout, payload, verbose));
+  }
+
+  if (modes & modeResume) {
+    cJSON *resumed = handshakeJSON(modeResume, threads, timeout, payload, verbose);
+    if (!resumed) goto FAIL;
+    cJSON_AddItemToObject(json, "resumed", resumed);
+  }
+
+  if (modes & modeBulk) {
+    size_t configured = recordSize;
+    cJSON *bulk = NULL;
+    if (sweep) {
+      bulk = cJSON_CreateArray();
+      assert(bulk);
+      for (recordSize = 256; recordSize <= recordMax; recordSize <<= 1) {
+        cJSON *point = bulkJSON(threads, timeout, payload, verbose);
+        if (!point) {
+          cJSON_Delete(bulk);
+          bulk = NULL;
+          break;
+        }
+        cJSON_AddItemToArray(bulk, point);
+      }
+    } else {
+      bulk = bulkJSON(threads, timeout, payload, verbose);
+    }
+    recordSize = configured;
+    if (!bulk) goto FAIL;
+    cJSON_AddItemToObject(json, "bulk", bulk);
+  }
+
+  contextsFree();
+
+  return json;
+
+FAIL:
+  cJSON_AddStringToObject(json, "error", "handshake failed");
+  contextsFree();
+
+  return json;
+}
+
+static void printUsage() {
+  fprintf(stderr,
+          "Usage: tls_bench \n"
+          "[-r seconds <seconds, default is 3>]\n"
+          "[-t threads <threads, default is logic cpu cores>]\n"
+          "[-k <certificate key, ec (P-256) or rsa (2048), default is ec>]\n"
+          "[-c <suites>, comma separated, TLS_ names are TLS 1.3 and others TLS 1.2, default is AES-128/256-GCM and ChaCha20-Poly1305 of both]\n"
+          "[-m <modes>, comma separated full, resume or bulk, default is all]\n"
+          "[-b <bulk record size, default is 16K>] [-S <sweep bulk record sizes from 256B to 16K>]\n"
+          "[-v <verbose json output>] [-f <formated json output>]\n"
+          "[-u <bulk payload size, default is 1M>]\n");
+}
+
+int main(int argc, char **argv) {
+  int ret = -1;
+  CONTENTS *contents = NULL;
+  EVP_PKEY *pkey = NULL;
+  X509 *cert = NULL;
+  char *suites = NULL;
+
+  struct timeval timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 0;
+  unsigned int threads = 0;
+  int verbose = 0;
+  int formated = 0;
+  int rsa = 0;
+  int sweep = 0;
+  unsigned int modes = modeFull | modeResume | modeBulk;
+  size_t payloadSize = 1 << 20;
+
+  int c;
+  opterr = 0;
+
+  while ((c = getopt(argc, argv, "r:t:k:c:m:b:Svfu:")) != -1) {
+    switch (c) {
+    case 'r':
+      timeout.tv_sec = atoi(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'k':
+      if (strcmp(optarg, "rsa") == 0) {
+        rsa = 1;
+      } else if (strcmp(optarg, "ec") != 0) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'c':
+      suites = strdup(optarg);
+      assert(suites);
+      break;
+    case 'm':
+      modes = parseNameList(optarg, modeNames,
+                            sizeof(modeNames) / sizeof(modeNames[0]));
+      if (!modes) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'b':
+      recordSize = parseHumanSize(optarg);
+      if (recordSize == 0 || recordSize > recordMax) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'S':
+      sweep = 1;
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'f':
+      formated = 1;
+      break;
+    case 'u':
+      payloadSize = parseHumanSize(optarg);
+      if (payloadSize == 0) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case '?':
+      printUsage();
+      goto END;
+    }
+  }
+
+  if (timeout.tv_sec == 0) {
+    timeout.tv_sec = 3;
+  }
+
+  if (threads == 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads == 0)
+      threads = 2;
+  }
+
+  if (!suites) {
+    suites = strdup(rsa ? defaultSuitesRSA : defaultSuitesEC);
+    assert(suites);
+  }
+
+  pthread_key_create(&connectionKey, NULL);
+  pthread_key_create(&sessionKey, NULL);
+
+  contents = randomContents(payloadSize);
+  pkey = keyGenerate(rsa);
+  cert = certificateNew(pkey);
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddNumberToObject(json, "threads", threads);
+  cJSON_AddStringToObject(json, "key", rsa ? "RSA-2048" : "P-256");
+  cJSON_AddNumberToObject(json, "payload", payloadSize);
+
+  cJSON *suitesJSON = cJSON_CreateArray();
+  assert(suitesJSON);
+  char *save = NULL;
+  for (char *suite = strtok_r(suites, ",", &save); suite;
+       suite = strtok_r(NULL, ",", &save)) {
+    cJSON_AddItemToArray(suitesJSON,
+                         suiteJSON(suite, pkey, cert, modes, threads, &timeout,
+                                   contents, sweep, verbose));
+  }
+  cJSON_AddItemToObject(json, "suites", suitesJSON);
+
+  printJSON(json, formated);
+
+  cJSON_Delete(json);
+
+  ret = 0;
+
+END:
+  X509_free(cert);
+  EVP_PKEY_free(pkey);
+  free(suites);
+  if (contents) {
+    destroyContents(contents);
+    free(contents);
+    contents = NULL;
+  }
+  return ret;
+}
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+
+#include "transform.h"
+#include "zstage.h"
+#include "cstage.h"
+#include "mstage.h"
+#include "external/cJSON.h"
+
+/* The largest TLS record. */
+#define sealRecordSize 16384
+
+/* Parse the payload and serialize it back, as a handler turning a
+   request into a response would. This cJSON has no length bounded
+   parse, so the payload is copied NUL terminated first. */
+static CONTENTS* jsonContent(const CONTENTS* data) {
+  char *body = malloc(data->size + 1);
+  assert(body);
+  memcpy(body, data->body, data->size);
+  body[data->size] = '\0';
+
+  cJSON *tree = cJSON_Parse(body);
+  free(body);
+  if (!tree) return NULL;
+
+  char *text = cJSON_PrintUnformatted(tree);
+  cJSON_Delete(tree);
+  if (!text) return NULL;
+
+  CONTENTS *result = calloc(1, sizeof(CONTENTS));
+  assert(result);
+  result->body = (unsigned char *)text;
+  result->size = strlen(text);
+
+  return result;
+}
+
+/* Data followed by its digest. */
+static CONTENTS* tagContent(const CONTENTS* data) {
+  CONTENTS *digest = mdContent(data);
+
+  CONTENTS *result = calloc(1, sizeof(CONTENTS));
+  assert(result);
+  result->body = malloc(data->size + digest->size);
+  assert(result->body);
+  memcpy(result->body, data->body, data->size);
+  memcpy(result->body + data->size, digest->body, digest->size);
+  result->size = data->size + digest->size;
+
+  destroyContents(digest);
+  free(digest);
+
+  return result;
+}
+
+static CONTENTS* checkContent(const CONTENTS* data) {
+  size_t digestSize = EVP_MD_size(mSettings.md);
+  if (data->size < digestSize) return NULL;
+
+  CONTENTS body;
+  memset(&body, 0, sizeof(body));
+  body.body = data->body;
+  body.size = data->size - digestSize;
+  body.borrowed = 1;
+
+  CONTENTS *digest = mdContent(&body);
+  int ok = CRYPTO_memcmp(digest->body, data->body + body.size,
+                         digestSize) == 0;
+  destroyContents(digest);
+  free(digest);
+  if (!ok) return NULL;
+
+  return cloneContents(&body);
+}
+
+const TRANSFORM transforms[] = {
+  {"json", jsonContent},
+  {"deflate", deflateContentOneShot},
+  {"inflate", inflateContentOneShot},
+  {"seal", sealRecords},
+  {"open", openRecords},
+  {"tag", tagContent},
+  {"check", checkContent},
+};
+const unsigned int transformCount = sizeof(transforms) / sizeof(transforms[0]);
+
+void transformInit(int level) {
+  zSettings.level = level;
+
+  cSettings.cipher = EVP_aes_256_gcm();
+  cSettings.cipherMode = cipherModeGCM;
+  cSettings.keyLength = 32;
+  cSettings.ivLength = recordNonceLength;
+  cSettings.tagLength = 16;
+  cSettings.keyMode = keyModeFixed;
+  cSettings.recordSize = sealRecordSize;
+  cipherKeys();
+
+  mSettings.md = EVP_sha256();
+  mSettings.chunkSize = 0;
+}
+
+const TRANSFORM *transformByName(const char *name) {
+  for (unsigned int i = 0; i < transformCount; i ++) {
+    if (strcmp(transforms[i].name, name) == 0) return &transforms[i];
+  }
+  return NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef __REALITY_TRANSFORM_H
+#define __REALITY_TRANSFORM_H
+
+#include "contents.h"
+
+/* Request path transforms usable as harness stages, each returning NULL
+   on input it cannot process. They run the stages the single library
+   benchmarks measure.
+
+   json:    parse and serialize unformatted with cJSON.
+   deflate: zlib_bench's one-shot stream, the original length then the
+            zlib data; inflate undoes it.
+   seal:    aes_bench's TLS style AES-256-GCM records of 16K, a nonce
+            per record; open undoes it.
+   tag:     data and its SHA-256 from md_bench's digest stage; check
+            verifies and strips it. */
+struct t_transform {
+  const char *name;
+  CONTENTS* (*run)(const CONTENTS*);
+};
+typedef struct t_transform TRANSFORM;
+
+extern const TRANSFORM transforms[];
+extern const unsigned int transformCount;
+
+/* Sets up the stages: the compression level, and a random AES key and
+   static IV, the same for every message so a chain can be checked
+   against a single threaded run. Only acceptable in a benchmark. */
+void transformInit(int level);
+const TRANSFORM *transformByName(const char *name);
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <errno.h>
 #include <assert.h>
@@ -9,95 +10,585 @@
 #include "contents.h"
 #include "benchmark.h"
 #include "misc.h"
+#include "parallel.h"
+#include "zstage.h"
 
-static int level = -1;
+static const char *formatNames[] = {"zlib", "gzip", "raw"};
+static const char *strategyNames[] = {
+  "default", "filtered", "huffman", "rle", "fixed"
+};
 
-static CONTENTS *deflateContent(const CONTENTS *data) {
-  assert(data != NULL);
-  assert(data->body != NULL);
-  assert(data->size > 0);
+/* Parallel single-stream deflate, in the style of pigz. */
+static size_t blockSize = 0;
+static unsigned int workers = 1;
+
+#define bufferModeStream  (1 << 0)
+#define bufferModeOneShot (1 << 1)
+
+struct z_memory {
+  size_t current;
+  size_t peak;
+};
+typedef struct z_memory MEMORY;
+
+/* Allocation header, kept at 16 bytes so zlib sees malloc alignment. */
+#define memoryHeaderSize 16
+
+static voidpf memoryAlloc(voidpf opaque, uInt items, uInt size) {
+  MEMORY *m = (MEMORY *)opaque;
+  size_t bytes = (size_t)items * size;
+
+  unsigned char *p = (unsigned char *)malloc(memoryHeaderSize + bytes);
+  if (!p) return Z_NULL;
+
+  *(size_t *)p = bytes;
+  m->current += bytes;
+  if (m->current > m->peak) m->peak = m->current;
+
+  return p + memoryHeaderSize;
+}
+
+static void memoryFree(voidpf opaque, voidpf address) {
+  MEMORY *m = (MEMORY *)opaque;
+  unsigned char *p = (unsigned char *)address - memoryHeaderSize;
+
+  m->current -= *(size_t *)p;
+  free(p);
+}
+
+/* Peak heap held by one deflate and one inflate stream over the input. */
+static void streamMemory(const CONTENTS *data, size_t *deflateBytes,
+                         size_t *inflateBytes) {
+  const BACKEND *backend = zSettings.backend;
 
   int ret;
-  size_t bufSize = 0;
+  z_stream strm;
+  MEMORY m;
 
-  CONTENTS *result = calloc(1, sizeof(CONTENTS));
-  assert(result);
+  memset(&strm, 0, sizeof(strm));
+  memset(&m, 0, sizeof(m));
+  strm.zalloc = memoryAlloc;
+  strm.zfree = memoryFree;
+  strm.opaque = &m;
 
-  z_stream *strm = (z_stream *)calloc(1, sizeof(z_stream));
-  assert(strm);
+  deflateStreamInit(&strm);
 
-  ret = deflateInit(strm, level);
-  assert(ret == Z_OK);
+  uLong bound = backend->deflateBound(&strm, data->size);
+  unsigned char *buf = (unsigned char *)malloc(bound);
+  assert(buf);
+
+  strm.avail_in = data->size;
+  strm.next_in = data->body;
+  strm.avail_out = bound;
+  strm.next_out = buf;
 
-  strm->avail_in = data->size;
-  strm->next_in = data->body;
+  ret = backend->deflate(&strm, Z_FINISH);
+  assert(ret == Z_STREAM_END);
+  size_t compressed = strm.total_out;
 
+  (void)backend->deflateEnd(&strm);
+  *deflateBytes = m.peak;
+
+  unsigned char *out = (unsigned char *)malloc(data->size);
+  assert(out);
+
+  memset(&strm, 0, sizeof(strm));
+  memset(&m, 0, sizeof(m));
+  strm.zalloc = memoryAlloc;
+  strm.zfree = memoryFree;
+  strm.opaque = &m;
+
+  inflateStreamInit(&strm);
+
+  strm.avail_in = compressed;
+  strm.next_in = buf;
+  strm.next_out = out;
+
+  /* Drain in small pieces like a live connection, otherwise inflate never
+     allocates its window. */
   do {
-    if (strm->avail_out == 0) {
-      unsigned char *ptr =
-        (unsigned char *)realloc(result->body, bufSize + data->size * 2);
-      assert(ptr);
+    size_t left = data->size - strm.total_out;
+    strm.avail_out = left < 16384 ? left : 16384;
 
-      result->body = ptr;
-      strm->next_out = ptr + bufSize;
-      strm->avail_out = data->size * 2;
-      bufSize += data->size;
+    ret = inflateStream(&strm, Z_NO_FLUSH);
+  } while (ret == Z_OK);
+  assert(ret == Z_STREAM_END);
+
+  (void)backend->inflateEnd(&strm);
+  *inflateBytes = m.peak;
+
+  free(out);
+  free(buf);
+}
+
+static cJSON *zlibJSON(const CONTENTS *data) {
+  const BACKEND *backend = zSettings.backend;
+
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+
+  size_t deflateBytes, inflateBytes;
+  streamMemory(data, &deflateBytes, &inflateBytes);
+
+  cJSON_AddStringToObject(json, "library", backend->name);
+  cJSON_AddStringToObject(json, "version", backend->zlibVersion());
+  cJSON_AddStringToObject(json, "format", formatNames[zSettings.format]);
+  cJSON_AddNumberToObject(json, "level", zSettings.level);
+  cJSON_AddNumberToObject(json, "windowBits", zSettings.windowBits);
+  cJSON_AddNumberToObject(json, "memLevel", zSettings.memLevel);
+  cJSON_AddStringToObject(json, "strategy", strategyNames[zSettings.strategy]);
+  cJSON_AddNumberToObject(json, "dictionary",
+                          zSettings.dictionary ?
+                          zSettings.dictionary->size : 0);
+  cJSON_AddNumberToObject(json, "deflateMemory", deflateBytes);
+  cJSON_AddNumberToObject(json, "inflateMemory", inflateBytes);
+
+  return json;
+}
+
+struct p_block {
+  const unsigned char *in;
+  size_t inSize;
+  const unsigned char *dictionary;
+  size_t dictionarySize;
+  int last;
+  unsigned char *out;
+  size_t outSize;
+  uLong check;
+};
+typedef struct p_block BLOCK;
+
+static void deflateBlock(size_t index, void *arg) {
+  const BACKEND *backend = zSettings.backend;
+
+  BLOCK *block = ((BLOCK *)arg) + index;
+
+  int ret;
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+
+  ret = backend->deflateInit2_(&strm, zSettings.level, Z_DEFLATED,
+                               -zSettings.windowBits, zSettings.memLevel,
+                               zSettings.strategy, ZLIB_VERSION,
+                               (int)sizeof(z_stream));
+  assert(ret == Z_OK);
+
+  if (block->dictionarySize) {
+    ret = backend->deflateSetDictionary(&strm, block->dictionary,
+                                        block->dictionarySize);
+    assert(ret == Z_OK);
+  }
+
+  /* Room for the sync flush marker that byte-aligns non-final blocks. */
+  size_t bound = backend->deflateBound(&strm, block->inSize) + 16;
+  block->out = (unsigned char *)malloc(bound);
+  assert(block->out);
+
+  strm.avail_in = block->inSize;
+  strm.next_in = (unsigned char *)block->in;
+  strm.avail_out = bound;
+  strm.next_out = block->out;
+
+  ret = backend->deflate(&strm, block->last ? Z_FINISH : Z_SYNC_FLUSH);
+  assert(ret == (block->last ? Z_STREAM_END : Z_OK));
+  assert(strm.avail_out > 0);
+
+  block->outSize = strm.total_out;
+  if (zSettings.format == formatGzip) {
+    block->check = backend->crc32(backend->crc32(0L, Z_NULL, 0),
+                                  block->in, block->inSize);
+  } else if (zSettings.format == formatZlib) {
+    block->check = backend->adler32(backend->adler32(0L, Z_NULL, 0),
+                                    block->in, block->inSize);
+  }
+
+  (void)backend->deflateEnd(&strm);
+}
+
+static size_t putHeader(unsigned char *p) {
+  const BACKEND *backend = zSettings.backend;
+  const CONTENTS *dictionary = zSettings.dictionary;
+
+  if (zSettings.format == formatGzip) {
+    static const unsigned char gzipHeader[10] = {
+      0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3
+    };
+    memcpy(p, gzipHeader, sizeof(gzipHeader));
+    if (zSettings.level == 9) {
+      p[8] = 2;
+    } else if (zSettings.level == 1) {
+      p[8] = 4;
     }
-    
-    ret = deflate(strm, Z_FINISH);
-    assert(ret != Z_STREAM_ERROR);
-  } while (strm->avail_in > 0);
+    return sizeof(gzipHeader);
+  } else if (zSettings.format == formatRaw) {
+    return 0;
+  }
 
-  result->size = strm->total_out;
+  int flevel;
+  if (zSettings.level == 1) {
+    flevel = 0;
+  } else if (zSettings.level >= 2 && zSettings.level <= 5) {
+    flevel = 1;
+  } else if (zSettings.level == 6 || zSettings.level == Z_DEFAULT_COMPRESSION) {
+    flevel = 2;
+  } else {
+    flevel = 3;
+  }
 
-  (void)deflateEnd(strm);
-  free(strm);
+  p[0] = ((zSettings.windowBits - 8) << 4) | Z_DEFLATED;
+  p[1] = flevel << 6;
+  if (dictionary) p[1] |= 0x20;
+  p[1] += 31 - (p[0] * 256 + p[1]) % 31;
 
-  return result;
+  if (dictionary) {
+    uLong id = backend->adler32(backend->adler32(0L, Z_NULL, 0),
+                                dictionary->body, dictionary->size);
+    for (int i = 0; i < 4; i ++) {
+      p[2 + i] = (unsigned char)(id >> ((3 - i) * 8));
+    }
+    return 6;
+  }
+  return 2;
 }
 
-static CONTENTS *inflateContent(const CONTENTS *data) {
+static size_t putTrailer(unsigned char *p, uLong check, size_t size) {
+  if (zSettings.format == formatGzip) {
+    for (int i = 0; i < 4; i ++) {
+      p[i] = (unsigned char)(check >> (i * 8));
+      p[4 + i] = (unsigned char)(size >> (i * 8));
+    }
+    return 8;
+  } else if (zSettings.format == formatRaw) {
+    return 0;
+  }
+
+  for (int i = 0; i < 4; i ++) {
+    p[i] = (unsigned char)(check >> ((3 - i) * 8));
+  }
+  return 4;
+}
+
+static CONTENTS *deflateContentParallel(const CONTENTS *data) {
+  const BACKEND *backend = zSettings.backend;
+
   assert(data != NULL);
   assert(data->body != NULL);
   assert(data->size > 0);
+  assert(blockSize > 0);
+
+  size_t count = (data->size + blockSize - 1) / blockSize;
+  BLOCK *blocks = (BLOCK *)calloc(count, sizeof(BLOCK));
+  assert(blocks);
+
+  for (size_t i = 0; i < count; i ++) {
+    size_t offset = i * blockSize;
+
+    blocks[i].in = data->body + offset;
+    blocks[i].inSize = (i == count - 1) ? data->size - offset : blockSize;
+    blocks[i].last = (i == count - 1);
+    if (i > 0) {
+      size_t window = (size_t)1 << zSettings.windowBits;
+      blocks[i].dictionarySize = offset < window ? offset : window;
+      blocks[i].dictionary = data->body + offset - blocks[i].dictionarySize;
+    } else if (zSettings.dictionary) {
+      blocks[i].dictionarySize = zSettings.dictionary->size;
+      blocks[i].dictionary = zSettings.dictionary->body;
+    }
+  }
 
-  int ret;
-  size_t bufSize = 0;
+  parallelFor(workers, count, deflateBlock, blocks);
+
+  /* Largest header (gzip) and trailer (gzip) */
+  size_t total = 10 + 8;
+  for (size_t i = 0; i < count; i ++) {
+    total += blocks[i].outSize;
+  }
 
   CONTENTS *result = calloc(1, sizeof(CONTENTS));
   assert(result);
+  result->body = (unsigned char *)malloc(total);
+  assert(result->body);
+
+  size_t offset = putHeader(result->body);
+
+  uLong check = blocks[0].check;
+  for (size_t i = 0; i < count; i ++) {
+    memcpy(result->body + offset, blocks[i].out, blocks[i].outSize);
+    offset += blocks[i].outSize;
+    if (i > 0) {
+      if (zSettings.format == formatGzip) {
+        check = backend->crc32_combine(check, blocks[i].check,
+                                       blocks[i].inSize);
+      } else {
+        check = backend->adler32_combine(check, blocks[i].check,
+                                         blocks[i].inSize);
+      }
+    }
+    free(blocks[i].out);
+  }
 
-  z_stream *strm = (z_stream *)calloc(1, sizeof(z_stream));
-  assert(strm);
+  offset += putTrailer(result->body + offset, check, data->size);
+  result->size = offset;
 
-  ret = inflateInit(strm);
-  assert(ret == Z_OK);
+  free(blocks);
+
+  return result;
+}
 
-  strm->avail_in = data->size;
-  strm->next_in = data->body;
+static RESULT *runTest(const CONTENTS *contents, unsigned int threads,
+                       struct timeval *timeout, unsigned int bufferMode) {
+  TEST *t = testNew();
+  testSetThreads(t, threads);
+  testSetTimeout(t, timeout);
+  if (blockSize) {
+    testAddRun(t, &deflateContentParallel);
+    testAddRun(t, &inflateContent);
+  } else if (bufferMode == bufferModeOneShot) {
+    testAddRun(t, &deflateContentOneShot);
+    testAddRun(t, &inflateContentOneShot);
+  } else {
+    testAddRun(t, &deflateContent);
+    testAddRun(t, &inflateContent);
+  }
+  testSetInput(t, contents);
+  testSetTesting(t, contents);
 
-   do {
-    if (strm->avail_out == 0) {
-      unsigned char *ptr =
-          (unsigned char *)realloc(result->body, bufSize + data->size * 5);
-      assert(ptr);
+  RESULT *r = testRun(t);
+  assert(r);
 
-      result->body = ptr;
-      strm->next_out = ptr + bufSize;
-      strm->avail_out = data->size * 5;
-      bufSize += data->size * 5;
+  testDestory(t);
+
+  return r;
+}
+
+static double secondsPerGB(const RESULT *r, unsigned int run) {
+  return resultAvgIntervalByRun(r, run) / 1000000.0 *
+         (double)(1 << 30) / (double)resultSampleInputByRun(r, run);
+}
+
+/* Latency of one object against the number of deflate workers, each
+   point measured by a single harness thread. */
+static cJSON *parallelJSON(const CONTENTS *contents, unsigned int threads,
+                           struct timeval *timeout, int verbose) {
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddNumberToObject(json, "blockSize", blockSize);
+
+  cJSON *pointsJSON = cJSON_CreateArray();
+  assert(pointsJSON);
+
+  double baseLatency = 0;
+  for (unsigned int w = 1; w; w = parallelNextWorkers(w, threads)) {
+    workers = w;
+
+    RESULT *r = runTest(contents, 1, timeout, bufferModeStream);
+    double latency = resultAvgIntervalByRun(r, 0);
+    if (w == 1) baseLatency = latency;
+
+    cJSON *point = cJSON_CreateObject();
+    assert(point);
+    cJSON_AddNumberToObject(point, "workers", w);
+    cJSON_AddNumberToObject(point, "deflateLatency", latency);
+    cJSON_AddNumberToObject(point, "inflateLatency",
+                            resultAvgIntervalByRun(r, 1));
+    cJSON_AddNumberToObject(point, "speedup", baseLatency / latency);
+    cJSON_AddItemToObject(point, "result", resultJSON(r, verbose));
+    cJSON_AddItemToArray(pointsJSON, point);
+
+    resultDestory(r);
+  }
+  cJSON_AddItemToObject(json, "parallel", pointsJSON);
+
+  return json;
+}
+
+/* Aggregate MiB/s of one run across all harness threads. */
+static double throughput(const RESULT *r, unsigned int run, size_t bytes) {
+  return (double)bytes / resultAvgIntervalByRun(r, run) * 1000000.0 /
+         (double)(1 << 20) * resultThreads(r);
+}
+
+/* Levels 1-9 for each selected strategy, scored on ratio against deflate
+   speed. A point is Pareto-optimal when no other point compresses at
+   least as well and at least as fast while beating it on one of them. */
+static cJSON *sweepJSON(const CONTENTS *contents, unsigned int threads,
+                        struct timeval *timeout, unsigned int bufferMode,
+                        const int *strategies, unsigned int strategyCount,
+                        int verbose) {
+  unsigned int count = strategyCount * 9;
+  double *speeds = (double *)calloc(count, sizeof(double));
+  double *ratios = (double *)calloc(count, sizeof(double));
+  assert(speeds && ratios);
+
+  int savedLevel = zSettings.level;
+  int savedStrategy = zSettings.strategy;
+
+  cJSON *pointsJSON = cJSON_CreateArray();
+  assert(pointsJSON);
+
+  for (unsigned int i = 0; i < count; i ++) {
+    zSettings.strategy = strategies[i / 9];
+    zSettings.level = i % 9 + 1;
+
+    RESULT *r = runTest(contents, threads, timeout, bufferMode);
+
+    size_t input = resultSampleInputByRun(r, 0);
+    size_t output = resultSampleOutputByRun(r, 0);
+    double deflateSec = resultAvgIntervalByRun(r, 0) / 1000000.0;
+
+    speeds[i] = throughput(r, 0, input);
+    ratios[i] = (double)input / (double)output;
+
+    cJSON *point = cJSON_CreateObject();
+    assert(point);
+    cJSON_AddNumberToObject(point, "level", zSettings.level);
+    cJSON_AddStringToObject(point, "strategy",
+                            strategyNames[zSettings.strategy]);
+    cJSON_AddBoolToObject(point, "correct", isResultCorrect(r));
+    cJSON_AddNumberToObject(point, "deflateMBps", speeds[i]);
+    cJSON_AddNumberToObject(point, "inflateMBps", throughput(r, 1, input));
+    cJSON_AddNumberToObject(point, "ratio", ratios[i]);
+    if (output < input) {
+      cJSON_AddNumberToObject(point, "cpuSecPerGBSaved",
+                              deflateSec * (double)(1 << 30) /
+                              (double)(input - output));
+    } else {
+      cJSON_AddNullToObject(point, "cpuSecPerGBSaved");
+    }
+    if (verbose) {
+      cJSON_AddItemToObject(point, "result", resultJSON(r, 0));
     }
+    cJSON_AddItemToArray(pointsJSON, point);
 
-    ret = inflate(strm, Z_FINISH);
-    assert(ret != Z_STREAM_ERROR);
-  } while (strm->avail_in > 0);
+    resultDestory(r);
+  }
 
-  result->size = strm->total_out;
+  for (unsigned int i = 0; i < count; i ++) {
+    int dominated = 0;
+    for (unsigned int j = 0; j < count && !dominated; j ++) {
+      dominated = speeds[j] >= speeds[i] && ratios[j] >= ratios[i] &&
+                  (speeds[j] > speeds[i] || ratios[j] > ratios[i]);
+    }
+    cJSON_AddBoolToObject(cJSON_GetArrayItem(pointsJSON, i), "pareto",
+                          !dominated);
+  }
 
-  (void)inflateEnd(strm);
-  free(strm);
+  zSettings.level = savedLevel;
+  zSettings.strategy = savedStrategy;
+  free(speeds);
+  free(ratios);
 
-  return result;
+  cJSON *json = cJSON_CreateObject();
+  assert(json);
+  cJSON_AddItemToObject(json, "sweep", pointsJSON);
+
+  return json;
+}
+
+static cJSON *bufferCostJSON(const RESULT *stream, const RESULT *oneShot) {
+  static const char *names[] = {"deflate", "inflate"};
+
+  cJSON *costJSON = cJSON_CreateArray();
+  assert(costJSON);
+
+  for (unsigned int i = 0; i < 2; i ++) {
+    cJSON *cost = cJSON_CreateObject();
+    assert(cost);
+
+    double streamSec = secondsPerGB(stream, i);
+    double oneShotSec = secondsPerGB(oneShot, i);
+
+    cJSON_AddStringToObject(cost, "run", names[i]);
+    cJSON_AddNumberToObject(cost, "streamSecPerGB", streamSec);
+    cJSON_AddNumberToObject(cost, "oneShotSecPerGB", oneShotSec);
+    cJSON_AddNumberToObject(cost, "bufferSecPerGB", streamSec - oneShotSec);
+    cJSON_AddItemToArray(costJSON, cost);
+  }
+
+  return costJSON;
+}
+
+static cJSON *benchJSON(const CONTENTS *contents, unsigned int threads,
+                        struct timeval *timeout, unsigned int bufferMode,
+                        const int *sweepStrategies, unsigned int sweepCount,
+                        int verbose) {
+  cJSON *json = NULL;
+
+  if (sweepCount) {
+    json = sweepJSON(contents, threads, timeout, bufferMode,
+                     sweepStrategies, sweepCount, verbose);
+  } else if (blockSize) {
+    json = parallelJSON(contents, threads, timeout, verbose);
+  } else if (bufferMode == (bufferModeStream | bufferModeOneShot)) {
+    RESULT *stream = runTest(contents, threads, timeout, bufferModeStream);
+    RESULT *oneShot = runTest(contents, threads, timeout, bufferModeOneShot);
+
+    json = cJSON_CreateObject();
+    assert(json);
+    cJSON_AddItemToObject(json, "stream", resultJSON(stream, verbose));
+    cJSON_AddItemToObject(json, "oneshot", resultJSON(oneShot, verbose));
+    cJSON_AddItemToObject(json, "bufferCost", bufferCostJSON(stream, oneShot));
+
+    resultDestory(stream);
+    resultDestory(oneShot);
+  } else {
+    RESULT *r = runTest(contents, threads, timeout, bufferMode);
+
+    /* The verbose result is an array, which has no room for the zlib
+       report. */
+    if (verbose) {
+      json = cJSON_CreateObject();
+      assert(json);
+      cJSON_AddItemToObject(json, "result", resultJSON(r, verbose));
+    } else {
+      json = resultJSON(r, verbose);
+    }
+
+    resultDestory(r);
+  }
+
+  cJSON_AddItemToObject(json, "zlib", zlibJSON(contents));
+
+  return json;
+}
+
+/* Every backend inflates the stream every other backend deflated. */
+static cJSON *crossVerifyJSON(const CONTENTS *contents, BACKEND **backends,
+                              unsigned int backendCount) {
+  cJSON *json = cJSON_CreateArray();
+  assert(json);
+
+  for (unsigned int i = 0; i < backendCount; i ++) {
+    zSettings.backend = backends[i];
+    CONTENTS *deflated = deflateContent(contents);
+
+    for (unsigned int j = 0; j < backendCount; j ++) {
+      zSettings.backend = backends[j];
+      /* NULL when the stream does not decode. */
+      CONTENTS *inflated = deflated ? inflateContent(deflated) : NULL;
+
+      cJSON *pair = cJSON_CreateObject();
+      assert(pair);
+      cJSON_AddStringToObject(pair, "deflate", backends[i]->name);
+      cJSON_AddStringToObject(pair, "inflate", backends[j]->name);
+      cJSON_AddBoolToObject(pair, "decoded", inflated != NULL);
+      cJSON_AddBoolToObject(pair, "correct",
+                            inflated && !compareContents(contents, inflated));
+      cJSON_AddItemToArray(json, pair);
+
+      if (inflated) {
+        destroyContents(inflated);
+        free(inflated);
+      }
+    }
+
+    if (deflated) {
+      destroyContents(deflated);
+      free(deflated);
+    }
+  }
+
+  return json;
 }
 
 static void printUsage() {
@@ -106,6 +597,15 @@ static void printUsage() {
           "[-r seconds <seconds, default is 3>]\n"
           "[-t threads <threads, default is logic cpu cores>]\n"
           "[-l level <levels, compress level 1-9, default is -1(6)>]\n"
+          "[-b <buffer mode>, should be stream, oneshot or all, default is stream]\n"
+          "[-s size <deflate one stream in blocks of size on 1..threads workers>]\n"
+          "[-F <format>, should be zlib, gzip or raw, default is zlib]\n"
+          "[-w windowBits <window bits 8-15, default is 15>]\n"
+          "[-M memLevel <memory level 1-9, default is 8>]\n"
+          "[-S <strategy>, should be default, filtered, huffman, rle or fixed, default is default]\n"
+          "[-D file <preset dictionary, zlib and raw format only>]\n"
+          "[-P <strategies>, sweep levels 1-9 for each comma separated strategy, or all, not with -s or -b all]\n"
+          "[-L library <zlib compatible shared library to dlopen, repeatable, linked for the built-in one>]\n"
           "[-v <verbose json output>] [-f <formated json output>]\n"
           "-u size <use random data block, size can use K, M, G>|file|url\n");
 }
@@ -121,12 +621,18 @@ int main(int argc, char **argv) {
   int verbose = 0;
   int formated = 0;
   size_t randomSize = 0;
+  unsigned int bufferMode = bufferModeStream;
+  const char *dictionaryFile = NULL;
+  int sweepStrategies[sizeof(strategyNames) / sizeof(strategyNames[0])];
+  unsigned int sweepCount = 0;
+  BACKEND **backends = NULL;
+  unsigned int backendCount = 0;
 
   int index;
   int c;
   opterr = 0;
 
-  while ((c = getopt(argc, argv, "r:t:l:vfu:")) != -1) {
+  while ((c = getopt(argc, argv, "r:t:l:b:s:F:w:M:S:D:P:L:vfu:")) != -1) {
     switch (c) {
     case 'r':
       timeout.tv_sec = atoi(optarg);
@@ -135,7 +641,101 @@ int main(int argc, char **argv) {
       threads = atoi(optarg);
       break;
     case 'l':
-      level = atoi(optarg);
+      zSettings.level = atoi(optarg);
+      break;
+    case 'b':
+      if (strcmp(optarg, "stream") == 0) {
+        bufferMode = bufferModeStream;
+      } else if (strcmp(optarg, "oneshot") == 0) {
+        bufferMode = bufferModeOneShot;
+      } else if (strcmp(optarg, "all") == 0) {
+        bufferMode = bufferModeStream | bufferModeOneShot;
+      } else {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 's':
+      blockSize = parseHumanSize(optarg);
+      if (blockSize == 0) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'F':
+      zSettings.format = -1;
+      for (int i = 0; i < sizeof(formatNames) / sizeof(formatNames[0]); i ++) {
+        if (strcmp(optarg, formatNames[i]) == 0) zSettings.format = i;
+      }
+      if (zSettings.format < 0) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'w':
+      zSettings.windowBits = atoi(optarg);
+      if (zSettings.windowBits < 8 || zSettings.windowBits > MAX_WBITS) {
+        printUsage();
+        goto END;
+      }
+      /* zlib never uses a 256 byte window, deflate would reject it for
+         raw and gzip streams. */
+      if (zSettings.windowBits == 8) zSettings.windowBits = 9;
+      break;
+    case 'M':
+      zSettings.memLevel = atoi(optarg);
+      if (zSettings.memLevel < 1 || zSettings.memLevel > MAX_MEM_LEVEL) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'S':
+      zSettings.strategy = -1;
+      for (int i = 0; i < sizeof(strategyNames) / sizeof(strategyNames[0]); i ++) {
+        if (strcmp(optarg, strategyNames[i]) == 0) zSettings.strategy = i;
+      }
+      if (zSettings.strategy < 0) {
+        printUsage();
+        goto END;
+      }
+      break;
+    case 'D':
+      dictionaryFile = optarg;
+      break;
+    case 'P': {
+      /* Each strategy at most once, "all" only on its own. */
+      int seen[sizeof(strategyNames) / sizeof(strategyNames[0])];
+      memset(seen, 0, sizeof(seen));
+      sweepCount = 0;
+      for (char *name = strtok(optarg, ","); name; name = strtok(NULL, ",")) {
+        int all = strcmp(name, "all") == 0;
+        int found = 0;
+        for (int i = 0; i < sizeof(seen) / sizeof(seen[0]); i ++) {
+          if (!all && strcmp(name, strategyNames[i]) != 0) continue;
+          if (seen[i]) {
+            found = 0;
+            break;
+          }
+          seen[i] = found = 1;
+          sweepStrategies[sweepCount ++] = i;
+        }
+        if (!found) {
+          printUsage();
+          goto END;
+        }
+      }
+      break;
+    }
+    case 'L':
+      backends = (BACKEND **)realloc(backends,
+                                     sizeof(BACKEND *) * (backendCount + 1));
+      assert(backends);
+      backends[backendCount] = backendOpen(optarg);
+      if (!backends[backendCount]) {
+        printUsage();
+        goto END;
+      }
+      backendCount ++;
       break;
     case 'u':
       randomSize = parseHumanSize(optarg);
@@ -162,6 +762,30 @@ int main(int argc, char **argv) {
       threads = 2;
   }
 
+  /* The sweep runs the harness' own threads, never parallel blocks. */
+  if (sweepCount && blockSize) {
+    fprintf(stderr, "-P cannot be combined with -s\n");
+    goto END;
+  }
+  /* Nor both buffer modes: each point is one run of one mode. */
+  if (sweepCount && bufferMode == (bufferModeStream | bufferModeOneShot)) {
+    fprintf(stderr, "-P cannot be combined with -b all\n");
+    goto END;
+  }
+
+  if (dictionaryFile) {
+    if (zSettings.format == formatGzip) {
+      fprintf(stderr, "Preset dictionary is not supported by gzip format\n");
+      goto END;
+    }
+
+    zSettings.dictionary = getContents(dictionaryFile);
+    if (zSettings.dictionary == NULL || zSettings.dictionary->size == 0) {
+      fprintf(stderr, "Get dictionary error\n");
+      goto END;
+    }
+  }
+
   if (randomSize) {
     contents = randomContents(randomSize);
   } else {
@@ -183,21 +807,34 @@ int main(int argc, char **argv) {
   }
   
 
-  TEST *t = testNew();
-  testSetThreads(t, threads);
-  testSetTimeout(t, &timeout);
-  testAddRun(t, &deflateContent);
-  testAddRun(t, &inflateContent);
-  testSetInput(t, contents);
-  testSetTesting(t, contents);
+  if (backendCount == 0) {
+    cJSON *json = benchJSON(contents, threads, &timeout, bufferMode,
+                            sweepStrategies, sweepCount, verbose);
 
-  RESULT *r = testRun(t);
-  assert(r);
+    printJSON(json, formated);
 
-  printResult(r, verbose, formated);
+    cJSON_Delete(json);
+  } else {
+    cJSON *json = cJSON_CreateObject();
+    assert(json);
+
+    cJSON *backendsJSON = cJSON_CreateArray();
+    assert(backendsJSON);
+    for (unsigned int i = 0; i < backendCount; i ++) {
+      zSettings.backend = backends[i];
+      cJSON_AddItemToArray(backendsJSON,
+                           benchJSON(contents, threads, &timeout, bufferMode,
+                                     sweepStrategies, sweepCount, verbose));
+    }
+    cJSON_AddItemToObject(json, "backends", backendsJSON);
+    cJSON_AddItemToObject(json, "crossVerify",
+                          crossVerifyJSON(contents, backends, backendCount));
+
+    printJSON(json, formated);
+
+    cJSON_Delete(json);
+  }
 
-  resultDestory(r);
-  
   ret = 0;
 
 END:
@@ -206,5 +843,14 @@ END:
     free(contents);
     contents = NULL;
   }
+  if (zSettings.dictionary) {
+    destroyContents(zSettings.dictionary);
+    free(zSettings.dictionary);
+    zSettings.dictionary = NULL;
+  }
+  for (unsigned int i = 0; i < backendCount; i ++) {
+    backendClose(backends[i]);
+  }
+  free(backends);
   return ret;
 }
\ No newline at end of file
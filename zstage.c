@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <dlfcn.h>
+
+#include "zstage.h"
+
+static BACKEND linkedBackend = {
+  "linked", NULL, zlibVersion, deflateInit2_, deflateSetDictionary,
+  deflateBound, deflate, deflateEnd, inflateInit2_, inflateSetDictionary,
+  inflate, inflateEnd, adler32, crc32, adler32_combine, crc32_combine
+};
+
+ZSETTINGS zSettings = {
+  &linkedBackend, Z_DEFAULT_COMPRESSION, formatZlib, MAX_WBITS, 8,
+  Z_DEFAULT_STRATEGY, NULL
+};
+
+BACKEND *backendOpen(const char *path) {
+  if (strcmp(path, linkedBackend.name) == 0) return &linkedBackend;
+
+  int flags = RTLD_NOW | RTLD_LOCAL;
+#ifdef RTLD_DEEPBIND
+  /* Keep the library's internal calls away from the linked zlib. */
+  flags |= RTLD_DEEPBIND;
+#endif
+
+  void *handle = dlopen(path, flags);
+  if (!handle) {
+    fprintf(stderr, "%s\n", dlerror());
+    return NULL;
+  }
+
+  BACKEND *b = (BACKEND *)calloc(1, sizeof(BACKEND));
+  assert(b);
+  b->name = path;
+  b->handle = handle;
+
+#define backendSymbol(s) \
+  if (!(*(void **)(&b->s) = dlsym(handle, #s))) { \
+    fprintf(stderr, "%s: missing %s\n", path, #s); \
+    goto ERROR; \
+  }
+  backendSymbol(zlibVersion);
+  backendSymbol(deflateInit2_);
+  backendSymbol(deflateSetDictionary);
+  backendSymbol(deflateBound);
+  backendSymbol(deflate);
+  backendSymbol(deflateEnd);
+  backendSymbol(inflateInit2_);
+  backendSymbol(inflateSetDictionary);
+  backendSymbol(inflate);
+  backendSymbol(inflateEnd);
+  backendSymbol(adler32);
+  backendSymbol(crc32);
+  backendSymbol(adler32_combine);
+  backendSymbol(crc32_combine);
+#undef backendSymbol
+
+  return b;
+ERROR:
+  dlclose(handle);
+  free(b);
+  return NULL;
+}
+
+void backendClose(BACKEND *b) {
+  if (b && b != &linkedBackend) {
+    dlclose(b->handle);
+    free(b);
+  }
+}
+
+/* One-shot streams carry the original length in front of the zlib data,
+   so inflate can size its output exactly as a real object store would
+   from its metadata. */
+#define oneShotHeaderSize 8
+
+static void putSize(unsigned char *p, uint64_t size) {
+  for (int i = 0; i < oneShotHeaderSize; i ++) {
+    p[i] = (unsigned char)(size >> (i * 8));
+  }
+}
+
+static uint64_t getSize(const unsigned char *p) {
+  uint64_t size = 0;
+  for (int i = 0; i < oneShotHeaderSize; i ++) {
+    size |= (uint64_t)p[i] << (i * 8);
+  }
+  return size;
+}
+
+static int streamWindowBits() {
+  switch (zSettings.format) {
+  case formatGzip:
+    return zSettings.windowBits + 16;
+  case formatRaw:
+    return -zSettings.windowBits;
+  }
+  return zSettings.windowBits;
+}
+
+void deflateStreamInit(z_stream *strm) {
+  const CONTENTS *dictionary = zSettings.dictionary;
+  int ret = zSettings.backend->deflateInit2_(strm, zSettings.level,
+                                             Z_DEFLATED, streamWindowBits(),
+                                             zSettings.memLevel,
+                                             zSettings.strategy, ZLIB_VERSION,
+                                             (int)sizeof(z_stream));
+  assert(ret == Z_OK);
+
+  if (dictionary) {
+    ret = zSettings.backend->deflateSetDictionary(strm, dictionary->body,
+                                                  dictionary->size);
+    assert(ret == Z_OK);
+  }
+}
+
+void inflateStreamInit(z_stream *strm) {
+  const CONTENTS *dictionary = zSettings.dictionary;
+  int ret = zSettings.backend->inflateInit2_(strm, streamWindowBits(),
+                                             ZLIB_VERSION,
+                                             (int)sizeof(z_stream));
+  assert(ret == Z_OK);
+
+  if (dictionary && zSettings.format == formatRaw) {
+    ret = zSettings.backend->inflateSetDictionary(strm, dictionary->body,
+                                                  dictionary->size);
+    assert(ret == Z_OK);
+  }
+}
+
+/* inflate() that supplies the preset dictionary when a zlib stream asks
+   for it. Errors are returned, so data from another library that does
+   not decode is reported rather than aborting. */
+int inflateStream(z_stream *strm, int flush) {
+  const CONTENTS *dictionary = zSettings.dictionary;
+  int ret = zSettings.backend->inflate(strm, flush);
+
+  if (ret == Z_NEED_DICT && dictionary) {
+    ret = zSettings.backend->inflateSetDictionary(strm, dictionary->body,
+                                                  dictionary->size);
+    if (ret != Z_OK) return ret;
+
+    ret = zSettings.backend->inflate(strm, flush);
+  }
+  assert(ret != Z_STREAM_ERROR && ret != Z_MEM_ERROR);
+
+  return ret;
+}
+
+/* Whether a streaming loop should call deflate or inflate again: only
+   after Z_OK, or a Z_BUF_ERROR that merely ran out of output space.
+   Any other error, or no progress, ends the loop. */
+static int streamProgress(const z_stream *strm, int ret) {
+  return ret == Z_OK || (ret == Z_BUF_ERROR && strm->avail_out == 0);
+}
+
+CONTENTS *deflateContent(const CONTENTS *data) {
+  assert(data != NULL);
+  assert(data->body != NULL);
+  assert(data->size > 0);
+
+  int ret;
+  size_t bufSize = 0;
+
+  CONTENTS *result = calloc(1, sizeof(CONTENTS));
+  assert(result);
+
+  z_stream *strm = (z_stream *)calloc(1, sizeof(z_stream));
+  assert(strm);
+
+  deflateStreamInit(strm);
+
+  strm->avail_in = data->size;
+  strm->next_in = data->body;
+
+  do {
+    if (strm->avail_out == 0) {
+      unsigned char *ptr =
+        (unsigned char *)realloc(result->body, bufSize + data->size * 2);
+      assert(ptr);
+
+      result->body = ptr;
+      strm->next_out = ptr + bufSize;
+      strm->avail_out = data->size * 2;
+      bufSize += data->size * 2;
+    }
+    
+    ret = zSettings.backend->deflate(strm, Z_FINISH);
+  } while (streamProgress(strm, ret));
+
+  result->size = strm->total_out;
+
+  (void)zSettings.backend->deflateEnd(strm);
+  free(strm);
+
+  if (ret != Z_STREAM_END) {
+    destroyContents(result);
+    free(result);
+    return NULL;
+  }
+
+  return result;
+}
+
+CONTENTS *inflateContent(const CONTENTS *data) {
+  assert(data != NULL);
+  assert(data->body != NULL);
+  assert(data->size > 0);
+
+  int ret;
+  size_t bufSize = 0;
+
+  CONTENTS *result = calloc(1, sizeof(CONTENTS));
+  assert(result);
+
+  z_stream *strm = (z_stream *)calloc(1, sizeof(z_stream));
+  assert(strm);
+
+  inflateStreamInit(strm);
+
+  strm->avail_in = data->size;
+  strm->next_in = data->body;
+
+  do {
+    if (strm->avail_out == 0) {
+      unsigned char *ptr =
+          (unsigned char *)realloc(result->body, bufSize + data->size * 5);
+      assert(ptr);
+
+      result->body = ptr;
+      strm->next_out = ptr + bufSize;
+      strm->avail_out = data->size * 5;
+      bufSize += data->size * 5;
+    }
+
+    ret = inflateStream(strm, Z_FINISH);
+  } while (streamProgress(strm, ret));
+
+  result->size = strm->total_out;
+
+  (void)zSettings.backend->inflateEnd(strm);
+  free(strm);
+
+  if (ret != Z_STREAM_END) {
+    destroyContents(result);
+    free(result);
+    return NULL;
+  }
+
+  return result;
+}
+
+/* z_stream counts are uInt, so one-shot buffers of 4G or more are
+   handed to zlib in pieces of at most this size. */
+#define oneShotChunk (1U << 30)
+
+/* Tops up an exhausted avail_in or avail_out from what is left. */
+static void oneShotFeed(uInt *avail, size_t *left) {
+  if (*avail || !*left) return;
+
+  *avail = *left > oneShotChunk ? oneShotChunk : *left;
+  *left -= *avail;
+}
+
+CONTENTS *deflateContentOneShot(const CONTENTS *data) {
+  assert(data != NULL);
+  assert(data->body != NULL);
+  assert(data->size > 0);
+
+  int ret;
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+
+  deflateStreamInit(&strm);
+
+  uLong bound = zSettings.backend->deflateBound(&strm, data->size);
+
+  CONTENTS *result = calloc(1, sizeof(CONTENTS));
+  assert(result);
+  result->body = (unsigned char *)malloc(oneShotHeaderSize + bound);
+  assert(result->body);
+
+  putSize(result->body, data->size);
+
+  size_t inLeft = data->size;
+  size_t outLeft = bound;
+  strm.next_in = data->body;
+  strm.next_out = result->body + oneShotHeaderSize;
+
+  /* Z_FINISH only once all the input is handed over. */
+  do {
+    oneShotFeed(&strm.avail_in, &inLeft);
+    oneShotFeed(&strm.avail_out, &outLeft);
+    ret = zSettings.backend->deflate(&strm, inLeft ? Z_NO_FLUSH : Z_FINISH);
+  } while (ret == Z_OK);
+  assert(ret == Z_STREAM_END);
+
+  result->size = oneShotHeaderSize + strm.total_out;
+
+  (void)zSettings.backend->deflateEnd(&strm);
+
+  return result;
+}
+
+CONTENTS *inflateContentOneShot(const CONTENTS *data) {
+  assert(data != NULL);
+  assert(data->body != NULL);
+  if (data->size <= oneShotHeaderSize) return NULL;
+
+  int ret;
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+
+  CONTENTS *result = calloc(1, sizeof(CONTENTS));
+  assert(result);
+  result->size = getSize(data->body);
+  /* Fails rather than aborts on a length read from data that is not a
+     one-shot stream. */
+  result->body = (unsigned char *)malloc(result->size ? result->size : 1);
+  if (!result->body) {
+    free(result);
+    return NULL;
+  }
+
+  inflateStreamInit(&strm);
+
+  size_t inLeft = data->size - oneShotHeaderSize;
+  size_t outLeft = result->size;
+  strm.next_in = data->body + oneShotHeaderSize;
+  strm.next_out = result->body;
+
+  do {
+    oneShotFeed(&strm.avail_in, &inLeft);
+    oneShotFeed(&strm.avail_out, &outLeft);
+    ret = inflateStream(&strm, inLeft || outLeft ? Z_NO_FLUSH : Z_FINISH);
+  } while (ret == Z_OK);
+
+  (void)zSettings.backend->inflateEnd(&strm);
+
+  if (ret != Z_STREAM_END || strm.total_out != result->size) {
+    destroyContents(result);
+    free(result);
+    return NULL;
+  }
+
+  return result;
+}
@@ -0,0 +1,69 @@
+#ifndef __REALITY_ZSTAGE_H
+#define __REALITY_ZSTAGE_H
+
+#include <zlib.h>
+
+#include "contents.h"
+
+/* zlib ABI entry points, taken from the linked zlib or resolved with
+   dlopen from any zlib compatible library (zlib-ng compat, patched
+   builds) so several implementations can run in one process. */
+struct z_backend {
+  const char *name;
+  void *handle;
+  const char *(*zlibVersion)(void);
+  int (*deflateInit2_)(z_streamp, int, int, int, int, int, const char *, int);
+  int (*deflateSetDictionary)(z_streamp, const Bytef *, uInt);
+  uLong (*deflateBound)(z_streamp, uLong);
+  int (*deflate)(z_streamp, int);
+  int (*deflateEnd)(z_streamp);
+  int (*inflateInit2_)(z_streamp, int, const char *, int);
+  int (*inflateSetDictionary)(z_streamp, const Bytef *, uInt);
+  int (*inflate)(z_streamp, int);
+  int (*inflateEnd)(z_streamp);
+  uLong (*adler32)(uLong, const Bytef *, uInt);
+  uLong (*crc32)(uLong, const Bytef *, uInt);
+  uLong (*adler32_combine)(uLong, uLong, z_off_t);
+  uLong (*crc32_combine)(uLong, uLong, z_off_t);
+};
+typedef struct z_backend BACKEND;
+
+/* "linked" for the linked zlib, otherwise a library path. NULL if it
+   cannot be loaded or lacks an entry point. */
+BACKEND *backendOpen(const char *path);
+void backendClose(BACKEND *b);
+
+#define formatZlib 0
+#define formatGzip 1
+#define formatRaw  2
+
+/* What every stream below is made with: zlib's defaults until changed.
+   The dictionary is preset on deflate, and on inflate when asked for. */
+struct z_settings {
+  const BACKEND *backend;
+  int level;
+  int format;
+  int windowBits;
+  int memLevel;
+  int strategy;
+  CONTENTS *dictionary;
+};
+typedef struct z_settings ZSETTINGS;
+
+extern ZSETTINGS zSettings;
+
+void deflateStreamInit(z_stream *strm);
+void inflateStreamInit(z_stream *strm);
+/* inflate() supplying the dictionary, returning errors rather than
+   aborting on data that does not decode. */
+int inflateStream(z_stream *strm, int flush);
+
+/* Harness stages, NULL on data that does not decode. Streamed stages
+   grow their output as they go; one-shot stages size it exactly, with
+   the original length carried in front of the compressed data. */
+CONTENTS *deflateContent(const CONTENTS *data);
+CONTENTS *inflateContent(const CONTENTS *data);
+CONTENTS *deflateContentOneShot(const CONTENTS *data);
+CONTENTS *inflateContentOneShot(const CONTENTS *data);
+
+#endif